@@ -0,0 +1,100 @@
+// Per-packet cost of the MQTT+UDP audio encryption with mbedtls software AES,
+// the baseline for the hardware AES path. Builds the packet the way
+// MqttProtocol::WriteAudio does and decrypts it the way its receive handler
+// does, and checks that the two agree.
+//   aes_ctr_benchmark [iterations]
+#include "host_test.h"
+
+#include <mbedtls/aes.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define MQTT_UDP_MAX_PACKET_SIZE 1500
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool Encrypt(mbedtls_aes_context& aes, const std::string& nonce, uint32_t sequence,
+    const std::vector<uint8_t>& data, std::string& udp_packet) {
+    udp_packet.resize(nonce.size() + data.size());
+    auto packet = (uint8_t*)udp_packet.data();
+    memcpy(packet, nonce.data(), nonce.size());
+    *(uint16_t*)&packet[2] = htons(data.size());
+    *(uint32_t*)&packet[12] = htonl(sequence);
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, packet, sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes, data.size(), &nc_off, nonce_counter, stream_block,
+        data.data(), packet + nonce.size()) == 0;
+}
+
+static bool Decrypt(mbedtls_aes_context& aes, const std::string& data, std::vector<uint8_t>& decrypted) {
+    decrypted.resize(data.size() - 16);
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, data.data(), sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&aes, decrypted.size(), &nc_off, nonce_counter, stream_block,
+        (const uint8_t*)data.data() + 16, decrypted.data()) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+    const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                             0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    std::string nonce("\x01\x00\x00\x00\x11\x22\x33\x44\x55\x66\x77\x88\x00\x00\x00\x00", 16);
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    CHECK(mbedtls_aes_setkey_enc(&aes, key, 128) == 0);
+
+    std::string udp_packet;
+    udp_packet.reserve(MQTT_UDP_MAX_PACKET_SIZE);
+    std::vector<uint8_t> decrypted;
+    decrypted.reserve(MQTT_UDP_MAX_PACKET_SIZE);
+
+    // 60 ms Opus frames at 16 kHz are roughly 40 to 300 bytes, 1400 is a burst
+    printf("%8s %14s %14s\n", "bytes", "encrypt ns", "decrypt ns");
+    for (size_t size : {40, 120, 300, 600, 1400}) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = (uint8_t)(i * 7 + size);
+        }
+
+        auto start = NowNs();
+        bool ok = true;
+        for (int i = 0; i < iterations; i++) {
+            ok &= Encrypt(aes, nonce, i, data, udp_packet);
+        }
+        auto encrypt_ns = (NowNs() - start) / iterations;
+
+        start = NowNs();
+        for (int i = 0; i < iterations; i++) {
+            ok &= Decrypt(aes, udp_packet, decrypted);
+        }
+        auto decrypt_ns = (NowNs() - start) / iterations;
+        printf("%8zu %14lld %14lld\n", size, (long long)encrypt_ns, (long long)decrypt_ns);
+
+        CHECK(ok);
+        CHECK(udp_packet.size() == 16 + size);
+        CHECK(memcmp(udp_packet.data() + 16, data.data(), size) != 0);
+        CHECK(decrypted == data);
+    }
+
+    // Sequence and size are part of the counter block, so equal payloads
+    // still encrypt differently
+    std::vector<uint8_t> data(100, 0x55);
+    std::string first, second;
+    Encrypt(aes, nonce, 1, data, first);
+    Encrypt(aes, nonce, 2, data, second);
+    CHECK(first.compare(16, std::string::npos, second, 16, std::string::npos) != 0);
+
+    mbedtls_aes_free(&aes);
+    return TestResult();
+}
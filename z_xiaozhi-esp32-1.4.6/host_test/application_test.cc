@@ -0,0 +1,307 @@
+// Runs the real Application on the host: a board with a simulated codec,
+// and ReplayProtocol feeding a session written here as the server side.
+// The whole turn plays out in simulated time, see HostClock.
+#include "host_test.h"
+#include "host_clock.h"
+#include "application.h"
+#include "board.h"
+#include "display.h"
+#include "audio_codec.h"
+#include "opus_codec.h"
+#include "session_recorder.h"
+#include "assets/lang_config.h"
+
+#include <esp_partition.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CLOCK_SPEED 10
+#define DOWNLINK_SAMPLE_RATE 24000
+#define REPLY_FRAMES 25
+
+// Everything the device shows or plays, in order
+class Observations {
+public:
+    void AddState(DeviceState state) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states_.push_back(state);
+        condition_variable_.notify_all();
+    }
+
+    void AddMessage(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        messages_.push_back(message);
+        condition_variable_.notify_all();
+    }
+
+    void AddPlayed(const int16_t* data, int samples) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < samples; i++) {
+            played_peak_ = std::max(played_peak_, std::abs((int)data[i]));
+        }
+        played_samples_ += samples;
+    }
+
+    // Waits up to timeout_ms of simulated time
+    bool WaitForMessage(const std::string& message, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return condition_variable_.wait_until(lock, HostClock::Deadline(timeout_ms * 1000LL), [this, &message]() {
+            return std::find(messages_.begin(), messages_.end(), message) != messages_.end();
+        });
+    }
+
+    bool WaitForStates(size_t count, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return condition_variable_.wait_until(lock, HostClock::Deadline(timeout_ms * 1000LL), [this, count]() {
+            return states_.size() >= count;
+        });
+    }
+
+    std::vector<DeviceState> states() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return states_;
+    }
+
+    bool HasMessage(const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::find(messages_.begin(), messages_.end(), message) != messages_.end();
+    }
+
+    size_t played_samples() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return played_samples_;
+    }
+
+    int played_peak() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return played_peak_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    std::vector<DeviceState> states_;
+    std::vector<std::string> messages_;
+    size_t played_samples_ = 0;
+    int played_peak_ = 0;
+};
+
+static Observations g_observations;
+
+// A microphone hearing a steady tone, or a 16 kHz mono WAV file in a loop,
+// and a speaker that takes as long to play a frame as the frame lasts, like
+// a write to a full I2S DMA buffer
+class HostCodec : public AudioCodec {
+public:
+    HostCodec() {
+        duplex_ = true;
+        input_sample_rate_ = 16000;
+        output_sample_rate_ = DOWNLINK_SAMPLE_RATE;
+    }
+
+    bool LoadInput(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        // Canonical 44 byte header: PCM, 16 bit, one channel
+        uint8_t header[44];
+        bool valid = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+            memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0 &&
+            header[20] == 1 && header[22] == 1 && header[34] == 16 &&
+            (header[24] | header[25] << 8 | header[26] << 16) == input_sample_rate_;
+        int16_t sample;
+        while (valid && fread(&sample, sizeof(sample), 1, file) == 1) {
+            input_.push_back(sample);
+        }
+        fclose(file);
+        return valid && !input_.empty();
+    }
+
+private:
+    std::vector<int16_t> input_;
+    int64_t input_position_ = 0;
+
+    int Read(int16_t* dest, int samples) override {
+        for (int i = 0; i < samples; i++, input_position_++) {
+            if (input_.empty()) {
+                dest[i] = 8000 * std::sin(2 * M_PI * 440 * input_position_ / input_sample_rate_);
+            } else {
+                dest[i] = input_[input_position_ % input_.size()];
+            }
+        }
+        return samples;
+    }
+
+    int Write(const int16_t* data, int samples) override {
+        g_observations.AddPlayed(data, samples);
+        HostClock::Sleep((int64_t)samples * 1000000 / output_sample_rate_);
+        return samples;
+    }
+};
+
+class HostDisplay : public NoDisplay {
+public:
+    void ShowNotification(const char* notification, int duration_ms = 3000) override {
+        g_observations.AddMessage(std::string("notification: ") + notification);
+    }
+    void ShowNotification(const std::string& notification, int duration_ms = 3000) override {
+        ShowNotification(notification.c_str(), duration_ms);
+    }
+    void SetChatMessage(const char* role, const char* content) override {
+        g_observations.AddMessage(std::string(role) + ": " + content);
+    }
+};
+
+class HostLed : public Led {
+public:
+    void OnStateChanged() override {
+        g_observations.AddState(Application::GetInstance().GetDeviceState());
+    }
+};
+
+class HostBoard : public Board {
+public:
+    std::string GetBoardType() override { return "wifi"; }
+    AudioCodec* GetAudioCodec() override {
+        static HostCodec codec;
+        return &codec;
+    }
+    Display* GetDisplay() override {
+        static HostDisplay display;
+        return &display;
+    }
+    Led* GetLed() override {
+        static HostLed led;
+        return &led;
+    }
+    Http* CreateHttp() override { return nullptr; }
+    WebSocket* CreateWebSocket() override { return nullptr; }
+    Mqtt* CreateMqtt() override { return nullptr; }
+    Udp* CreateUdp() override { return nullptr; }
+    void StartNetwork() override {}
+    const char* GetNetworkStateIcon() override { return ""; }
+    void SetPowerSaveMode(bool enabled) override {}
+
+private:
+    std::string GetBoardJson() override { return "{\"type\":\"host\"}"; }
+};
+
+DECLARE_BOARD(HostBoard);
+
+// Builds a session in the layout SessionRecorder saves
+class SessionWriter {
+public:
+    void AddJson(uint32_t time_ms, const std::string& json) {
+        Add(time_ms, kSessionRecordJson, (const uint8_t*)json.data(), json.size());
+    }
+
+    void AddAudio(uint32_t time_ms, const OpusPacket& opus) {
+        Add(time_ms, kSessionRecordAudio, opus.data(), opus.size());
+    }
+
+    std::vector<uint8_t> Finish(int sample_rate) {
+        SessionHeader header = {SESSION_MAGIC, SESSION_VERSION, (uint16_t)sample_rate, (uint32_t)records_.size()};
+        std::vector<uint8_t> session((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        session.insert(session.end(), records_.begin(), records_.end());
+        return session;
+    }
+
+private:
+    std::vector<uint8_t> records_;
+
+    void Add(uint32_t time_ms, SessionRecordType type, const uint8_t* data, size_t size) {
+        SessionRecord record = {time_ms, (uint8_t)type, 0, (uint16_t)size};
+        records_.insert(records_.end(), (const uint8_t*)&record, (const uint8_t*)&record + sizeof(record));
+        records_.insert(records_.end(), data, data + size);
+    }
+};
+
+// One turn: the server hears the user, answers with 1.5 s of audio and keeps
+// the channel open for another second of listening before it hangs up
+static std::vector<uint8_t> MakeSession() {
+    SessionWriter writer;
+    writer.AddJson(300, "{\"type\":\"stt\",\"text\":\"hello\"}");
+    writer.AddJson(600, "{\"type\":\"tts\",\"state\":\"start\",\"sample_rate\":24000}");
+    writer.AddJson(600, "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"Hi there\"}");
+
+    OpusPacketEncoder encoder(DOWNLINK_SAMPLE_RATE, 1, OPUS_FRAME_DURATION_MS);
+    const int frame_samples = DOWNLINK_SAMPLE_RATE / 1000 * OPUS_FRAME_DURATION_MS;
+    std::vector<OpusPacket> frames;
+    for (int i = 0; i < REPLY_FRAMES; i++) {
+        std::vector<int16_t> pcm(frame_samples);
+        for (int j = 0; j < frame_samples; j++) {
+            pcm[j] = 10000 * std::sin(2 * M_PI * 300 * (i * frame_samples + j) / DOWNLINK_SAMPLE_RATE);
+        }
+        encoder.Encode(std::move(pcm), [&frames](OpusPacket&& opus) {
+            frames.emplace_back(std::move(opus));
+        });
+    }
+    // Audio that arrives before the main loop has handled tts start is dropped
+    for (size_t i = 0; i < frames.size(); i++) {
+        writer.AddAudio(700 + i * OPUS_FRAME_DURATION_MS, frames[i]);
+    }
+    uint32_t reply_end = 700 + REPLY_FRAMES * OPUS_FRAME_DURATION_MS;
+    writer.AddJson(reply_end + 200, "{\"type\":\"tts\",\"state\":\"stop\"}");
+    writer.AddJson(reply_end + 1200, "{\"type\":\"llm\",\"emotion\":\"happy\"}");
+    return writer.Finish(DOWNLINK_SAMPLE_RATE);
+}
+
+static void TestWakeWordTurn() {
+    esp_partition_host_add(SESSION_PARTITION_LABEL, MakeSession());
+
+    auto& app = Application::GetInstance();
+    app.Start();
+    CHECK(app.GetDeviceState() == kDeviceStateIdle);
+    // The version check runs beside the main loop, it may set the state to
+    // idle until it shows the version and clears the chat message
+    CHECK(g_observations.WaitForMessage(std::string("notification: ") + Lang::Strings::VERSION + "1.4.6", 5000));
+    CHECK(g_observations.WaitForMessage("system: ", 5000));
+
+    app.WakeWordInvoke("hi");
+    const std::vector<DeviceState> expected = {
+        kDeviceStateStarting, kDeviceStateIdle,
+        kDeviceStateConnecting, kDeviceStateListening, kDeviceStateSpeaking,
+        kDeviceStateListening, kDeviceStateIdle,
+    };
+    CHECK(g_observations.WaitForStates(expected.size(), 10000));
+    auto states = g_observations.states();
+    CHECK(states == expected);
+    if (states != expected) {
+        for (auto state : states) {
+            printf("state %d\n", state);
+        }
+    }
+
+    CHECK(g_observations.HasMessage("user: hello"));
+    CHECK(g_observations.HasMessage("assistant: Hi there"));
+    // All of the reply is decoded and played, before the device listens again
+    const size_t reply_samples = REPLY_FRAMES * DOWNLINK_SAMPLE_RATE / 1000 * OPUS_FRAME_DURATION_MS;
+    CHECK(g_observations.played_samples() >= reply_samples);
+    CHECK(g_observations.played_peak() > 5000);
+}
+
+// Usage: application_test [microphone.wav]
+int main(int argc, char** argv) {
+    HostClock::SetSpeed(CLOCK_SPEED);
+    if (argc > 1) {
+        auto codec = (HostCodec*)Board::GetInstance().GetAudioCodec();
+        if (!codec->LoadInput(argv[1])) {
+            printf("%s is not a 16 kHz mono 16 bit WAV file\n", argv[1]);
+            return 1;
+        }
+    }
+    TestWakeWordTurn();
+    // The firmware's tasks never end, skip the destructors of what they use
+    int result = TestResult();
+    fflush(stdout);
+    _Exit(result);
+}
@@ -0,0 +1,62 @@
+#include "host_test.h"
+#include "histogram.h"
+
+#include <string>
+
+static void TestEmpty() {
+    Histogram histogram("empty");
+    CHECK_EQ(histogram.Percentile(50), -1);
+    CHECK(histogram.GetJson() == "{\"name\":\"empty\",\"count\":0,\"min_us\":0,\"max_us\":0,\"mean_us\":0,"
+        "\"p50_us\":-1,\"p90_us\":-1,\"p99_us\":-1}");
+}
+
+static void TestMicroseconds() {
+    // Sub-millisecond stages like encode and resample get buckets of their own
+    Histogram histogram("encode");
+    for (int i = 0; i < 90; i++) {
+        histogram.Record(40);
+    }
+    for (int i = 0; i < 9; i++) {
+        histogram.Record(180);
+    }
+    histogram.Record(900);
+    CHECK_EQ(histogram.Percentile(50), 50);
+    CHECK_EQ(histogram.Percentile(90), 50);
+    CHECK_EQ(histogram.Percentile(99), 200);
+    CHECK_EQ(histogram.Percentile(100), 1000);
+    CHECK(histogram.GetJson() == "{\"name\":\"encode\",\"count\":100,\"min_us\":40,\"max_us\":900,\"mean_us\":61,"
+        "\"p50_us\":50,\"p90_us\":50,\"p99_us\":200}");
+}
+
+static void TestBucketBounds() {
+    // Upper bounds are inclusive
+    Histogram histogram("bounds");
+    histogram.Record(75);
+    CHECK_EQ(histogram.Percentile(100), 75);
+    histogram.Reset();
+    histogram.Record(76);
+    CHECK_EQ(histogram.Percentile(100), 100);
+    histogram.Reset();
+    histogram.Record(2500000);
+    CHECK_EQ(histogram.Percentile(100), 3000000);
+}
+
+static void TestLongTail() {
+    // The open ended bucket reports the largest value seen
+    Histogram histogram("rtt");
+    for (int i = 0; i < 99; i++) {
+        histogram.Record(120000);
+    }
+    histogram.Record(12000000);
+    CHECK_EQ(histogram.Percentile(50), 150000);
+    CHECK_EQ(histogram.Percentile(99), 150000);
+    CHECK_EQ(histogram.Percentile(100), 12000000);
+}
+
+int main() {
+    TestEmpty();
+    TestMicroseconds();
+    TestBucketBounds();
+    TestLongTail();
+    return TestResult();
+}
@@ -0,0 +1,62 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Failed checks are printed and counted, main() returns TestResult()
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            TestFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        auto _a = (a); \
+        auto _b = (b); \
+        if (!(_a == _b)) { \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #a, #b); \
+            TestFailures()++; \
+        } \
+    } while (0)
+
+inline int TestResult() {
+    if (TestFailures() > 0) {
+        printf("%d check(s) failed\n", TestFailures());
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+// Heap allocations made through operator new, include from exactly one file
+// of a test that wants to count them
+#ifdef HOST_TEST_COUNT_ALLOCATIONS
+inline size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    if (void* ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+#endif
+
+#endif // HOST_TEST_H
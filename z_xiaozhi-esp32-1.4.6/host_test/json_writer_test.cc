@@ -0,0 +1,147 @@
+#define HOST_TEST_COUNT_ALLOCATIONS
+#include "host_test.h"
+#include "json_writer.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+static void TestMessage() {
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", "abc")
+        .AddString("type", "listen")
+        .AddInt("seq", -42)
+        .AddBool("flow_control", true)
+        .BeginObject("audio_params")
+            .AddInt("sample_rate", 16000)
+        .EndObject()
+        .AddRaw("states", "[1,2]")
+        .EndObject();
+    CHECK(json.ok());
+    CHECK(json.view() == R"({"session_id":"abc","type":"listen","seq":-42,"flow_control":true,)"
+        R"("audio_params":{"sample_rate":16000},"states":[1,2]})");
+    CHECK_EQ(json.size(), strlen(json.c_str()));
+}
+
+static void TestEscaping() {
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("text", "\"q\" \\ \b\f\n\r\t \x01\x1f")
+        .AddString("wake_word", "你好小智")
+        .AddString("k\"ey", "")
+        .EndObject();
+    CHECK(json.ok());
+    CHECK(json.view() == R"({"text":"\"q\" \\ \b\f\n\r\t \u0001\u001f","wake_word":"你好小智","k\"ey":""})");
+
+    // NUL inside a view is data, not the end of the string
+    StackJsonWriter<64> nul;
+    nul.BeginObject().AddString("a", std::string_view("x\0y", 3)).EndObject();
+    CHECK(nul.ok());
+    CHECK(nul.view() == R"({"a":"x\u0000y"})");
+}
+
+static void TestOverflow() {
+    // Fits exactly: 12 characters and the terminating zero
+    StackJsonWriter<13> exact;
+    exact.BeginObject().AddString("a", "1234").EndObject();
+    CHECK(exact.ok());
+    CHECK(exact.view() == R"({"a":"1234"})");
+
+    StackJsonWriter<12> small;
+    small.BeginObject().AddString("a", "1234").EndObject();
+    CHECK(!small.ok());
+    // What was written stays terminated and within the buffer
+    CHECK(small.size() < 12);
+    CHECK_EQ(strlen(small.c_str()), small.size());
+
+    // An escape sequence that does not fit whole is not written in part
+    StackJsonWriter<10> escape;
+    escape.BeginObject().AddString("a", "\x01").EndObject();
+    CHECK(!escape.ok());
+    CHECK(escape.view().find("\\u") == std::string_view::npos);
+
+    char unused;
+    JsonWriter empty(&unused, 0);
+    empty.BeginObject().EndObject();
+    CHECK(!empty.ok());
+}
+
+static void TestHeap() {
+    // Larger than any stack writer the firmware uses
+    std::string states = "[" + std::string(3000, ' ') + "]";
+    HeapJsonWriter json(states.size() + 32);
+    json.BeginObject().AddString("type", "iot").AddRaw("states", states).EndObject();
+    CHECK(json.ok());
+    CHECK_EQ(json.size(), states.size() + 24);
+    CHECK(json.view().substr(json.size() - 2) == "]}");
+
+    HeapJsonWriter small(16);
+    small.BeginObject().AddRaw("states", states).EndObject();
+    CHECK(!small.ok());
+    CHECK_EQ(strlen(small.c_str()), small.size());
+}
+
+static void TestDepth() {
+    StackJsonWriter<1024> deep;
+    deep.BeginObject();
+    for (int i = 1; i < 32; i++) {
+        deep.BeginObject("a");
+    }
+    for (int i = 1; i < 32; i++) {
+        deep.EndObject();
+    }
+    deep.EndObject();
+    CHECK(deep.ok());
+
+    StackJsonWriter<1024> too_deep;
+    too_deep.BeginObject();
+    for (int i = 1; i < 33; i++) {
+        too_deep.BeginObject("a");
+    }
+    for (int i = 1; i < 33; i++) {
+        too_deep.EndObject();
+    }
+    too_deep.EndObject();
+    CHECK(!too_deep.ok());
+
+    StackJsonWriter<64> unbalanced;
+    unbalanced.BeginObject().BeginObject("a").EndObject();
+    CHECK(!unbalanced.ok());
+
+    StackJsonWriter<64> extra_end;
+    extra_end.BeginObject().EndObject().EndObject();
+    CHECK(!extra_end.ok());
+}
+
+static void TestNoAllocations() {
+    // Session ids and wake words come in as std::string, make them before counting
+    std::string session_id(40, 's');
+    std::string wake_word = "你好小智";
+    auto before = g_allocations;
+    for (int i = 0; i < 100; i++) {
+        StackJsonWriter<256> json;
+        json.BeginObject()
+            .AddString("session_id", session_id)
+            .AddString("type", "listen")
+            .AddString("state", "detect")
+            .AddString("text", wake_word)
+            .AddInt("timestamp", 1234567890123LL)
+            .EndObject();
+        CHECK(json.ok());
+        StackJsonWriter<16> overflow;
+        overflow.BeginObject().AddString("session_id", session_id).EndObject();
+        CHECK(!overflow.ok());
+    }
+    CHECK_EQ(g_allocations, before);
+}
+
+int main() {
+    TestMessage();
+    TestEscaping();
+    TestOverflow();
+    TestHeap();
+    TestDepth();
+    TestNoAllocations();
+    return TestResult();
+}
@@ -0,0 +1,472 @@
+// Load generator: N simulated devices, each running the firmware's own
+// WebsocketProtocol or MqttProtocol on the host network clients, so the
+// send queue, frame packing and UDP encryption are the device's code.
+// Each device opens the audio channel and runs conversation turns: listen
+// start, an utterance streamed in real time as 60 ms Opus frames, silence
+// until the reply, then tts stop. The time from the end of the utterance to
+// the first reply audio is reported per device and in aggregate.
+//
+//   load_test --devices 20 --turns 5 hello.p3
+//   load_test --transport mqtt --endpoint broker:1883 --devices 20 hello.p3
+//   load_test --stand-in --transport mqtt --devices 4
+//   load_test --serve                     # only the stand-in server
+//
+// Utterances are .p3 files of 16 kHz 60 ms frames, see
+// scripts/convert_audio_to_p3.py. The websocket URL and token are built in
+// like on the device, here with -DLOAD_TEST_WEBSOCKET_URL and
+// -DLOAD_TEST_ACCESS_TOKEN. The devices offer binary protocol version 2 and
+// up to 4 frames per message, what they use is up to the server.
+#include "stand_in_server.h"
+#include "host_network.h"
+#include "host_device.h"
+#include "application.h"
+#include "board.h"
+#include "histogram.h"
+#include "opus_codec.h"
+#include "settings.h"
+#include "websocket_protocol.h"
+#include "mqtt_protocol.h"
+
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+
+using Clock = std::chrono::steady_clock;
+using Utterance = std::vector<OpusPacket>;
+
+class LoadTestBoard : public Board {
+public:
+    std::string GetBoardType() override { return "wifi"; }
+    std::string GetUuid() override {
+        char uuid[37];
+        snprintf(uuid, sizeof(uuid), "00000000-0000-4000-8000-%012x", HostDevice::current());
+        return uuid;
+    }
+    AudioCodec* GetAudioCodec() override { return nullptr; }
+    Http* CreateHttp() override { return nullptr; }
+    WebSocket* CreateWebSocket() override { return new WebSocket(); }
+    Mqtt* CreateMqtt() override { return new HostMqtt(); }
+    Udp* CreateUdp() override { return new HostUdp(); }
+    void StartNetwork() override {}
+    const char* GetNetworkStateIcon() override { return ""; }
+    void SetPowerSaveMode(bool enabled) override {}
+
+private:
+    std::string GetBoardJson() override { return "{\"type\":\"load_test\"}"; }
+};
+
+DECLARE_BOARD(LoadTestBoard);
+
+struct Options {
+    bool mqtt = false;
+    std::string endpoint;
+    std::string username;
+    std::string password;
+    int devices = 1;
+    int turns = 3;
+    bool manual = false;
+    int abort_after_ms = -1;
+    int burst_ms = 0;
+    int pause_ms = 1000;
+    int ramp_ms = 5000;
+    int timeout_ms = 30000;
+    bool stand_in = false;
+    bool serve = false;
+    StandInOptions server;
+    std::vector<std::string> utterances;
+};
+
+static Options g_options;
+static std::vector<Utterance> g_utterances;
+// An Opus packet of a 60 ms SILK frame without data, decoded as silence
+static const OpusPacket g_silence = {0x58};
+
+static Histogram g_connect("connect");
+static Histogram g_response("response");
+static Histogram g_turn("turn");
+
+// Frames in the BinaryProtocol3 layout the firmware's sounds use
+static bool LoadUtterance(const char* path, Utterance& frames) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    BinaryProtocol3 header;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        OpusPacket frame(ntohs(header.payload_size));
+        if (fread(frame.data(), 1, frame.size(), file) != frame.size()) {
+            break;
+        }
+        frames.push_back(std::move(frame));
+    }
+    fclose(file);
+    return !frames.empty();
+}
+
+// A rising tone, for the stand-in server, which only looks at frame sizes
+static Utterance MakeUtterance(int frames) {
+    Utterance utterance;
+    OpusPacketEncoder encoder(SAMPLE_RATE, 1, OPUS_FRAME_DURATION_MS);
+    const int frame_samples = SAMPLE_RATE / 1000 * OPUS_FRAME_DURATION_MS;
+    for (int i = 0; i < frames; i++) {
+        std::vector<int16_t> pcm(frame_samples);
+        for (int j = 0; j < frame_samples; j++) {
+            pcm[j] = 8000 * std::sin(2 * M_PI * (300 + 20 * i) * j / SAMPLE_RATE);
+        }
+        encoder.Encode(std::move(pcm), [&utterance](OpusPacket&& opus) {
+            utterance.push_back(std::move(opus));
+        });
+    }
+    return utterance;
+}
+
+static int64_t ElapsedUs(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count();
+}
+
+class Device {
+public:
+    explicit Device(int index) : index_(index), response_("response") {
+    }
+
+    void Run() {
+        // Settings, the Device-Id and the Client-Id are this device's
+        HostDevice::SetCurrent(index_ + 1);
+        if (g_options.mqtt) {
+            Settings settings("mqtt", true);
+            settings.SetString("endpoint", g_options.endpoint);
+            settings.SetString("client_id", "load-test-" + std::to_string(index_));
+            settings.SetString("username", g_options.username);
+            settings.SetString("password", g_options.password);
+            settings.SetString("publish_topic", "device-server");
+            protocol_ = std::make_unique<MqttProtocol>();
+        } else {
+            protocol_ = std::make_unique<WebsocketProtocol>();
+        }
+
+        protocol_->OnIncomingJson([this](const cJSON* root) {
+            auto type = cJSON_GetObjectItem(root, "type");
+            auto state = cJSON_GetObjectItem(root, "state");
+            if (!cJSON_IsString(type) || !cJSON_IsString(state) || strcmp(type->valuestring, "tts") != 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (strcmp(state->valuestring, "start") == 0) {
+                tts_started_ = true;
+            } else if (strcmp(state->valuestring, "stop") == 0) {
+                tts_stopped_ = true;
+            }
+            condition_variable_.notify_all();
+        });
+        protocol_->OnIncomingAudio([this](OpusPacket&& data) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (first_audio_time_ == Clock::time_point()) {
+                first_audio_time_ = Clock::now();
+            }
+            received_frames_++;
+        });
+        protocol_->OnNetworkError([this](const std::string& message) {
+            printf("device %d: %s\n", index_, message.c_str());
+            errors_++;
+        });
+
+        auto start_time = Clock::now();
+        protocol_->Start();
+        if (!protocol_->OpenAudioChannel()) {
+            errors_++;
+            return;
+        }
+        connect_us_ = ElapsedUs(start_time);
+        g_connect.Record(connect_us_);
+
+        for (int turn = 0; turn < g_options.turns; turn++) {
+            if (!RunTurn(turn)) {
+                errors_++;
+                break;
+            }
+        }
+        protocol_->CloseAudioChannel();
+    }
+
+    void Report() {
+        char response[32] = "-";
+        if (response_.Percentile(50) >= 0) {
+            snprintf(response, sizeof(response), "p50 %lld p90 %lld ms",
+                (long long)response_.Percentile(50) / 1000, (long long)response_.Percentile(90) / 1000);
+        }
+        SendQueueStats stats;
+        int64_t send_p90 = -1;
+        if (protocol_ != nullptr) {
+            stats = protocol_->send_queue_stats();
+            send_p90 = protocol_->send_duration().Percentile(90);
+        }
+        printf("device %d: connect %lld ms, response %s, frames received %d, sent %u, dropped %u, "
+            "max queue %zu, send p90 %lld us, errors %d\n",
+            index_, (long long)connect_us_ / 1000, response, received_frames_, (unsigned)stats.sent,
+            (unsigned)stats.dropped, stats.max_depth, (long long)send_p90, errors_.load());
+    }
+
+    int errors() const { return errors_; }
+    bool answered_every_turn() const { return turns_answered_ == g_options.turns; }
+
+private:
+    int index_;
+    std::unique_ptr<Protocol> protocol_;
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    bool tts_started_ = false;
+    bool tts_stopped_ = false;
+    Clock::time_point first_audio_time_;
+    int received_frames_ = 0;
+    int turns_answered_ = 0;
+    std::atomic<int> errors_ = 0;
+    int64_t connect_us_ = -1000;
+    Histogram response_;
+
+    // Queues frames like the encoder does, one per frame duration
+    Clock::time_point SendFrames(const Utterance& frames, Clock::time_point next_time) {
+        for (auto& frame : frames) {
+            protocol_->SendAudio(OpusPacket(frame));
+            next_time += std::chrono::milliseconds(OPUS_FRAME_DURATION_MS);
+            std::this_thread::sleep_until(next_time);
+        }
+        return next_time;
+    }
+
+    bool WaitFor(bool& flag, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return condition_variable_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&flag]() {
+            return flag;
+        });
+    }
+
+    bool RunTurn(int turn) {
+        auto& frames = g_utterances[(index_ + turn) % g_utterances.size()];
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tts_started_ = false;
+            tts_stopped_ = false;
+            first_audio_time_ = Clock::time_point();
+        }
+
+        auto turn_start = Clock::now();
+        protocol_->SendStartListening(g_options.manual ? kListeningModeManualStop : kListeningModeAutoStop);
+        // Audio captured before the channel was ready goes out in one burst,
+        // like the wake word and what the device buffered while connecting
+        size_t burst = std::min<size_t>(g_options.burst_ms / OPUS_FRAME_DURATION_MS, frames.size());
+        for (size_t i = 0; i < burst; i++) {
+            protocol_->SendAudio(OpusPacket(frames[i]), false);
+        }
+        auto next_time = SendFrames(Utterance(frames.begin() + burst, frames.end()), Clock::now());
+        auto speech_end = Clock::now();
+
+        if (g_options.manual) {
+            protocol_->SendStopListening();
+        } else {
+            // Like the device, keep streaming until the server's VAD answers
+            Utterance silence = {g_silence};
+            while (ElapsedUs(speech_end) < g_options.timeout_ms * 1000LL) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (tts_started_) {
+                        break;
+                    }
+                }
+                next_time = SendFrames(silence, next_time);
+            }
+        }
+
+        if (g_options.abort_after_ms >= 0) {
+            if (!WaitFor(tts_started_, g_options.timeout_ms)) {
+                printf("device %d: no reply in turn %d\n", index_, turn);
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(g_options.abort_after_ms));
+            protocol_->SendAbortSpeaking(kAbortReasonNone);
+        }
+        if (!WaitFor(tts_stopped_, g_options.timeout_ms)) {
+            printf("device %d: reply did not end in turn %d\n", index_, turn);
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (first_audio_time_ != Clock::time_point()) {
+                auto response_us = std::chrono::duration_cast<std::chrono::microseconds>(first_audio_time_ - speech_end).count();
+                response_.Record(response_us);
+                g_response.Record(response_us);
+                turns_answered_++;
+            }
+        }
+        g_turn.Record(ElapsedUs(turn_start));
+        protocol_->SendPing();
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_options.pause_ms));
+        return true;
+    }
+};
+
+static void PrintUsage() {
+    printf("Usage: load_test [options] [utterance.p3 ...]\n"
+        "  --transport websocket|mqtt  protocol of the devices (websocket)\n"
+        "  --endpoint host:port        MQTT broker, plain TCP\n"
+        "  --username, --password      MQTT credentials\n"
+        "  --devices N                 simulated devices (1)\n"
+        "  --turns N                   turns per device (3)\n"
+        "  --manual                    stop listening explicitly instead of the server's VAD\n"
+        "  --abort-after MS            abort every reply this long after it starts\n"
+        "  --burst MS                  queue this much of each utterance at once\n"
+        "  --pause MS                  between turns (1000)\n"
+        "  --ramp MS                   time over which devices connect (5000)\n"
+        "  --timeout MS                for a reply to start and to end (30000)\n"
+        "  --stand-in                  run the stand-in server in this process\n"
+        "  --serve                     only run the stand-in server\n"
+        "  --server-version N          binary protocol the stand-in agrees to (2)\n"
+        "  --server-frames-per-packet N  frames per message the stand-in agrees to (4)\n"
+        "  --server-delay MS           stand-in think time (300)\n"
+        "The websocket URL is %s\n", CONFIG_WEBSOCKET_URL);
+}
+
+static bool ParseOptions(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            return i + 1 < argc ? argv[++i] : "";
+        };
+        if (arg == "--transport") {
+            std::string transport = next();
+            if (transport != "websocket" && transport != "mqtt") {
+                return false;
+            }
+            g_options.mqtt = transport == "mqtt";
+        } else if (arg == "--endpoint") {
+            g_options.endpoint = next();
+        } else if (arg == "--username") {
+            g_options.username = next();
+        } else if (arg == "--password") {
+            g_options.password = next();
+        } else if (arg == "--devices") {
+            g_options.devices = std::max(1, atoi(next()));
+        } else if (arg == "--turns") {
+            g_options.turns = std::max(1, atoi(next()));
+        } else if (arg == "--manual") {
+            g_options.manual = true;
+        } else if (arg == "--abort-after") {
+            g_options.abort_after_ms = atoi(next());
+        } else if (arg == "--burst") {
+            g_options.burst_ms = atoi(next());
+        } else if (arg == "--pause") {
+            g_options.pause_ms = atoi(next());
+        } else if (arg == "--ramp") {
+            g_options.ramp_ms = atoi(next());
+        } else if (arg == "--timeout") {
+            g_options.timeout_ms = atoi(next());
+        } else if (arg == "--stand-in") {
+            g_options.stand_in = true;
+        } else if (arg == "--serve") {
+            g_options.serve = true;
+        } else if (arg == "--server-version") {
+            g_options.server.binary_version = atoi(next());
+        } else if (arg == "--server-frames-per-packet") {
+            g_options.server.frames_per_packet = atoi(next());
+        } else if (arg == "--server-delay") {
+            g_options.server.reply_delay_ms = atoi(next());
+        } else if (arg.compare(0, 2, "--") == 0) {
+            return false;
+        } else {
+            g_options.utterances.push_back(arg);
+        }
+    }
+    return true;
+}
+
+// The stand-in listens where the built in URL points, the MQTT broker anywhere
+static bool StartStandIn(StandInServer& server, bool websocket, bool mqtt) {
+    int websocket_port = -1;
+    if (websocket) {
+        std::string url = CONFIG_WEBSOCKET_URL;
+        auto colon = url.find(':', 5);
+        websocket_port = colon != std::string::npos ? atoi(url.c_str() + colon + 1) : 80;
+    }
+    if (!server.Start(websocket_port, mqtt ? 0 : -1)) {
+        printf("Failed to start the stand-in server\n");
+        return false;
+    }
+    if (mqtt && g_options.endpoint.empty()) {
+        g_options.endpoint = "127.0.0.1:" + std::to_string(server.mqtt_port());
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!ParseOptions(argc, argv)) {
+        PrintUsage();
+        return 1;
+    }
+
+    StandInServer server(g_options.server);
+    if (g_options.serve) {
+        if (!StartStandIn(server, true, true)) {
+            return 1;
+        }
+        printf("stand-in server: %s and MQTT on 127.0.0.1:%d\n", CONFIG_WEBSOCKET_URL, server.mqtt_port());
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+    if (g_options.stand_in && !StartStandIn(server, !g_options.mqtt, g_options.mqtt)) {
+        return 1;
+    }
+    if (g_options.mqtt && g_options.endpoint.empty()) {
+        printf("--transport mqtt needs --endpoint or --stand-in\n");
+        return 1;
+    }
+
+    for (auto& path : g_options.utterances) {
+        Utterance frames;
+        if (!LoadUtterance(path.c_str(), frames)) {
+            printf("%s is not a p3 file\n", path.c_str());
+            return 1;
+        }
+        g_utterances.push_back(std::move(frames));
+    }
+    if (g_utterances.empty()) {
+        if (!g_options.stand_in) {
+            printf("At least one utterance is needed, the synthetic one only suits the stand-in server\n");
+            return 1;
+        }
+        g_utterances.push_back(MakeUtterance(10));
+    }
+
+    std::vector<std::unique_ptr<Device>> devices;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < g_options.devices; i++) {
+        devices.push_back(std::make_unique<Device>(i));
+        threads.emplace_back(&Device::Run, devices.back().get());
+        // Spread the connects so the handshakes don't all land at once
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_options.ramp_ms / g_options.devices));
+    }
+    int errors = 0;
+    bool answered = true;
+    for (int i = 0; i < g_options.devices; i++) {
+        threads[i].join();
+        devices[i]->Report();
+        errors += devices[i]->errors();
+        answered = answered && devices[i]->answered_every_turn();
+    }
+    printf("%s\n%s\n%s\n", g_connect.GetJson().c_str(), g_response.GetJson().c_str(), g_turn.GetJson().c_str());
+    printf("errors: %d\n", errors);
+
+    // The protocols' tasks never end, skip the destructors of what they use
+    fflush(stdout);
+    _Exit(errors == 0 && answered ? 0 : 1);
+}
@@ -0,0 +1,82 @@
+// Protocol's message building and send queue, with a protocol that records
+// what its sender task writes
+#include "host_test.h"
+#include "protocol.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class RecordingProtocol : public Protocol {
+public:
+    RecordingProtocol() {
+        session_id_ = "session-1";
+    }
+
+    ~RecordingProtocol() {
+        StopSender();
+    }
+
+    void Start() override {}
+    bool OpenAudioChannel() override { return true; }
+    void CloseAudioChannel() override {}
+    bool IsAudioChannelOpened() const override { return true; }
+
+    // Waits for the sender task to write `count` text messages
+    std::vector<std::string> WaitTexts(size_t count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_variable_.wait_for(lock, std::chrono::seconds(5), [this, count]() {
+            return texts_.size() >= count;
+        });
+        return texts_;
+    }
+
+protected:
+    void WriteText(std::string_view text) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        texts_.emplace_back(text);
+        condition_variable_.notify_all();
+    }
+
+    void WriteAudio(const std::vector<uint8_t>& data) override {}
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    std::vector<std::string> texts_;
+};
+
+static std::string IotStatesMessage(const std::string& states) {
+    return R"({"session_id":"session-1","type":"iot","update":true,"states":)" + states + "}";
+}
+
+static void TestIotStates() {
+    RecordingProtocol protocol;
+    std::string small = R"([{"name":"Speaker","state":{"volume":70}}])";
+    // States of a board with many things do not fit the stack buffer
+    std::string large = "[";
+    for (int i = 0; i < 100; i++) {
+        large += (i > 0 ? "," : "") + std::string(R"({"name":"Lamp)") + std::to_string(i) +
+            R"(","state":{"power":true}})";
+    }
+    large += "]";
+    CHECK(large.size() > 2048);
+
+    protocol.SendIotStates(small);
+    protocol.SendIotStates(large);
+    protocol.SendPing();
+    auto texts = protocol.WaitTexts(3);
+    CHECK_EQ(texts.size(), (size_t)3);
+    if (texts.size() == 3) {
+        CHECK(texts[0] == IotStatesMessage(small));
+        CHECK(texts[1] == IotStatesMessage(large));
+        CHECK(texts[2].find(R"("type":"ping")") != std::string::npos);
+    }
+}
+
+int main() {
+    TestIotStates();
+    return TestResult();
+}
@@ -0,0 +1,210 @@
+#include "host_test.h"
+#include "rate_controller.h"
+
+#include <vector>
+#include <algorithm>
+
+#define QUEUE_SIZE 16
+
+// One second steps of an uplink with a fixed capacity: every packet costs
+// its Opus payload (at the controller's bitrate, if it picks one) plus a fixed
+// transport overhead, what the link can't carry
+// waits in the send queue (oldest packets dropped when full), and a write
+// takes as long as the backlog needs to drain.
+class ThrottledLink {
+public:
+    ThrottledLink(int capacity_bytes, int overhead_bytes = 100, int payload_bytes_per_ms = 2)
+        : capacity_bytes_(capacity_bytes), overhead_bytes_(overhead_bytes), payload_bytes_per_ms_(payload_bytes_per_ms) {
+    }
+
+    void Step(RateController& controller, int rtt_ms = -1) {
+        int duration = controller.frame_duration();
+        int payload_bytes = controller.bitrate() > 0 ? controller.bitrate() * duration / 8000 : payload_bytes_per_ms_ * duration;
+        int packet_bytes = overhead_bytes_ + payload_bytes;
+        backlog_ += packet_bytes * 1000 / duration - capacity_bytes_;
+        backlog_ = std::clamp(backlog_, 0, QUEUE_SIZE * packet_bytes);
+        size_t depth = (backlog_ + packet_bytes - 1) / packet_bytes;
+        int latency = 20 + backlog_ * 1000 / capacity_bytes_;
+        controller.Update(depth, QUEUE_SIZE, latency, rtt_ms);
+        durations_.push_back(controller.frame_duration());
+        bitrates_.push_back(controller.bitrate());
+    }
+
+    // Seconds at which the duration changed
+    std::vector<int> Changes(size_t from = 0) const {
+        std::vector<int> changes;
+        for (size_t i = std::max<size_t>(from, 1); i < durations_.size(); i++) {
+            if (durations_[i] != durations_[i - 1]) {
+                changes.push_back(i);
+            }
+        }
+        return changes;
+    }
+
+    int SecondsAt(int duration, size_t from = 0) const {
+        return std::count(durations_.begin() + from, durations_.end(), duration);
+    }
+
+    int capacity_bytes_;
+    int overhead_bytes_;
+    int payload_bytes_per_ms_;
+    int backlog_ = 0;
+    std::vector<int> durations_;
+    std::vector<int> bitrates_;
+};
+
+static void TestStockServer() {
+    // No max_frame_duration in the server hello, nothing to adapt
+    RateController controller(60, 60);
+    controller.SetMaxDuration(0);
+    ThrottledLink link(2000);
+    for (int i = 0; i < 120; i++) {
+        link.Step(controller);
+    }
+    CHECK_EQ(link.SecondsAt(60), 120);
+}
+
+static void TestFastLink() {
+    RateController controller(60, 60);
+    controller.SetMaxDuration(120);
+    ThrottledLink link(10000);
+    for (int i = 0; i < 300; i++) {
+        link.Step(controller);
+    }
+    CHECK(link.Changes().empty());
+}
+
+static void TestLinkThatFitsLongerFrames() {
+    // 60 ms frames need 3666 B/s, 80 ms frames 3250 B/s
+    RateController controller(60, 60);
+    controller.SetMaxDuration(120);
+    ThrottledLink link(3400);
+    for (int i = 0; i < 1200; i++) {
+        link.Step(controller);
+    }
+    // Backs off once and never goes longer than needed
+    CHECK(link.durations_[10] == 80);
+    CHECK(*std::max_element(link.durations_.begin(), link.durations_.end()) == 80);
+
+    // Every probe back to 60 ms fails, they must get rarer instead of flapping
+    auto changes = link.Changes();
+    int last_interval = 0;
+    for (size_t i = 2; i + 1 < changes.size(); i += 2) {
+        int interval = changes[i + 1] - changes[i - 1];
+        CHECK(interval >= last_interval);
+        last_interval = interval;
+    }
+    CHECK(last_interval >= 160);
+    CHECK(link.SecondsAt(60, 600) * 100 < 600 * 5);
+}
+
+static void TestThrottleThenRecover() {
+    RateController controller(60, 60);
+    controller.SetMaxDuration(120);
+    ThrottledLink link(2800);
+    for (int i = 0; i < 120; i++) {
+        link.Step(controller);
+    }
+    CHECK_EQ(controller.frame_duration(), 120);
+    // Only ever stepped towards longer frames while throttled
+    CHECK(std::is_sorted(link.durations_.begin(), link.durations_.end()));
+
+    link.capacity_bytes_ = 10000;
+    size_t recovered = link.durations_.size();
+    for (int i = 0; i < 300; i++) {
+        link.Step(controller);
+    }
+    CHECK_EQ(controller.frame_duration(), 60);
+    CHECK(std::is_sorted(link.durations_.begin() + recovered, link.durations_.end(), std::greater<int>()));
+    CHECK_EQ(link.Changes(recovered).size(), 3u);
+}
+
+static void TestStockServerBitrate() {
+    // 16 kbps needs 3666 B/s at 60 ms frames, 14 kbps 3416 B/s, 12 kbps 3166 B/s
+    RateController controller(60, 60, 10000, 16000);
+    controller.SetMaxDuration(0);
+    ThrottledLink link(3300);
+    for (int i = 0; i < 600; i++) {
+        link.Step(controller);
+    }
+    CHECK_EQ(link.SecondsAt(60), 600);
+    CHECK_EQ(link.bitrates_[10], 12000);
+    CHECK_EQ(*std::min_element(link.bitrates_.begin(), link.bitrates_.end()), 12000);
+    CHECK(std::count(link.bitrates_.begin() + 300, link.bitrates_.end(), 12000) * 100 > 300 * 95);
+}
+
+static void TestBitrateBeforeDuration() {
+    // Even 10 kbps needs 2916 B/s at 60 ms frames, at 80 ms it takes 2500 B/s
+    RateController controller(60, 60, 10000, 16000);
+    controller.SetMaxDuration(120);
+    ThrottledLink link(2800);
+    for (int i = 0; i < 120; i++) {
+        link.Step(controller);
+    }
+    auto first_longer = std::find_if(link.durations_.begin(), link.durations_.end(), [](int duration) {
+        return duration > 60;
+    }) - link.durations_.begin();
+    CHECK(first_longer < 120);
+    CHECK(link.bitrates_[first_longer - 1] == 10000);
+    CHECK(std::is_sorted(link.bitrates_.begin(), link.bitrates_.end(), std::greater<int>()));
+    CHECK_EQ(controller.frame_duration(), 80);
+
+    // Recovers the frame duration first, then the bitrate. The probes that
+    // failed while throttled keep the steps up apart by the longest wait.
+    link.capacity_bytes_ = 10000;
+    size_t recovered = link.durations_.size();
+    for (int i = 0; i < 800; i++) {
+        link.Step(controller);
+    }
+    CHECK_EQ(controller.frame_duration(), 60);
+    CHECK_EQ(controller.bitrate(), 16000);
+    for (size_t i = recovered; i < link.bitrates_.size(); i++) {
+        CHECK(link.bitrates_[i] == 10000 || link.durations_[i] == 60);
+    }
+}
+
+static void TestNoisyLatency() {
+    // Single congested seconds between clear ones are not enough to act on
+    RateController controller(60, 60);
+    controller.SetMaxDuration(120);
+    for (int i = 0; i < 300; i++) {
+        controller.Update(i % 2 ? 0 : QUEUE_SIZE, QUEUE_SIZE, i % 2 ? 30 : 200, i % 2 ? 100 : 700);
+        CHECK_EQ(controller.frame_duration(), 60);
+    }
+
+    // Latency between the thresholds keeps whatever was chosen
+    for (int i = 0; i < 4; i++) {
+        controller.Update(0, QUEUE_SIZE, 30, 700);
+    }
+    CHECK_EQ(controller.frame_duration(), 100);
+    for (int i = 0; i < 300; i++) {
+        controller.Update(0, QUEUE_SIZE, 100, 400);
+    }
+    CHECK_EQ(controller.frame_duration(), 100);
+}
+
+static void TestSetMaxDuration() {
+    RateController controller(60, 60);
+    controller.SetMaxDuration(120);
+    for (int i = 0; i < 20; i++) {
+        controller.Update(QUEUE_SIZE, QUEUE_SIZE, 300, -1);
+    }
+    CHECK_EQ(controller.frame_duration(), 120);
+    // A new session with a server that takes less clamps right away
+    controller.SetMaxDuration(80);
+    CHECK_EQ(controller.frame_duration(), 80);
+    controller.SetMaxDuration(0);
+    CHECK_EQ(controller.frame_duration(), 60);
+}
+
+int main() {
+    TestStockServer();
+    TestFastLink();
+    TestLinkThatFitsLongerFrames();
+    TestThrottleThenRecover();
+    TestStockServerBitrate();
+    TestBitrateBeforeDuration();
+    TestNoisyLatency();
+    TestSetMaxDuration();
+    return TestResult();
+}
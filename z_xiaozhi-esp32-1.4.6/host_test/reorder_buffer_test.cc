@@ -0,0 +1,154 @@
+#include "host_test.h"
+#include "reorder_buffer.h"
+
+#include <string>
+#include <initializer_list>
+
+// Synthetic arrival traces: every packet carries the low byte of its
+// sequence, the output lists what the decoder got, "_" for a concealed frame
+class Trace {
+public:
+    Trace(size_t window = 4, size_t max_concealed = 8) : buffer_(window, max_concealed) {
+        buffer_.OnPacket([this](OpusPacket&& payload) {
+            if (!output_.empty()) {
+                output_ += " ";
+            }
+            output_ += payload.empty() ? "_" : std::to_string(payload[0]);
+        });
+    }
+
+    // Returns what the last Push returned: packets are held for a gap
+    bool Push(std::initializer_list<uint32_t> sequences, uint8_t payload_offset = 0) {
+        bool pending = false;
+        for (auto sequence : sequences) {
+            pending = buffer_.Push(sequence, OpusPacket{(uint8_t)(sequence + payload_offset)});
+        }
+        return pending;
+    }
+
+    ReorderBuffer buffer_;
+    std::string output_;
+};
+
+static void TestInOrder() {
+    Trace trace;
+    CHECK(!trace.Push({1, 2, 3, 4, 5, 6}));
+    CHECK(trace.output_ == "1 2 3 4 5 6");
+    auto& stats = trace.buffer_.stats();
+    CHECK_EQ(stats.received, 6u);
+    CHECK_EQ(stats.lost + stats.reordered + stats.duplicated + stats.late, 0u);
+}
+
+static void TestSwapped() {
+    Trace trace;
+    CHECK(trace.Push({1, 2, 4}));
+    CHECK(trace.output_ == "1 2");
+    CHECK(!trace.Push({3, 5, 7, 6}));
+    CHECK(trace.output_ == "1 2 3 4 5 6 7");
+    CHECK_EQ(trace.buffer_.stats().reordered, 2u);
+    CHECK_EQ(trace.buffer_.stats().lost, 0u);
+}
+
+static void TestLost() {
+    // 3 never comes, its frame is concealed once the window is full
+    Trace trace;
+    trace.Push({1, 2, 4, 5, 6});
+    CHECK(trace.output_ == "1 2");
+    CHECK(!trace.Push({7, 8}));
+    CHECK(trace.output_ == "1 2 _ 4 5 6 7 8");
+    CHECK_EQ(trace.buffer_.stats().lost, 1u);
+
+    // Two missing in a row
+    Trace two;
+    two.Push({1, 4, 5, 6, 7, 8});
+    CHECK(two.output_ == "1 _ _ 4 5 6 7 8");
+    CHECK_EQ(two.buffer_.stats().lost, 2u);
+}
+
+static void TestDuplicated() {
+    // Duplicates of played packets and of held ones
+    Trace trace;
+    trace.Push({1, 2, 2, 1, 4, 4, 3});
+    CHECK(trace.output_ == "1 2 3 4");
+    auto& stats = trace.buffer_.stats();
+    CHECK_EQ(stats.duplicated, 3u);
+    CHECK_EQ(stats.late, 0u);
+    CHECK_EQ(stats.received, 7u);
+}
+
+static void TestLate() {
+    // 2 shows up after its frame was concealed: counted late, not played
+    Trace trace;
+    trace.Push({1, 3, 4, 5, 6, 2});
+    CHECK(trace.output_ == "1 _ 3 4 5 6");
+    auto& stats = trace.buffer_.stats();
+    CHECK_EQ(stats.lost, 1u);
+    CHECK_EQ(stats.late, 1u);
+    CHECK_EQ(stats.duplicated, 0u);
+}
+
+static void TestSequenceWrap() {
+    Trace trace;
+    CHECK(!trace.Push({0xfffffffe, 0xffffffff}, 5));
+    CHECK(trace.Push({1}, 5));
+    CHECK(!trace.Push({0, 2}, 5));
+    // 0xfffffffe + 5 wraps to 3
+    CHECK(trace.output_ == "3 4 5 6 7");
+    CHECK_EQ(trace.buffer_.stats().reordered, 1u);
+    CHECK_EQ(trace.buffer_.stats().lost, 0u);
+
+    // A loss right at the wrap is concealed too
+    Trace lost;
+    lost.Push({0xfffffffe, 0, 1, 2, 3}, 5);
+    CHECK(lost.output_ == "3 _ 5 6 7 8");
+    CHECK_EQ(lost.buffer_.stats().lost, 1u);
+}
+
+static void TestTimeoutFlush() {
+    // What the reorder timer does when the gap does not fill in time
+    Trace trace;
+    CHECK(trace.Push({1, 3, 4}));
+    CHECK(trace.buffer_.HasPending());
+    trace.buffer_.Flush();
+    CHECK(!trace.buffer_.HasPending());
+    CHECK(trace.output_ == "1 _ 3 4");
+    CHECK_EQ(trace.buffer_.stats().lost, 1u);
+
+    // The stream goes on from where the flush left it
+    CHECK(!trace.Push({5, 6}));
+    CHECK(trace.output_ == "1 _ 3 4 5 6");
+    trace.Push({2});
+    CHECK_EQ(trace.buffer_.stats().late, 1u);
+}
+
+static void TestLargeJump() {
+    // A restart of the server's sequence is not concealed frame by frame
+    Trace trace;
+    trace.Push({1, 2, 100});
+    CHECK(trace.output_ == "1 2 100");
+    CHECK_EQ(trace.buffer_.stats().lost, 97u);
+}
+
+static void TestReset() {
+    Trace trace;
+    trace.Push({1, 3});
+    trace.buffer_.Reset();
+    CHECK(!trace.buffer_.HasPending());
+    CHECK_EQ(trace.buffer_.stats().received, 0u);
+    // A new session may start anywhere
+    CHECK(!trace.Push({50, 51}));
+    CHECK(trace.output_ == "1 50 51");
+}
+
+int main() {
+    TestInOrder();
+    TestSwapped();
+    TestLost();
+    TestDuplicated();
+    TestLate();
+    TestSequenceWrap();
+    TestTimeoutFlush();
+    TestLargeJump();
+    TestReset();
+    return TestResult();
+}
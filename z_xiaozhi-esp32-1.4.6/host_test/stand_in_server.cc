@@ -0,0 +1,686 @@
+#include "stand_in_server.h"
+#include "host_network.h"
+
+#include <cJSON.h>
+#include <mbedtls/aes.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace HostSocket;
+
+#define FRAME_DURATION_MS 60
+// Silence encodes to a few bytes, good enough for a stand-in VAD
+#define QUIET_FRAME_SIZE 16
+#define QUIET_FRAMES_TO_REPLY 5
+
+static std::string RandomBytes(size_t size) {
+    static std::mutex mutex;
+    static std::mt19937 random(std::random_device{}());
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string bytes(size, 0);
+    for (auto& byte : bytes) {
+        byte = random();
+    }
+    return bytes;
+}
+
+static std::string HexString(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (uint8_t byte : bytes) {
+        hex.push_back(digits[byte >> 4]);
+        hex.push_back(digits[byte & 15]);
+    }
+    return hex;
+}
+
+static inline uint32_t RotateLeft(uint32_t value, int bits) {
+    return value << bits | value >> (32 - bits);
+}
+
+// Only for the websocket handshake
+static std::string Sha1(const std::string& data) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    std::string message = data;
+    uint64_t bits = (uint64_t)data.size() * 8;
+    message.push_back((char)0x80);
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        message.push_back(bits >> shift & 0xff);
+    }
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+        uint32_t w[80];
+        auto p = (const uint8_t*)message.data() + chunk;
+        for (int i = 0; i < 16; i++) {
+            w[i] = p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 | p[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t t = RotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = RotateLeft(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    std::string digest;
+    for (auto word : h) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            digest.push_back(word >> shift & 0xff);
+        }
+    }
+    return digest;
+}
+
+static std::string PrintJson(cJSON* root) {
+    char* text = cJSON_PrintUnformatted(root);
+    std::string json = text != nullptr ? text : "";
+    cJSON_free(text);
+    cJSON_Delete(root);
+    return json;
+}
+
+// Copies the options of the device's hello that the server agrees to
+static void EchoHelloOptions(const cJSON* hello, cJSON* reply) {
+    for (auto key : {"idle_timeout", "max_frame_duration", "flow_control"}) {
+        auto item = cJSON_GetObjectItem(hello, key);
+        if (item != nullptr) {
+            cJSON_AddItemToObject(reply, key, cJSON_Duplicate(item, 1));
+        }
+    }
+}
+
+// A client socket, shared with the reply thread, which may still be sending
+// when the client leaves. The socket closes with the last reference.
+struct Connection {
+    int fd;
+    std::mutex write_mutex;
+    // Websocket framing agreed in the hello, see BinaryProtocol2 and BinaryProtocolPacked
+    int version = 1;
+    bool packed = false;
+    uint32_t downlink_sequence = 0;
+    // MQTT topic the device receives on
+    std::string topic;
+
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+};
+
+// What the server does with one device session, whatever the transport
+class Conversation : public std::enable_shared_from_this<Conversation> {
+public:
+    using SendJson = std::function<void(const std::string& json)>;
+    // Frames of one message, and the stream position of the first in ms
+    using SendAudio = std::function<void(const std::vector<std::string>& frames, uint32_t timestamp)>;
+
+    Conversation(const StandInOptions& options, SendJson send_json, SendAudio send_audio)
+        : options_(options), send_json_(send_json), send_audio_(send_audio) {
+        session_id_ = HexString(RandomBytes(8));
+    }
+
+    const std::string& session_id() const { return session_id_; }
+
+    void set_frames_per_packet(int frames_per_packet) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frames_per_packet_ = frames_per_packet;
+    }
+
+    void OnJson(const cJSON* root) {
+        auto type = cJSON_GetObjectItem(root, "type");
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (!cJSON_IsString(type)) {
+            return;
+        }
+        std::string kind = type->valuestring;
+        std::string value = cJSON_IsString(state) ? state->valuestring : "";
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (kind == "listen" && value == "start") {
+            quiet_frames_ = 0;
+            listening_ = true;
+        } else if (kind == "listen" && value == "stop" && listening_) {
+            listening_ = false;
+            SpeakLocked();
+        } else if (kind == "abort") {
+            generation_++;
+            condition_variable_.notify_all();
+            lock.unlock();
+            SendTts("stop");
+        } else if (kind == "flow") {
+            paused_ = value == "pause";
+            condition_variable_.notify_all();
+        } else if (kind == "ping") {
+            auto timestamp = cJSON_GetObjectItem(root, "timestamp");
+            auto pong = cJSON_CreateObject();
+            cJSON_AddStringToObject(pong, "type", "pong");
+            cJSON_AddNumberToObject(pong, "timestamp", cJSON_IsNumber(timestamp) ? timestamp->valuedouble : 0);
+            lock.unlock();
+            send_json_(PrintJson(pong));
+        }
+    }
+
+    void OnAudio(const std::string& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Over UDP the first frames may overtake the listen start sent over
+        // MQTT, so speech is kept until a reply takes it
+        bool quiet = frame.size() < QUIET_FRAME_SIZE;
+        if (!quiet) {
+            received_.push_back(frame);
+        }
+        if (!listening_) {
+            return;
+        }
+        quiet_frames_ = quiet ? quiet_frames_ + 1 : 0;
+        if (quiet_frames_ >= QUIET_FRAMES_TO_REPLY && !received_.empty()) {
+            listening_ = false;
+            SpeakLocked();
+        }
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        condition_variable_.notify_all();
+    }
+
+private:
+    StandInOptions options_;
+    SendJson send_json_;
+    SendAudio send_audio_;
+    std::string session_id_;
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    int frames_per_packet_ = 1;
+    bool listening_ = false;
+    bool paused_ = false;
+    bool closed_ = false;
+    int quiet_frames_ = 0;
+    int generation_ = 0;    // a new reply or an abort ends the current one
+    std::vector<std::string> received_;
+
+    void SendTts(const char* state) {
+        auto json = cJSON_CreateObject();
+        cJSON_AddStringToObject(json, "session_id", session_id_.c_str());
+        cJSON_AddStringToObject(json, "type", "tts");
+        cJSON_AddStringToObject(json, "state", state);
+        send_json_(PrintJson(json));
+    }
+
+    // Plays the utterance back in real time, as many frames per message as agreed
+    void SpeakLocked() {
+        int generation = ++generation_;
+        auto self = shared_from_this();
+        std::thread([self, generation, frames = std::exchange(received_, {})]() {
+            auto next_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(self->options_.reply_delay_ms);
+            {
+                std::unique_lock<std::mutex> lock(self->mutex_);
+                if (self->condition_variable_.wait_until(lock, next_time, [&self, generation]() {
+                    return self->closed_ || self->generation_ != generation;
+                })) {
+                    return;
+                }
+            }
+            self->SendTts("start");
+            for (size_t i = 0; i < frames.size();) {
+                std::vector<std::string> group;
+                {
+                    std::unique_lock<std::mutex> lock(self->mutex_);
+                    self->condition_variable_.wait(lock, [&self, generation]() {
+                        return self->closed_ || self->generation_ != generation || !self->paused_;
+                    });
+                    if (self->closed_ || self->generation_ != generation) {
+                        return;
+                    }
+                    size_t count = std::min<size_t>(self->frames_per_packet_, frames.size() - i);
+                    group.assign(frames.begin() + i, frames.begin() + i + count);
+                }
+                self->send_audio_(group, i * FRAME_DURATION_MS);
+                i += group.size();
+                next_time += std::chrono::milliseconds(FRAME_DURATION_MS * group.size());
+                std::this_thread::sleep_until(next_time);
+            }
+            {
+                std::lock_guard<std::mutex> lock(self->mutex_);
+                if (self->closed_ || self->generation_ != generation) {
+                    return;
+                }
+            }
+            self->SendTts("stop");
+        }).detach();
+    }
+};
+
+// A device session of the MQTT side, found by the connection id in the nonce
+// of its UDP packets
+struct UdpSession {
+    std::mutex mutex;
+    mbedtls_aes_context aes;
+    std::string nonce;
+    uint32_t sequence = 0;
+    sockaddr_in address = {};
+    bool has_address = false;
+    std::shared_ptr<Conversation> conversation;
+
+    UdpSession() { mbedtls_aes_init(&aes); }
+    ~UdpSession() { mbedtls_aes_free(&aes); }
+};
+
+struct StandInServer::Impl {
+    StandInOptions options;
+    int websocket_fd = -1;
+    int mqtt_fd = -1;
+    int udp_fd = -1;
+    std::mutex sessions_mutex;
+    std::map<std::string, std::shared_ptr<UdpSession>> udp_sessions;    // by connection id
+
+    void AcceptLoop(int fd, std::function<void(int)> handler);
+    void ServeWebsocket(int fd);
+    void ServeMqtt(int fd);
+    void ServeUdp();
+    void SendUdpAudio(UdpSession& session, const std::string& frame);
+};
+
+// The handler owns the client socket
+void StandInServer::Impl::AcceptLoop(int fd, std::function<void(int)> handler) {
+    std::thread([fd, handler]() {
+        while (true) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client >= 0) {
+                std::thread(handler, client).detach();
+            }
+        }
+    }).detach();
+}
+
+void StandInServer::Impl::ServeWebsocket(int fd) {
+    auto connection = std::make_shared<Connection>(fd);
+    std::string headers;
+    if (!ReadHttpHeaders(fd, headers)) {
+        return;
+    }
+    auto key = HttpHeader(headers, "Sec-WebSocket-Key");
+    auto digest = Sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + Base64Encode((const uint8_t*)digest.data(), digest.size()) + "\r\n\r\n";
+    if (!WriteAll(fd, response.data(), response.size())) {
+        return;
+    }
+
+    auto send_text = [connection](const std::string& json) {
+        std::lock_guard<std::mutex> lock(connection->write_mutex);
+        WriteWebsocketFrame(connection->fd, 0x1, json.data(), json.size(), true, false);
+    };
+    auto send_audio = [connection](const std::vector<std::string>& frames, uint32_t timestamp) {
+        std::lock_guard<std::mutex> lock(connection->write_mutex);
+        std::string payload;
+        if (connection->packed) {
+            std::string body;
+            for (size_t i = 0; i < frames.size(); i++) {
+                uint32_t frame_timestamp = htonl(timestamp + i * FRAME_DURATION_MS);
+                uint16_t size = htons(frames[i].size());
+                body.append((const char*)&frame_timestamp, 4).append((const char*)&size, 2).append(frames[i]);
+            }
+            uint16_t size = htons(body.size());
+            payload.push_back(0);
+            payload.push_back(frames.size());
+            payload.append((const char*)&size, 2).append(body);
+        } else {
+            payload = frames[0];
+        }
+        if (connection->version >= 2) {
+            // Each reply is a new stream, its sequence starts over
+            if (timestamp == 0) {
+                connection->downlink_sequence = 0;
+            }
+            uint16_t fields16[2] = {htons(2), htons(connection->packed ? 1 : 0)};
+            uint32_t fields32[3] = {htonl(connection->downlink_sequence++), htonl(timestamp), htonl(payload.size())};
+            std::string header((const char*)fields16, sizeof(fields16));
+            header.append((const char*)fields32, sizeof(fields32));
+            payload.insert(0, header);
+        }
+        WriteWebsocketFrame(connection->fd, 0x2, payload.data(), payload.size(), true, false);
+    };
+    auto conversation = std::make_shared<Conversation>(options, send_text, send_audio);
+
+    WebsocketFrame frame;
+    while (ReadWebsocketFrame(fd, frame) && frame.opcode != 0x8) {
+        if (frame.opcode == 0x9) {
+            std::lock_guard<std::mutex> lock(connection->write_mutex);
+            WriteWebsocketFrame(fd, 0xA, frame.payload.data(), frame.payload.size(), true, false);
+            continue;
+        }
+        if (frame.opcode == 0x2) {
+            std::string data = frame.payload;
+            bool packed;
+            {
+                std::lock_guard<std::mutex> lock(connection->write_mutex);
+                packed = connection->packed;
+                if (connection->version >= 2) {
+                    if (data.size() < 16) {
+                        continue;
+                    }
+                    packed = ntohs(*(uint16_t*)&data[2]) == 1;
+                    data.erase(0, 16);
+                }
+            }
+            if (!packed) {
+                conversation->OnAudio(data);
+                continue;
+            }
+            size_t offset = 4;
+            for (int i = 0; i < (uint8_t)data[1] && offset + 6 <= data.size(); i++) {
+                size_t size = ntohs(*(uint16_t*)&data[offset + 4]);
+                conversation->OnAudio(data.substr(offset + 6, size));
+                offset += 6 + size;
+            }
+            continue;
+        }
+
+        auto root = cJSON_Parse(frame.payload.c_str());
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (cJSON_IsString(type) && strcmp(type->valuestring, "hello") == 0) {
+            auto reply = cJSON_CreateObject();
+            cJSON_AddStringToObject(reply, "type", "hello");
+            cJSON_AddStringToObject(reply, "transport", "websocket");
+            cJSON_AddStringToObject(reply, "session_id", conversation->session_id().c_str());
+            auto device_version = cJSON_GetObjectItem(root, "version");
+            bool version2 = options.binary_version >= 2 && cJSON_IsNumber(device_version) && device_version->valueint >= 2;
+            if (version2) {
+                cJSON_AddNumberToObject(reply, "version", 2);
+            }
+            auto audio_params = cJSON_AddObjectToObject(reply, "audio_params");
+            cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+            auto frames_per_packet = cJSON_GetObjectItem(cJSON_GetObjectItem(root, "audio_params"), "frames_per_packet");
+            int agreed_frames = 1;
+            if (cJSON_IsNumber(frames_per_packet) && frames_per_packet->valueint > 1 && options.frames_per_packet > 1) {
+                agreed_frames = std::min(frames_per_packet->valueint, options.frames_per_packet);
+                cJSON_AddNumberToObject(audio_params, "frames_per_packet", agreed_frames);
+            }
+            EchoHelloOptions(root, reply);
+            {
+                std::lock_guard<std::mutex> lock(connection->write_mutex);
+                connection->version = version2 ? 2 : 1;
+                connection->packed = agreed_frames > 1;
+            }
+            conversation->set_frames_per_packet(agreed_frames);
+            send_text(PrintJson(reply));
+        } else if (root != nullptr) {
+            conversation->OnJson(root);
+        }
+        cJSON_Delete(root);
+    }
+    conversation->Close();
+}
+
+// MQTT control packet types, in the high nibble of the first byte
+#define MQTT_CONNECT 0x10
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x80
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+
+static bool ReadMqttPacket(int fd, uint8_t& type, std::string& body) {
+    if (!ReadAll(fd, &type, 1)) {
+        return false;
+    }
+    size_t size = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        uint8_t byte;
+        if (!ReadAll(fd, &byte, 1)) {
+            return false;
+        }
+        size |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    body.resize(size);
+    return ReadAll(fd, body.data(), size);
+}
+
+static bool WriteMqttPacket(int fd, uint8_t type, const std::string& body) {
+    std::string packet(1, (char)type);
+    size_t size = body.size();
+    do {
+        uint8_t byte = size & 0x7f;
+        size >>= 7;
+        packet.push_back(size > 0 ? byte | 0x80 : byte);
+    } while (size > 0);
+    packet += body;
+    return WriteAll(fd, packet.data(), packet.size());
+}
+
+static std::string MqttString(const std::string& value) {
+    std::string encoded;
+    encoded.push_back(value.size() >> 8);
+    encoded.push_back(value.size() & 0xff);
+    return encoded + value;
+}
+
+void StandInServer::Impl::ServeMqtt(int fd) {
+    auto connection = std::make_shared<Connection>(fd);
+    uint8_t type;
+    std::string body;
+    if (!ReadMqttPacket(fd, type, body) || type != MQTT_CONNECT || body.size() < 12) {
+        return;
+    }
+    // The variable header of 3.1.1 is 10 bytes, the client id leads the payload
+    size_t id_size = (uint8_t)body[10] << 8 | (uint8_t)body[11];
+    connection->topic = "devices/p2p/" + body.substr(12, id_size);
+    WriteMqttPacket(fd, 0x20, std::string("\0\0", 2));
+
+    auto send_json = [connection](const std::string& json) {
+        std::lock_guard<std::mutex> lock(connection->write_mutex);
+        WriteMqttPacket(connection->fd, MQTT_PUBLISH, MqttString(connection->topic) + json);
+    };
+    std::shared_ptr<UdpSession> session;
+    auto end_session = [this, &session]() {
+        if (session == nullptr) {
+            return;
+        }
+        session->conversation->Close();
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        udp_sessions.erase(session->nonce.substr(4, 8));
+        session.reset();
+    };
+
+    while (ReadMqttPacket(fd, type, body) && type != MQTT_DISCONNECT) {
+        if (type == MQTT_PINGREQ) {
+            std::lock_guard<std::mutex> lock(connection->write_mutex);
+            WriteMqttPacket(fd, 0xD0, "");
+            continue;
+        }
+        if ((type & 0xf0) == MQTT_SUBSCRIBE && body.size() >= 2) {
+            std::lock_guard<std::mutex> lock(connection->write_mutex);
+            WriteMqttPacket(fd, 0x90, body.substr(0, 2) + std::string(1, 0));
+            continue;
+        }
+        if ((type & 0xf0) != MQTT_PUBLISH || body.size() < 2) {
+            continue;
+        }
+        size_t offset = 2 + ((uint8_t)body[0] << 8 | (uint8_t)body[1]);
+        if ((type >> 1) & 3) {
+            offset += 2;
+        }
+        auto root = cJSON_Parse(body.c_str() + std::min(offset, body.size()));
+        auto kind = cJSON_GetObjectItem(root, "type");
+        if (cJSON_IsString(kind) && strcmp(kind->valuestring, "hello") == 0) {
+            end_session();
+            session = std::make_shared<UdpSession>();
+            std::weak_ptr<UdpSession> weak_session = session;
+            session->conversation = std::make_shared<Conversation>(options, send_json,
+                [this, weak_session](const std::vector<std::string>& frames, uint32_t timestamp) {
+                    if (auto session = weak_session.lock()) {
+                        for (auto& frame : frames) {
+                            SendUdpAudio(*session, frame);
+                        }
+                    }
+                });
+            // type, reserved, size, connection id, sequence
+            session->nonce = std::string("\x01\0\0\0", 4) + RandomBytes(8) + std::string(4, 0);
+            auto key = RandomBytes(16);
+            mbedtls_aes_setkey_enc(&session->aes, (const uint8_t*)key.data(), 128);
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                udp_sessions[session->nonce.substr(4, 8)] = session;
+            }
+
+            auto reply = cJSON_CreateObject();
+            cJSON_AddStringToObject(reply, "type", "hello");
+            cJSON_AddStringToObject(reply, "transport", "udp");
+            cJSON_AddStringToObject(reply, "session_id", session->conversation->session_id().c_str());
+            auto audio_params = cJSON_AddObjectToObject(reply, "audio_params");
+            cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+            auto udp = cJSON_AddObjectToObject(reply, "udp");
+            cJSON_AddStringToObject(udp, "server", "127.0.0.1");
+            cJSON_AddNumberToObject(udp, "port", LocalPort(udp_fd));
+            cJSON_AddStringToObject(udp, "encryption", "aes-128-ctr");
+            cJSON_AddStringToObject(udp, "key", HexString(key).c_str());
+            cJSON_AddStringToObject(udp, "nonce", HexString(session->nonce).c_str());
+            EchoHelloOptions(root, reply);
+            send_json(PrintJson(reply));
+        } else if (cJSON_IsString(kind) && strcmp(kind->valuestring, "goodbye") == 0) {
+            end_session();
+        } else if (root != nullptr && session != nullptr) {
+            session->conversation->OnJson(root);
+        }
+        cJSON_Delete(root);
+    }
+    end_session();
+}
+
+// Packet = nonce with the payload size and sequence filled in + AES-CTR
+// encrypted payload, the nonce being the counter block
+void StandInServer::Impl::SendUdpAudio(UdpSession& session, const std::string& frame) {
+    std::lock_guard<std::mutex> lock(session.mutex);
+    if (!session.has_address) {
+        return;
+    }
+    std::string packet = session.nonce;
+    *(uint16_t*)&packet[2] = htons(frame.size());
+    *(uint32_t*)&packet[12] = htonl(++session.sequence);
+    uint8_t counter[16];
+    memcpy(counter, packet.data(), sizeof(counter));
+    uint8_t stream_block[16] = {};
+    size_t offset = 0;
+    packet.resize(16 + frame.size());
+    mbedtls_aes_crypt_ctr(&session.aes, frame.size(), &offset, counter, stream_block,
+        (const uint8_t*)frame.data(), (uint8_t*)&packet[16]);
+    sendto(udp_fd, packet.data(), packet.size(), 0, (sockaddr*)&session.address, sizeof(session.address));
+}
+
+void StandInServer::Impl::ServeUdp() {
+    std::thread([this]() {
+        std::string packet;
+        while (true) {
+            sockaddr_in address = {};
+            socklen_t address_size = sizeof(address);
+            packet.resize(2048);
+            auto ret = recvfrom(udp_fd, packet.data(), packet.size(), 0, (sockaddr*)&address, &address_size);
+            if (ret < 16 || packet[0] != 0x01) {
+                continue;
+            }
+            packet.resize(ret);
+            std::shared_ptr<UdpSession> session;
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                auto it = udp_sessions.find(packet.substr(4, 8));
+                if (it == udp_sessions.end()) {
+                    continue;
+                }
+                session = it->second;
+            }
+            std::string frame(ret - 16, 0);
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                // Replies go to wherever the device sends from
+                session->address = address;
+                session->has_address = true;
+                uint8_t counter[16];
+                memcpy(counter, packet.data(), sizeof(counter));
+                uint8_t stream_block[16] = {};
+                size_t offset = 0;
+                mbedtls_aes_crypt_ctr(&session->aes, frame.size(), &offset, counter, stream_block,
+                    (const uint8_t*)packet.data() + 16, (uint8_t*)frame.data());
+            }
+            session->conversation->OnAudio(frame);
+        }
+    }).detach();
+}
+
+StandInServer::StandInServer(const StandInOptions& options) : impl_(new Impl()) {
+    impl_->options = options;
+}
+
+StandInServer::~StandInServer() {
+}
+
+bool StandInServer::Start(int websocket_port, int mqtt_port) {
+    if (websocket_port >= 0) {
+        impl_->websocket_fd = Listen(websocket_port);
+        if (impl_->websocket_fd < 0) {
+            return false;
+        }
+        impl_->AcceptLoop(impl_->websocket_fd, [this](int fd) {
+            impl_->ServeWebsocket(fd);
+        });
+    }
+    if (mqtt_port >= 0) {
+        impl_->mqtt_fd = Listen(mqtt_port);
+        impl_->udp_fd = Listen(0, true);
+        if (impl_->mqtt_fd < 0 || impl_->udp_fd < 0) {
+            return false;
+        }
+        impl_->ServeUdp();
+        impl_->AcceptLoop(impl_->mqtt_fd, [this](int fd) {
+            impl_->ServeMqtt(fd);
+        });
+    }
+    return true;
+}
+
+int StandInServer::websocket_port() const {
+    return impl_->websocket_fd >= 0 ? LocalPort(impl_->websocket_fd) : -1;
+}
+
+int StandInServer::mqtt_port() const {
+    return impl_->mqtt_fd >= 0 ? LocalPort(impl_->mqtt_fd) : -1;
+}
@@ -0,0 +1,36 @@
+#ifndef STAND_IN_SERVER_H
+#define STAND_IN_SERVER_H
+
+#include <memory>
+#include <string>
+
+struct StandInOptions {
+    int binary_version = 2;         // highest websocket binary protocol agreed to
+    int frames_per_packet = 4;      // most Opus frames per websocket message agreed to
+    int reply_delay_ms = 300;       // think time before a reply starts
+};
+
+// A conversation server for the load generator to try the firmware's
+// protocols against: websocket, or an MQTT broker and UDP audio with the
+// AES-CTR encryption of MqttProtocol. It answers after listen stop, or
+// after a few quiet frames in auto mode, with the utterance it received,
+// and agrees to the hello options the device offers.
+class StandInServer {
+public:
+    explicit StandInServer(const StandInOptions& options);
+    ~StandInServer();
+    StandInServer(const StandInServer&) = delete;
+    StandInServer& operator=(const StandInServer&) = delete;
+
+    // Port 0 picks a free port, -1 leaves the transport off. The servers run
+    // on threads of their own until the process ends.
+    bool Start(int websocket_port, int mqtt_port);
+    int websocket_port() const;
+    int mqtt_port() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+#endif // STAND_IN_SERVER_H
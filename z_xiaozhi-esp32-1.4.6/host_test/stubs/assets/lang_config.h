@@ -0,0 +1,73 @@
+// Host build of the generated language config: the en-US strings, and
+// empty sounds since the .p3 files are only embedded in the firmware image
+#pragma once
+
+#include <string_view>
+
+namespace Lang {
+    constexpr const char* CODE = "en-US";
+
+    namespace Strings {
+        constexpr const char* ACCESS_VIA_BROWSER = " Config URL: ";
+        constexpr const char* ACTIVATION = "Activation";
+        constexpr const char* BATTERY_CHARGING = "Charging";
+        constexpr const char* BATTERY_FULL = "Battery full";
+        constexpr const char* BATTERY_LOW = "Low battery";
+        constexpr const char* BATTERY_NEED_CHARGE = "Low battery, please charge";
+        constexpr const char* CONNECTED_TO = "Connected to ";
+        constexpr const char* CONNECTING = "Connecting...";
+        constexpr const char* CONNECTION_SUCCESSFUL = "Connection Successful";
+        constexpr const char* CONNECT_TO = "Connect to ";
+        constexpr const char* CONNECT_TO_HOTSPOT = "Hotspot: ";
+        constexpr const char* DETECTING_MODULE = "Detecting module...";
+        constexpr const char* ENTERING_WIFI_CONFIG_MODE = "Entering Wi-Fi configuration mode...";
+        constexpr const char* ERROR = "Error";
+        constexpr const char* INFO = "Information";
+        constexpr const char* INITIALIZING = "Initializing...";
+        constexpr const char* LISTENING = "Listening...";
+        constexpr const char* LOADING_PROTOCOL = "Loading Protocol...";
+        constexpr const char* MAX_VOLUME = "Max volume";
+        constexpr const char* MUTED = "Muted";
+        constexpr const char* NEW_VERSION = "New version ";
+        constexpr const char* OTA_UPGRADE = "OTA Upgrade";
+        constexpr const char* PIN_ERROR = "Please insert SIM card";
+        constexpr const char* REGISTERING_NETWORK = "Waiting for network...";
+        constexpr const char* REG_ERROR = "Unable to access network, please check SIM card status";
+        constexpr const char* SCANNING_WIFI = "Scanning Wi-Fi...";
+        constexpr const char* SERVER_ERROR = "Sending failed, please check the network";
+        constexpr const char* SERVER_NOT_CONNECTED = "Unable to connect to service, please try again later";
+        constexpr const char* SERVER_NOT_FOUND = "Looking for available service";
+        constexpr const char* SERVER_TIMEOUT = "Waiting for response timeout";
+        constexpr const char* SPEAKING = "Speaking...";
+        constexpr const char* STANDBY = "Standby";
+        constexpr const char* UPGRADE_FAILED = "Upgrade failed";
+        constexpr const char* UPGRADING = "System is upgrading...";
+        constexpr const char* VERSION = "Ver ";
+        constexpr const char* VOLUME = "Volume ";
+        constexpr const char* WARNING = "Warning";
+        constexpr const char* WIFI_CONFIG_MODE = "Wi-Fi Configuration Mode";
+    }
+
+    namespace Sounds {
+        constexpr std::string_view P3_0;
+        constexpr std::string_view P3_1;
+        constexpr std::string_view P3_2;
+        constexpr std::string_view P3_3;
+        constexpr std::string_view P3_4;
+        constexpr std::string_view P3_5;
+        constexpr std::string_view P3_6;
+        constexpr std::string_view P3_7;
+        constexpr std::string_view P3_8;
+        constexpr std::string_view P3_9;
+        constexpr std::string_view P3_ACTIVATION;
+        constexpr std::string_view P3_ERR_PIN;
+        constexpr std::string_view P3_ERR_REG;
+        constexpr std::string_view P3_EXCLAMATION;
+        constexpr std::string_view P3_LOW_BATTERY;
+        constexpr std::string_view P3_SUCCESS;
+        constexpr std::string_view P3_UPGRADE;
+        constexpr std::string_view P3_VIBRATION;
+        constexpr std::string_view P3_WELCOME;
+        constexpr std::string_view P3_WIFICONFIG;
+    }
+}
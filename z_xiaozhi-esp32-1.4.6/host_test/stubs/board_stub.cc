@@ -0,0 +1,137 @@
+// Host versions of the Board, Display and AudioCodec base classes. A host
+// board derives from Board as usual and registers with DECLARE_BOARD; its
+// codec only implements Read and Write.
+#include "board.h"
+#include "display.h"
+#include "audio_codec.h"
+
+#include <thread>
+
+#include "host_clock.h"
+
+// The I2S DMA of the device raises an event for every buffer, the host
+// codec for every frame of this length
+#define HOST_CODEC_FRAME_MS 30
+
+Board::Board() {
+    uuid_ = GenerateUuid();
+}
+
+std::string Board::GenerateUuid() {
+    return "00000000-0000-4000-8000-000000000001";
+}
+
+bool Board::GetBatteryLevel(int& level, bool& charging) {
+    return false;
+}
+
+Display* Board::GetDisplay() {
+    static NoDisplay display;
+    return &display;
+}
+
+Led* Board::GetLed() {
+    static NoLed led;
+    return &led;
+}
+
+std::string Board::GetJson() {
+    return "{\"version\":2,\"uuid\":\"" + uuid_ + "\",\"board\":" + GetBoardJson() + "}";
+}
+
+Display::Display() {
+}
+
+Display::~Display() {
+}
+
+void Display::SetStatus(const char* status) {
+}
+
+void Display::ShowNotification(const std::string& notification, int duration_ms) {
+    ShowNotification(notification.c_str(), duration_ms);
+}
+
+void Display::ShowNotification(const char* notification, int duration_ms) {
+}
+
+void Display::Update() {
+}
+
+void Display::SetEmotion(const char* emotion) {
+}
+
+void Display::SetIcon(const char* icon) {
+}
+
+void Display::SetChatMessage(const char* role, const char* content) {
+}
+
+AudioCodec::AudioCodec() {
+}
+
+AudioCodec::~AudioCodec() {
+}
+
+void AudioCodec::OnInputReady(std::function<bool()> callback) {
+    on_input_ready_ = callback;
+}
+
+void AudioCodec::OnOutputReady(std::function<bool()> callback) {
+    on_output_ready_ = callback;
+}
+
+void AudioCodec::OutputData(std::vector<int16_t>& data) {
+    Write(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(std::vector<int16_t>& data) {
+    int input_frame_size = input_sample_rate_ / 1000 * HOST_CODEC_FRAME_MS * input_channels_;
+    data.resize(input_frame_size);
+    int samples = Read(data.data(), data.size());
+    return samples > 0;
+}
+
+bool AudioCodec::on_sent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto audio_codec = (AudioCodec*)user_ctx;
+    if (audio_codec->output_enabled_ && audio_codec->on_output_ready_) {
+        return audio_codec->on_output_ready_();
+    }
+    return false;
+}
+
+bool AudioCodec::on_recv(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto audio_codec = (AudioCodec*)user_ctx;
+    if (audio_codec->input_enabled_ && audio_codec->on_input_ready_) {
+        return audio_codec->on_input_ready_();
+    }
+    return false;
+}
+
+// Stands in for the DMA interrupts: both fire once per frame of simulated time
+void AudioCodec::Start() {
+    std::thread([this]() {
+        int64_t due = HostClock::Now();
+        while (true) {
+            due += HOST_CODEC_FRAME_MS * 1000;
+            HostClock::Sleep(due - HostClock::Now());
+            on_recv(rx_handle_, nullptr, this);
+            on_sent(tx_handle_, nullptr, this);
+        }
+    }).detach();
+
+    EnableInput(true);
+    EnableOutput(true);
+}
+
+void AudioCodec::SetOutputVolume(int volume) {
+    output_volume_ = volume;
+}
+
+void AudioCodec::EnableInput(bool enable) {
+    input_enabled_ = enable;
+}
+
+void AudioCodec::EnableOutput(bool enable) {
+    output_enabled_ = enable;
+}
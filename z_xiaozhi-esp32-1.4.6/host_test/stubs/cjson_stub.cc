@@ -0,0 +1,503 @@
+// Host stand-in for cJSON, see stubs/cJSON.h
+#include <cJSON.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+static char* CopyString(const char* string) {
+    size_t length = strlen(string) + 1;
+    auto copy = (char*)malloc(length);
+    memcpy(copy, string, length);
+    return copy;
+}
+
+static cJSON* NewItem(int type) {
+    auto item = (cJSON*)calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+void* cJSON_malloc(size_t size) {
+    return malloc(size);
+}
+
+void cJSON_free(void* object) {
+    free(object);
+}
+
+void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        cJSON* next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+namespace {
+
+class Parser {
+public:
+    Parser(const char* data, size_t length) : p_(data), end_(data + length) {}
+
+    cJSON* ParseDocument() {
+        cJSON* item = ParseValue(0);
+        SkipSpace();
+        if (item != nullptr && p_ != end_ && *p_ != '\0') {
+            cJSON_Delete(item);
+            return nullptr;
+        }
+        return item;
+    }
+
+private:
+    static constexpr int kMaxDepth = 1000;
+    const char* p_;
+    const char* end_;
+
+    void SkipSpace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+            p_++;
+        }
+    }
+
+    bool Match(const char* literal) {
+        size_t length = strlen(literal);
+        if ((size_t)(end_ - p_) < length || strncmp(p_, literal, length) != 0) {
+            return false;
+        }
+        p_ += length;
+        return true;
+    }
+
+    static void AppendUtf8(std::string& out, unsigned int code) {
+        if (code < 0x80) {
+            out += (char)code;
+        } else if (code < 0x800) {
+            out += (char)(0xc0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += (char)(0xe0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        } else {
+            out += (char)(0xf0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3f));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+    }
+
+    bool ParseHex4(unsigned int& code) {
+        if (end_ - p_ < 4) {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *p_++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    char* ParseString() {
+        if (p_ >= end_ || *p_ != '"') {
+            return nullptr;
+        }
+        p_++;
+        std::string out;
+        while (p_ < end_ && *p_ != '"') {
+            char c = *p_++;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (p_ >= end_) {
+                return nullptr;
+            }
+            c = *p_++;
+            switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned int code;
+                if (!ParseHex4(code)) {
+                    return nullptr;
+                }
+                if (code >= 0xd800 && code < 0xdc00) {
+                    unsigned int low;
+                    if (!Match("\\u") || !ParseHex4(low) || low < 0xdc00 || low >= 0xe000) {
+                        return nullptr;
+                    }
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default:
+                return nullptr;
+            }
+        }
+        if (p_ >= end_) {
+            return nullptr;
+        }
+        p_++;
+        return CopyString(out.c_str());
+    }
+
+    cJSON* ParseNumber() {
+        std::string text;
+        while (p_ < end_ && strchr("+-0123456789.eE", *p_) != nullptr) {
+            text += *p_++;
+        }
+        char* text_end;
+        double number = strtod(text.c_str(), &text_end);
+        if (text.empty() || *text_end != '\0') {
+            return nullptr;
+        }
+        return cJSON_CreateNumber(number);
+    }
+
+    cJSON* ParseValue(int depth) {
+        if (depth > kMaxDepth) {
+            return nullptr;
+        }
+        SkipSpace();
+        if (p_ >= end_) {
+            return nullptr;
+        }
+        if (Match("null")) return NewItem(cJSON_NULL);
+        if (Match("true")) return NewItem(cJSON_True);
+        if (Match("false")) return NewItem(cJSON_False);
+        if (*p_ == '"') {
+            char* string = ParseString();
+            if (string == nullptr) {
+                return nullptr;
+            }
+            cJSON* item = NewItem(cJSON_String);
+            item->valuestring = string;
+            return item;
+        }
+        if (*p_ == '[' || *p_ == '{') {
+            return ParseContainer(depth);
+        }
+        return ParseNumber();
+    }
+
+    cJSON* ParseContainer(int depth) {
+        bool object = *p_++ == '{';
+        char close = object ? '}' : ']';
+        cJSON* container = NewItem(object ? cJSON_Object : cJSON_Array);
+        SkipSpace();
+        if (p_ < end_ && *p_ == close) {
+            p_++;
+            return container;
+        }
+        cJSON* last = nullptr;
+        while (true) {
+            char* name = nullptr;
+            if (object) {
+                SkipSpace();
+                name = ParseString();
+                SkipSpace();
+                if (name == nullptr || p_ >= end_ || *p_++ != ':') {
+                    free(name);
+                    cJSON_Delete(container);
+                    return nullptr;
+                }
+            }
+            cJSON* item = ParseValue(depth + 1);
+            if (item == nullptr) {
+                free(name);
+                cJSON_Delete(container);
+                return nullptr;
+            }
+            item->string = name;
+            if (last == nullptr) {
+                container->child = item;
+            } else {
+                last->next = item;
+                item->prev = last;
+            }
+            last = item;
+            container->child->prev = last;
+            SkipSpace();
+            if (p_ < end_ && *p_ == ',') {
+                p_++;
+                continue;
+            }
+            if (p_ < end_ && *p_ == close) {
+                p_++;
+                return container;
+            }
+            cJSON_Delete(container);
+            return nullptr;
+        }
+    }
+};
+
+void PrintString(std::string& out, const char* string) {
+    out += '"';
+    for (const char* p = string; *p != '\0'; p++) {
+        unsigned char c = *p;
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            } else {
+                out += (char)c;
+            }
+        }
+    }
+    out += '"';
+}
+
+void PrintValue(std::string& out, const cJSON* item) {
+    switch (item->type & 0xff) {
+    case cJSON_NULL: out += "null"; break;
+    case cJSON_True: out += "true"; break;
+    case cJSON_False: out += "false"; break;
+    case cJSON_Raw: out += item->valuestring != nullptr ? item->valuestring : ""; break;
+    case cJSON_String: PrintString(out, item->valuestring != nullptr ? item->valuestring : ""); break;
+    case cJSON_Number: {
+        char number[32];
+        double value = item->valuedouble;
+        if (std::isnan(value) || std::isinf(value)) {
+            snprintf(number, sizeof(number), "null");
+        } else if (value == (double)(long long)value && std::fabs(value) < 1e15) {
+            snprintf(number, sizeof(number), "%lld", (long long)value);
+        } else {
+            snprintf(number, sizeof(number), "%.17g", value);
+        }
+        out += number;
+        break;
+    }
+    case cJSON_Array:
+    case cJSON_Object: {
+        bool object = (item->type & 0xff) == cJSON_Object;
+        out += object ? '{' : '[';
+        for (const cJSON* child = item->child; child != nullptr; child = child->next) {
+            if (child != item->child) {
+                out += ',';
+            }
+            if (object) {
+                PrintString(out, child->string != nullptr ? child->string : "");
+                out += ':';
+            }
+            PrintValue(out, child);
+        }
+        out += object ? '}' : ']';
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+} // namespace
+
+cJSON* cJSON_ParseWithLength(const char* value, size_t length) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    return Parser(value, length).ParseDocument();
+}
+
+cJSON* cJSON_Parse(const char* value) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    return cJSON_ParseWithLength(value, strlen(value));
+}
+
+char* cJSON_PrintUnformatted(const cJSON* item) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    std::string out;
+    PrintValue(out, item);
+    return CopyString(out.c_str());
+}
+
+char* cJSON_Print(const cJSON* item) {
+    return cJSON_PrintUnformatted(item);
+}
+
+int cJSON_GetArraySize(const cJSON* array) {
+    int size = 0;
+    for (const cJSON* child = array != nullptr ? array->child : nullptr; child != nullptr; child = child->next) {
+        size++;
+    }
+    return size;
+}
+
+cJSON* cJSON_GetArrayItem(const cJSON* array, int index) {
+    if (array == nullptr || index < 0) {
+        return nullptr;
+    }
+    cJSON* child = array->child;
+    while (child != nullptr && index-- > 0) {
+        child = child->next;
+    }
+    return child;
+}
+
+static cJSON* GetObjectItem(const cJSON* object, const char* string, bool case_sensitive) {
+    if (object == nullptr || string == nullptr) {
+        return nullptr;
+    }
+    for (cJSON* child = object->child; child != nullptr; child = child->next) {
+        if (child->string != nullptr &&
+            (case_sensitive ? strcmp(child->string, string) : strcasecmp(child->string, string)) == 0) {
+            return child;
+        }
+    }
+    return nullptr;
+}
+
+cJSON* cJSON_GetObjectItem(const cJSON* object, const char* string) {
+    return GetObjectItem(object, string, false);
+}
+
+cJSON* cJSON_GetObjectItemCaseSensitive(const cJSON* object, const char* string) {
+    return GetObjectItem(object, string, true);
+}
+
+char* cJSON_GetStringValue(const cJSON* item) {
+    return cJSON_IsString(item) ? item->valuestring : nullptr;
+}
+
+double cJSON_GetNumberValue(const cJSON* item) {
+    return cJSON_IsNumber(item) ? item->valuedouble : NAN;
+}
+
+static cJSON_bool IsType(const cJSON* item, int type) {
+    return item != nullptr && (item->type & 0xff) == type;
+}
+
+cJSON_bool cJSON_IsInvalid(const cJSON* item) { return IsType(item, cJSON_Invalid); }
+cJSON_bool cJSON_IsFalse(const cJSON* item) { return IsType(item, cJSON_False); }
+cJSON_bool cJSON_IsTrue(const cJSON* item) { return IsType(item, cJSON_True); }
+cJSON_bool cJSON_IsBool(const cJSON* item) { return item != nullptr && (item->type & (cJSON_True | cJSON_False)) != 0; }
+cJSON_bool cJSON_IsNull(const cJSON* item) { return IsType(item, cJSON_NULL); }
+cJSON_bool cJSON_IsNumber(const cJSON* item) { return IsType(item, cJSON_Number); }
+cJSON_bool cJSON_IsString(const cJSON* item) { return IsType(item, cJSON_String); }
+cJSON_bool cJSON_IsArray(const cJSON* item) { return IsType(item, cJSON_Array); }
+cJSON_bool cJSON_IsObject(const cJSON* item) { return IsType(item, cJSON_Object); }
+
+cJSON* cJSON_CreateNull(void) { return NewItem(cJSON_NULL); }
+cJSON* cJSON_CreateTrue(void) { return NewItem(cJSON_True); }
+cJSON* cJSON_CreateFalse(void) { return NewItem(cJSON_False); }
+cJSON* cJSON_CreateBool(cJSON_bool boolean) { return NewItem(boolean ? cJSON_True : cJSON_False); }
+cJSON* cJSON_CreateArray(void) { return NewItem(cJSON_Array); }
+cJSON* cJSON_CreateObject(void) { return NewItem(cJSON_Object); }
+
+cJSON* cJSON_CreateNumber(double num) {
+    cJSON* item = NewItem(cJSON_Number);
+    item->valuedouble = num;
+    if (num >= 2147483647.0) {
+        item->valueint = 2147483647;
+    } else if (num <= -2147483648.0) {
+        item->valueint = -2147483647 - 1;
+    } else {
+        item->valueint = (int)num;
+    }
+    return item;
+}
+
+cJSON* cJSON_CreateString(const char* string) {
+    cJSON* item = NewItem(cJSON_String);
+    item->valuestring = CopyString(string);
+    return item;
+}
+
+cJSON* cJSON_Duplicate(const cJSON* item, cJSON_bool recurse) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    cJSON* copy = NewItem(item->type);
+    copy->valueint = item->valueint;
+    copy->valuedouble = item->valuedouble;
+    copy->valuestring = item->valuestring != nullptr ? CopyString(item->valuestring) : nullptr;
+    copy->string = item->string != nullptr ? CopyString(item->string) : nullptr;
+    if (recurse) {
+        for (const cJSON* child = item->child; child != nullptr; child = child->next) {
+            cJSON_AddItemToArray(copy, cJSON_Duplicate(child, true));
+        }
+    }
+    return copy;
+}
+
+cJSON_bool cJSON_AddItemToArray(cJSON* array, cJSON* item) {
+    if (array == nullptr || item == nullptr || array == item) {
+        return false;
+    }
+    if (array->child == nullptr) {
+        array->child = item;
+        item->prev = item;
+    } else {
+        cJSON* last = array->child->prev;
+        last->next = item;
+        item->prev = last;
+        array->child->prev = item;
+    }
+    item->next = nullptr;
+    return true;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON* object, const char* string, cJSON* item) {
+    if (object == nullptr || string == nullptr || item == nullptr) {
+        return false;
+    }
+    free(item->string);
+    item->string = CopyString(string);
+    return cJSON_AddItemToArray(object, item);
+}
+
+static cJSON* AddToObject(cJSON* object, const char* name, cJSON* item) {
+    if (cJSON_AddItemToObject(object, name, item)) {
+        return item;
+    }
+    cJSON_Delete(item);
+    return nullptr;
+}
+
+cJSON* cJSON_AddNullToObject(cJSON* object, const char* name) { return AddToObject(object, name, cJSON_CreateNull()); }
+cJSON* cJSON_AddTrueToObject(cJSON* object, const char* name) { return AddToObject(object, name, cJSON_CreateTrue()); }
+cJSON* cJSON_AddFalseToObject(cJSON* object, const char* name) { return AddToObject(object, name, cJSON_CreateFalse()); }
+cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, cJSON_bool boolean) {
+    return AddToObject(object, name, cJSON_CreateBool(boolean));
+}
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number) {
+    return AddToObject(object, name, cJSON_CreateNumber(number));
+}
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string) {
+    return AddToObject(object, name, cJSON_CreateString(string));
+}
+cJSON* cJSON_AddObjectToObject(cJSON* object, const char* name) { return AddToObject(object, name, cJSON_CreateObject()); }
+cJSON* cJSON_AddArrayToObject(cJSON* object, const char* name) { return AddToObject(object, name, cJSON_CreateArray()); }
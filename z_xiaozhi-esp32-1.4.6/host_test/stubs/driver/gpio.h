@@ -0,0 +1,7 @@
+#ifndef DRIVER_GPIO_STUB_H
+#define DRIVER_GPIO_STUB_H
+
+typedef int gpio_num_t;
+#define GPIO_NUM_NC -1
+
+#endif // DRIVER_GPIO_STUB_H
@@ -0,0 +1,11 @@
+#ifndef DRIVER_I2S_STD_STUB_H
+#define DRIVER_I2S_STD_STUB_H
+
+// Handles in audio_codec.h, the host codec has no I2S channels
+typedef struct i2s_channel_obj_t* i2s_chan_handle_t;
+typedef struct {
+    void* data;
+    size_t size;
+} i2s_event_data_t;
+
+#endif // DRIVER_I2S_STD_STUB_H
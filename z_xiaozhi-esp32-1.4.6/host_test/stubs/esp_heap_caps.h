@@ -0,0 +1,23 @@
+#ifndef ESP_HEAP_CAPS_STUB_H
+#define ESP_HEAP_CAPS_STUB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sdkconfig.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+// There is no PSRAM on the host, every allocation is internal RAM, and the
+// free size is a large constant
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+#endif // ESP_HEAP_CAPS_STUB_H
@@ -0,0 +1,25 @@
+#ifndef ESP_LOG_STUB_H
+#define ESP_LOG_STUB_H
+
+#include <sdkconfig.h>
+
+// Host tests don't print the firmware's log lines, unless built with
+// HOST_TEST_LOG to follow a simulation
+#if HOST_TEST_LOG
+#include <cstdio>
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
+#else
+// Still takes the arguments, so that variables only logged count as used
+inline void esp_log_discard(const char* tag, ...) {}
+#define ESP_LOGE(tag, format, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_discard(tag, ##__VA_ARGS__)
+#endif
+
+#endif // ESP_LOG_STUB_H
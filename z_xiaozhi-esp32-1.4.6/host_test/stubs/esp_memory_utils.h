@@ -0,0 +1,8 @@
+#ifndef ESP_MEMORY_UTILS_STUB_H
+#define ESP_MEMORY_UTILS_STUB_H
+
+inline bool esp_ptr_external_ram(const void* ptr) {
+    return false;
+}
+
+#endif // ESP_MEMORY_UTILS_STUB_H
@@ -0,0 +1,35 @@
+#ifndef ESP_PARTITION_STUB_H
+#define ESP_PARTITION_STUB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <esp_err.h>
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    std::vector<uint8_t>* data;     // host only, the partition's content
+} esp_partition_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+
+// Host only: adds a data partition holding `data`
+void esp_partition_host_add(const char* label, std::vector<uint8_t> data);
+
+#endif // ESP_PARTITION_STUB_H
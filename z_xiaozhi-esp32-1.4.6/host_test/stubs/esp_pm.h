@@ -0,0 +1,6 @@
+#ifndef ESP_PM_STUB_H
+#define ESP_PM_STUB_H
+
+typedef struct esp_pm_lock* esp_pm_lock_handle_t;
+
+#endif // ESP_PM_STUB_H
@@ -0,0 +1,232 @@
+// Host stand-ins for the ESP-IDF system APIs: esp_timer, heap_caps,
+// partitions, restart and the app description
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "host_clock.h"
+
+// Timers share one dispatch thread, like ESP_TIMER_TASK timers share the
+// esp_timer task; a slow callback delays the others
+struct HostTimer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool skip_unhandled_events;
+    bool active = false;
+    int64_t due = 0;
+    int64_t period = 0;     // 0 for one shot timers
+};
+
+namespace {
+
+class TimerService {
+public:
+    static TimerService& GetInstance() {
+        static TimerService instance;
+        return instance;
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    std::list<HostTimer*> timers;
+
+private:
+    TimerService() {
+        std::thread([this]() { Run(); }).detach();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            HostTimer* next = nullptr;
+            for (auto timer : timers) {
+                if (timer->active && (next == nullptr || timer->due < next->due)) {
+                    next = timer;
+                }
+            }
+            if (next == nullptr) {
+                condition_variable.wait(lock);
+                continue;
+            }
+            int64_t now = HostClock::Now();
+            if (next->due > now) {
+                condition_variable.wait_until(lock, HostClock::Deadline(next->due - now));
+                continue;
+            }
+            if (next->period > 0) {
+                next->due += next->period;
+                if (next->skip_unhandled_events && next->due <= now) {
+                    next->due = now + next->period;
+                }
+            } else {
+                next->active = false;
+            }
+            auto callback = next->callback;
+            auto arg = next->arg;
+            lock.unlock();
+            callback(arg);
+            lock.lock();
+        }
+    }
+};
+
+} // namespace
+
+int64_t esp_timer_get_time(void) {
+    return HostClock::Now();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    auto& service = TimerService::GetInstance();
+    auto timer = new HostTimer{args->callback, args->arg, args->skip_unhandled_events};
+    std::lock_guard<std::mutex> lock(service.mutex);
+    service.timers.push_back(timer);
+    *handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t StartTimer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    auto& service = TimerService::GetInstance();
+    std::lock_guard<std::mutex> lock(service.mutex);
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = true;
+    timer->due = HostClock::Now() + timeout_us;
+    timer->period = period_us;
+    service.condition_variable.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return StartTimer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return StartTimer(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    auto& service = TimerService::GetInstance();
+    std::lock_guard<std::mutex> lock(service.mutex);
+    if (!timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    auto& service = TimerService::GetInstance();
+    std::lock_guard<std::mutex> lock(service.mutex);
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    service.timers.remove(timer);
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    auto& service = TimerService::GetInstance();
+    std::lock_guard<std::mutex> lock(service.mutex);
+    return timer->active;
+}
+
+// About what an ESP32-S3 has left after boot
+#define HOST_FREE_INTERNAL_RAM (200 * 1024)
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps) {
+    return calloc(count, size);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : HOST_FREE_INTERNAL_RAM;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+static std::mutex g_partitions_mutex;
+static std::list<esp_partition_t> g_partitions;
+static std::list<std::vector<uint8_t>> g_partition_data;
+
+void esp_partition_host_add(const char* label, std::vector<uint8_t> data) {
+    std::lock_guard<std::mutex> lock(g_partitions_mutex);
+    auto& content = g_partition_data.emplace_back(std::move(data));
+    esp_partition_t partition = {};
+    partition.type = ESP_PARTITION_TYPE_DATA;
+    partition.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    partition.size = content.size();
+    strncpy(partition.label, label, sizeof(partition.label) - 1);
+    partition.data = &content;
+    g_partitions.push_back(partition);
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    std::lock_guard<std::mutex> lock(g_partitions_mutex);
+    for (auto& partition : g_partitions) {
+        if (partition.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.subtype == subtype) &&
+            (label == nullptr || strcmp(partition.label, label) == 0)) {
+            return &partition;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, partition->data->data() + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(partition->data->data() + offset, src, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    std::fill_n(partition->data->data() + offset, size, 0xff);
+    return ESP_OK;
+}
+
+void esp_restart(void) {
+    fprintf(stderr, "esp_restart() called\n");
+    _Exit(1);
+}
+
+const esp_app_desc_t* esp_app_get_description(void) {
+    static const esp_app_desc_t desc = {"1.4.6", "xiaozhi"};
+    return &desc;
+}
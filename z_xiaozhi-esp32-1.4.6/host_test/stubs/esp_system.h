@@ -0,0 +1,8 @@
+#ifndef ESP_SYSTEM_STUB_H
+#define ESP_SYSTEM_STUB_H
+
+#include <esp_err.h>
+
+[[noreturn]] void esp_restart(void);
+
+#endif // ESP_SYSTEM_STUB_H
@@ -0,0 +1,6 @@
+#ifndef ESP_TASK_WDT_STUB_H
+#define ESP_TASK_WDT_STUB_H
+
+#include <esp_err.h>
+
+#endif // ESP_TASK_WDT_STUB_H
@@ -0,0 +1,6 @@
+#ifndef FONT_AWESOME_SYMBOLS_STUB_H
+#define FONT_AWESOME_SYMBOLS_STUB_H
+
+#define FONT_AWESOME_DOWNLOAD "\xef\x80\x99"
+
+#endif // FONT_AWESOME_SYMBOLS_STUB_H
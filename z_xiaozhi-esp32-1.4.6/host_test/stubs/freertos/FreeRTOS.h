@@ -0,0 +1,29 @@
+#ifndef FREERTOS_STUB_H
+#define FREERTOS_STUB_H
+
+// The subset of FreeRTOS the host builds use, tasks are threads
+#include <cstddef>
+#include <cstdint>
+#include <sdkconfig.h>
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+typedef struct { int dummy; } StaticTask_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7fffffff
+#define IRAM_ATTR
+#define configMAX_TASK_NAME_LEN 16
+
+#endif // FREERTOS_STUB_H
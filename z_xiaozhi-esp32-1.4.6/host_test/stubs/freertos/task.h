@@ -0,0 +1,26 @@
+#ifndef FREERTOS_TASK_STUB_H
+#define FREERTOS_TASK_STUB_H
+
+#include "FreeRTOS.h"
+
+typedef struct HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// Starts a detached thread, the task ends when its function returns
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer);
+// Threads can't be killed, deleting a task only forgets about it
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char* pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+// Stacks are thread stacks, a task always reports its whole stack as free
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif // FREERTOS_TASK_STUB_H
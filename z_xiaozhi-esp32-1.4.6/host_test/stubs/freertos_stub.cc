@@ -0,0 +1,134 @@
+// Host stand-in for FreeRTOS tasks and event groups, see stubs/freertos
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "host_clock.h"
+
+struct HostTask {
+    std::string name;
+    uint32_t stack_size;
+    UBaseType_t priority;
+};
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    EventBits_t bits = 0;
+};
+
+static HostTask g_main_task{"main", 3584, 1};
+static thread_local HostTask* g_current_task = &g_main_task;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle) {
+    // Tasks are never freed, like a deleted task's handle they must not be used afterwards
+    auto task = new HostTask{name, stack_size, priority};
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    std::thread([function, arg, task]() {
+        g_current_task = task;
+        function(arg);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    return xTaskCreate(function, name, stack_size, arg, priority, handle);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+    UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer) {
+    TaskHandle_t handle = nullptr;
+    xTaskCreate(function, name, stack_size, arg, priority, &handle);
+    return handle;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    HostClock::Sleep((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return HostClock::Now() / 1000 / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return g_current_task;
+}
+
+const char* pcTaskGetName(TaskHandle_t task) {
+    return (task != nullptr ? task : g_current_task)->name.c_str();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    return (task != nullptr ? task : g_current_task)->priority;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return (task != nullptr ? task : g_current_task)->stack_size;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [group, bits, wait_for_all]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    if (ticks == portMAX_DELAY) {
+        group->condition_variable.wait(lock, satisfied);
+    } else {
+        auto deadline = HostClock::Deadline((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+        group->condition_variable.wait_until(lock, deadline, satisfied);
+    }
+    // Like FreeRTOS, the bits as they were before clearing
+    EventBits_t result = group->bits;
+    if (clear_on_exit && satisfied()) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->condition_variable.notify_all();
+    return group->bits;
+}
+
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t* higher_priority_task_woken) {
+    xEventGroupSetBits(group, bits);
+    if (higher_priority_task_woken != nullptr) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return pdPASS;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t result = group->bits;
+    group->bits &= ~bits;
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
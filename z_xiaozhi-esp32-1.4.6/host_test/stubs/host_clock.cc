@@ -0,0 +1,34 @@
+#include "host_clock.h"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+const auto kStartTime = std::chrono::steady_clock::now();
+std::atomic<int> g_speed = 1;
+}
+
+namespace HostClock {
+
+void SetSpeed(int speed) {
+    g_speed = speed > 0 ? speed : 1;
+}
+
+int speed() {
+    return g_speed;
+}
+
+int64_t Now() {
+    auto elapsed = std::chrono::steady_clock::now() - kStartTime;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * g_speed;
+}
+
+std::chrono::steady_clock::time_point Deadline(int64_t us) {
+    return std::chrono::steady_clock::now() + std::chrono::microseconds(us > 0 ? us / g_speed : 0);
+}
+
+void Sleep(int64_t us) {
+    std::this_thread::sleep_until(Deadline(us));
+}
+
+} // namespace HostClock
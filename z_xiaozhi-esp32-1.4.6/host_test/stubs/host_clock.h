@@ -0,0 +1,21 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+// Simulated time of the host builds. It runs `speed` times faster than the
+// wall clock; esp_timer, FreeRTOS delays and timeouts and the mock audio
+// codec all follow it, so a simulation plays out faster than real time with
+// the same timing relations as on the device.
+namespace HostClock {
+    void SetSpeed(int speed);
+    int speed();
+    // Microseconds of simulated time since the program started
+    int64_t Now();
+    // Wall clock time point `us` of simulated time from now
+    std::chrono::steady_clock::time_point Deadline(int64_t us);
+    void Sleep(int64_t us);
+}
+
+#endif // HOST_CLOCK_H
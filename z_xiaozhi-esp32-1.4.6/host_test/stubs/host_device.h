@@ -0,0 +1,12 @@
+#ifndef HOST_DEVICE_H
+#define HOST_DEVICE_H
+
+// Several simulated devices may share one process, each on threads of its
+// own. Settings and SystemInfo::GetMacAddress answer for the device of the
+// calling thread, 0 is the only device of a single device simulation.
+namespace HostDevice {
+    void SetCurrent(int index);
+    int current();
+}
+
+#endif // HOST_DEVICE_H
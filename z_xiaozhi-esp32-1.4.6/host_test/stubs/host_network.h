@@ -0,0 +1,78 @@
+#ifndef HOST_NETWORK_H
+#define HOST_NETWORK_H
+
+#include <mqtt.h>
+#include <udp.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// MQTT 3.1.1 client over a plain TCP socket, QoS 0 only. The broker address
+// may carry its own port ("host:1883"), it then overrides the port the
+// caller passes, which is the TLS port on the device.
+class HostMqtt : public Mqtt {
+public:
+    HostMqtt();
+    ~HostMqtt();
+
+    bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+        const std::string username, const std::string password) override;
+    void Disconnect() override;
+    bool Publish(const std::string topic, const std::string payload, int qos = 0) override;
+    bool Subscribe(const std::string topic, int qos = 0) override;
+    bool Unsubscribe(const std::string topic) override;
+    bool IsConnected() override;
+
+private:
+    int fd_ = -1;
+    std::atomic<bool> connected_ = false;
+    std::mutex write_mutex_;
+    uint16_t packet_id_ = 0;
+    std::thread receive_thread_;
+
+    bool WritePacket(uint8_t type, const std::string& body);
+    void ReceiveLoop();
+};
+
+class HostUdp : public Udp {
+public:
+    HostUdp();
+    ~HostUdp();
+
+    bool Connect(const std::string& host, int port) override;
+    void Disconnect() override;
+    int Send(const std::string& data) override;
+
+private:
+    int fd_ = -1;
+    std::atomic<bool> stop_ = false;
+    std::thread receive_thread_;
+};
+
+// Helpers shared with the host servers
+namespace HostSocket {
+    // Blocking TCP connection, -1 on failure
+    int ConnectTcp(const std::string& host, int port);
+    // Listening TCP or UDP socket on 127.0.0.1, port 0 picks a free one
+    int Listen(int port, bool udp = false);
+    int LocalPort(int fd);
+    bool WriteAll(int fd, const void* data, size_t size);
+    bool ReadAll(int fd, void* data, size_t size);
+    // Reads an HTTP header block up to the blank line, and not a byte further
+    bool ReadHttpHeaders(int fd, std::string& headers);
+    std::string HttpHeader(const std::string& headers, const std::string& name);
+    std::string Base64Encode(const uint8_t* data, size_t size);
+
+    struct WebsocketFrame {
+        bool fin;
+        int opcode;
+        std::string payload;    // unmasked
+    };
+    bool ReadWebsocketFrame(int fd, WebsocketFrame& frame);
+    // Clients mask what they send, servers don't
+    bool WriteWebsocketFrame(int fd, int opcode, const void* data, size_t size, bool fin, bool mask);
+}
+
+#endif // HOST_NETWORK_H
@@ -0,0 +1,9 @@
+#ifndef LVGL_STUB_H
+#define LVGL_STUB_H
+
+// Only the types display.h refers to, the host display draws nothing
+typedef struct _lv_font_t lv_font_t;
+typedef struct _lv_display_t lv_display_t;
+typedef struct _lv_obj_t lv_obj_t;
+
+#endif // LVGL_STUB_H
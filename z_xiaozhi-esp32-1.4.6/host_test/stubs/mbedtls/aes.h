@@ -0,0 +1,10 @@
+#ifndef MBEDTLS_AES_STUB_H
+#define MBEDTLS_AES_STUB_H
+
+// Lets mqtt_protocol.h be included without mbedtls, targets that build
+// MqttProtocol put the real mbedtls include directory first
+typedef struct {
+    int unused;
+} mbedtls_aes_context;
+
+#endif // MBEDTLS_AES_STUB_H
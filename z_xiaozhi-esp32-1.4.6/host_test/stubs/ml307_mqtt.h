@@ -0,0 +1,6 @@
+#ifndef ML307_MQTT_STUB_H
+#define ML307_MQTT_STUB_H
+
+#include "mqtt.h"
+
+#endif // ML307_MQTT_STUB_H
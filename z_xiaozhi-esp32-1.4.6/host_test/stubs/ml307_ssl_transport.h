@@ -0,0 +1,4 @@
+#ifndef ML307_SSL_TRANSPORT_STUB_H
+#define ML307_SSL_TRANSPORT_STUB_H
+
+#endif // ML307_SSL_TRANSPORT_STUB_H
@@ -0,0 +1,6 @@
+#ifndef ML307_UDP_STUB_H
+#define ML307_UDP_STUB_H
+
+#include "udp.h"
+
+#endif // ML307_UDP_STUB_H
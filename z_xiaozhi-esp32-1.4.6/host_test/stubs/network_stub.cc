@@ -0,0 +1,667 @@
+// Host versions of the ml307 network clients on POSIX sockets: a plain ws://
+// WebSocket, an MQTT client without TLS and UDP. Each connection receives on
+// a thread of its own, like the modem and lwIP tasks on the device.
+#include "host_network.h"
+
+#include <web_socket.h>
+#include <esp_log.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <random>
+
+#define TAG "HostNetwork"
+
+namespace HostSocket {
+
+static int Resolve(const std::string& host, int port, int type, addrinfo** result) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = type;
+    return getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, result);
+}
+
+int ConnectTcp(const std::string& host, int port) {
+    addrinfo* address = nullptr;
+    if (Resolve(host, port, SOCK_STREAM, &address) != 0) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host.c_str());
+        return -1;
+    }
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(address);
+    if (fd >= 0) {
+        // Audio messages are small and latency is what the device cares about
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+int Listen(int port, bool udp) {
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || (!udp && listen(fd, 64) != 0)) {
+        ESP_LOGE(TAG, "Failed to listen on port %d", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int LocalPort(int fd) {
+    sockaddr_in address = {};
+    socklen_t size = sizeof(address);
+    if (getsockname(fd, (sockaddr*)&address, &size) != 0) {
+        return -1;
+    }
+    return ntohs(address.sin_port);
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+    auto p = (const uint8_t*)data;
+    while (size > 0) {
+        auto ret = send(fd, p, size, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return false;
+        }
+        p += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+    auto p = (uint8_t*)data;
+    while (size > 0) {
+        auto ret = recv(fd, p, size, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        p += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool ReadHttpHeaders(int fd, std::string& headers) {
+    // Byte by byte, so that the first frame after the handshake stays in the socket
+    headers.clear();
+    char c;
+    while (headers.size() < 8192 && ReadAll(fd, &c, 1)) {
+        headers.push_back(c);
+        if (headers.size() >= 4 && headers.compare(headers.size() - 4, 4, "\r\n\r\n") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string HttpHeader(const std::string& headers, const std::string& name) {
+    size_t line = headers.find("\r\n");
+    while (line != std::string::npos) {
+        line += 2;
+        size_t end = headers.find("\r\n", line);
+        size_t colon = headers.find(':', line);
+        if (end == std::string::npos || colon == std::string::npos || colon > end) {
+            break;
+        }
+        if (strncasecmp(headers.c_str() + line, name.c_str(), name.size()) == 0 && colon - line == name.size()) {
+            size_t value = headers.find_first_not_of(' ', colon + 1);
+            return headers.substr(value, end - value);
+        }
+        line = end;
+    }
+    return "";
+}
+
+std::string Base64Encode(const uint8_t* data, size_t size) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t group = data[i] << 16;
+        if (i + 1 < size) group |= data[i + 1] << 8;
+        if (i + 2 < size) group |= data[i + 2];
+        encoded.push_back(alphabet[(group >> 18) & 63]);
+        encoded.push_back(alphabet[(group >> 12) & 63]);
+        encoded.push_back(i + 1 < size ? alphabet[(group >> 6) & 63] : '=');
+        encoded.push_back(i + 2 < size ? alphabet[group & 63] : '=');
+    }
+    return encoded;
+}
+
+bool ReadWebsocketFrame(int fd, WebsocketFrame& frame) {
+    uint8_t header[2];
+    if (!ReadAll(fd, header, sizeof(header))) {
+        return false;
+    }
+    frame.fin = header[0] & 0x80;
+    frame.opcode = header[0] & 0x0f;
+    uint64_t size = header[1] & 0x7f;
+    if (size == 126) {
+        uint16_t extended;
+        if (!ReadAll(fd, &extended, sizeof(extended))) {
+            return false;
+        }
+        size = ntohs(extended);
+    } else if (size == 127) {
+        uint8_t extended[8];
+        if (!ReadAll(fd, extended, sizeof(extended))) {
+            return false;
+        }
+        size = 0;
+        for (auto byte : extended) {
+            size = size << 8 | byte;
+        }
+    }
+    uint8_t mask[4] = {};
+    bool masked = header[1] & 0x80;
+    if ((masked && !ReadAll(fd, mask, sizeof(mask))) || size > 16 * 1024 * 1024) {
+        return false;
+    }
+    frame.payload.resize(size);
+    if (!ReadAll(fd, frame.payload.data(), size)) {
+        return false;
+    }
+    if (masked) {
+        for (size_t i = 0; i < size; i++) {
+            frame.payload[i] ^= mask[i % 4];
+        }
+    }
+    return true;
+}
+
+bool WriteWebsocketFrame(int fd, int opcode, const void* data, size_t size, bool fin, bool mask) {
+    std::string frame;
+    frame.reserve(14 + size);
+    frame.push_back((fin ? 0x80 : 0) | opcode);
+    uint8_t mask_bit = mask ? 0x80 : 0;
+    if (size < 126) {
+        frame.push_back(mask_bit | size);
+    } else if (size <= 0xffff) {
+        frame.push_back(mask_bit | 126);
+        frame.push_back(size >> 8);
+        frame.push_back(size & 0xff);
+    } else {
+        frame.push_back(mask_bit | 127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame.push_back((uint64_t)size >> shift & 0xff);
+        }
+    }
+    size_t payload = frame.size();
+    frame.append((const char*)data, size);
+    if (mask) {
+        static thread_local std::mt19937 random(std::random_device{}());
+        uint8_t key[4];
+        for (auto& byte : key) {
+            byte = random();
+        }
+        frame.insert(payload, (const char*)key, sizeof(key));
+        payload += sizeof(key);
+        for (size_t i = 0; i < size; i++) {
+            frame[payload + i] ^= key[i % 4];
+        }
+    }
+    return WriteAll(fd, frame.data(), frame.size());
+}
+
+} // namespace HostSocket
+
+using namespace HostSocket;
+
+struct WebSocket::Impl {
+    std::map<std::string, std::string> headers;
+    int fd = -1;
+    std::atomic<bool> connected = false;
+    std::atomic<bool> closing = false;
+    std::mutex write_mutex;
+    bool continuation = false;      // a message sent with fin = false is still open
+    std::thread receive_thread;
+    std::function<void()> on_connected;
+    std::function<void()> on_disconnected;
+    std::function<void(const char*, size_t, bool)> on_data;
+    std::function<void(int)> on_error;
+
+    void ReceiveLoop();
+};
+
+void WebSocket::Impl::ReceiveLoop() {
+    std::string message;
+    bool binary = false;
+    WebsocketFrame frame;
+    while (ReadWebsocketFrame(fd, frame)) {
+        if (frame.opcode == 0x8) {
+            break;
+        } else if (frame.opcode == 0x9) {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            WriteWebsocketFrame(fd, 0xA, frame.payload.data(), frame.payload.size(), true, true);
+            continue;
+        } else if (frame.opcode == 0xA) {
+            continue;
+        }
+        if (frame.opcode != 0) {
+            binary = frame.opcode == 0x2;
+            message.clear();
+        }
+        message += frame.payload;
+        if (frame.fin && on_data != nullptr) {
+            // Text stays NUL terminated, the protocols parse it in place
+            on_data(message.c_str(), message.size(), binary);
+        }
+    }
+    connected = false;
+    // Closing from this side is not reported, like on the device
+    if (!closing && on_disconnected != nullptr) {
+        on_disconnected();
+    }
+}
+
+WebSocket::WebSocket() : impl_(new Impl()) {
+}
+
+WebSocket::~WebSocket() {
+    Close();
+    if (impl_->receive_thread.joinable()) {
+        if (impl_->receive_thread.get_id() == std::this_thread::get_id()) {
+            impl_->receive_thread.detach();
+        } else {
+            impl_->receive_thread.join();
+        }
+    }
+    if (impl_->fd >= 0) {
+        close(impl_->fd);
+    }
+    delete impl_;
+}
+
+void WebSocket::SetHeader(const char* key, const char* value) {
+    impl_->headers[key] = value;
+}
+
+bool WebSocket::IsConnected() const {
+    return impl_->connected;
+}
+
+bool WebSocket::Connect(const char* uri) {
+    std::string url = uri;
+    if (url.compare(0, 5, "ws://") != 0) {
+        ESP_LOGE(TAG, "Only ws:// is supported on the host: %s", uri);
+        return false;
+    }
+    size_t host_start = 5;
+    size_t path_start = url.find('/', host_start);
+    std::string host = url.substr(host_start, path_start - host_start);
+    std::string path = path_start == std::string::npos ? "/" : url.substr(path_start);
+    int port = 80;
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        port = atoi(host.c_str() + colon + 1);
+        host.resize(colon);
+    }
+
+    impl_->fd = ConnectTcp(host, port);
+    if (impl_->fd < 0) {
+        return false;
+    }
+
+    uint8_t key[16];
+    std::random_device random;
+    for (auto& byte : key) {
+        byte = random();
+    }
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port) + "\r\n"
+        "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n"
+        "Sec-WebSocket-Key: " + Base64Encode(key, sizeof(key)) + "\r\n";
+    for (auto& [name, value] : impl_->headers) {
+        request += name + ": " + value + "\r\n";
+    }
+    request += "\r\n";
+
+    std::string response;
+    if (!WriteAll(impl_->fd, request.data(), request.size()) || !ReadHttpHeaders(impl_->fd, response) ||
+        response.compare(0, 12, "HTTP/1.1 101") != 0) {
+        ESP_LOGE(TAG, "Websocket handshake failed: %s", response.substr(0, response.find('\r')).c_str());
+        return false;
+    }
+
+    impl_->connected = true;
+    impl_->receive_thread = std::thread([this]() {
+        impl_->ReceiveLoop();
+    });
+    if (impl_->on_connected != nullptr) {
+        impl_->on_connected();
+    }
+    return true;
+}
+
+bool WebSocket::Send(const std::string& data) {
+    return Send(data.data(), data.size(), false, true);
+}
+
+bool WebSocket::Send(const void* data, size_t len, bool binary, bool fin) {
+    if (!impl_->connected) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(impl_->write_mutex);
+    int opcode = impl_->continuation ? 0x0 : (binary ? 0x2 : 0x1);
+    impl_->continuation = !fin;
+    return WriteWebsocketFrame(impl_->fd, opcode, data, len, fin, true);
+}
+
+void WebSocket::Ping() {
+    if (!impl_->connected) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(impl_->write_mutex);
+    WriteWebsocketFrame(impl_->fd, 0x9, nullptr, 0, true, true);
+}
+
+void WebSocket::Close() {
+    if (impl_->fd < 0 || impl_->closing.exchange(true)) {
+        return;
+    }
+    if (impl_->connected) {
+        std::lock_guard<std::mutex> lock(impl_->write_mutex);
+        WriteWebsocketFrame(impl_->fd, 0x8, nullptr, 0, true, true);
+    }
+    // Also makes a send that is blocked on a full socket return
+    shutdown(impl_->fd, SHUT_RDWR);
+    impl_->connected = false;
+}
+
+void WebSocket::OnConnected(std::function<void()> callback) {
+    impl_->on_connected = std::move(callback);
+}
+
+void WebSocket::OnDisconnected(std::function<void()> callback) {
+    impl_->on_disconnected = std::move(callback);
+}
+
+void WebSocket::OnData(std::function<void(const char*, size_t, bool binary)> callback) {
+    impl_->on_data = std::move(callback);
+}
+
+void WebSocket::OnError(std::function<void(int)> callback) {
+    impl_->on_error = std::move(callback);
+}
+
+// MQTT control packet types, in the high nibble of the first byte
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_UNSUBSCRIBE 0xA2
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+
+static void AppendMqttString(std::string& body, const std::string& value) {
+    body.push_back(value.size() >> 8);
+    body.push_back(value.size() & 0xff);
+    body += value;
+}
+
+static bool ReadMqttPacket(int fd, uint8_t& type, std::string& body) {
+    if (!ReadAll(fd, &type, 1)) {
+        return false;
+    }
+    size_t size = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        uint8_t byte;
+        if (!ReadAll(fd, &byte, 1)) {
+            return false;
+        }
+        size |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    body.resize(size);
+    return ReadAll(fd, body.data(), size);
+}
+
+HostMqtt::HostMqtt() {
+}
+
+HostMqtt::~HostMqtt() {
+    Disconnect();
+}
+
+bool HostMqtt::WritePacket(uint8_t type, const std::string& body) {
+    std::string packet(1, (char)type);
+    size_t size = body.size();
+    do {
+        uint8_t byte = size & 0x7f;
+        size >>= 7;
+        packet.push_back(size > 0 ? byte | 0x80 : byte);
+    } while (size > 0);
+    packet += body;
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return fd_ >= 0 && WriteAll(fd_, packet.data(), packet.size());
+}
+
+bool HostMqtt::Connect(const std::string broker_address, int broker_port, const std::string client_id,
+    const std::string username, const std::string password) {
+    std::string host = broker_address;
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        broker_port = atoi(host.c_str() + colon + 1);
+        host.resize(colon);
+    }
+    fd_ = ConnectTcp(host, broker_port);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    std::string body;
+    AppendMqttString(body, "MQTT");
+    body.push_back(4);  // protocol level 3.1.1
+    uint8_t flags = 0x02;   // clean session
+    if (!username.empty()) {
+        flags |= 0x80;
+    }
+    if (!password.empty()) {
+        flags |= 0x40;
+    }
+    body.push_back(flags);
+    body.push_back(keep_alive_seconds_ >> 8);
+    body.push_back(keep_alive_seconds_ & 0xff);
+    AppendMqttString(body, client_id);
+    if (!username.empty()) {
+        AppendMqttString(body, username);
+    }
+    if (!password.empty()) {
+        AppendMqttString(body, password);
+    }
+
+    uint8_t type;
+    std::string ack;
+    if (!WritePacket(MQTT_CONNECT, body) || !ReadMqttPacket(fd_, type, ack) ||
+        type != MQTT_CONNACK || ack.size() < 2 || ack[1] != 0) {
+        ESP_LOGE(TAG, "MQTT connect to %s:%d refused", host.c_str(), broker_port);
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    connected_ = true;
+    receive_thread_ = std::thread([this]() {
+        ReceiveLoop();
+    });
+    if (on_connected_callback_ != nullptr) {
+        on_connected_callback_();
+    }
+    return true;
+}
+
+void HostMqtt::ReceiveLoop() {
+    pollfd poll_fd = {fd_, POLLIN, 0};
+    int interval_ms = keep_alive_seconds_ * 1000 / 2;
+    while (true) {
+        int ready = poll(&poll_fd, 1, interval_ms);
+        if (ready == 0) {
+            WritePacket(MQTT_PINGREQ, "");
+            continue;
+        }
+        uint8_t type;
+        std::string body;
+        if (ready < 0 || !ReadMqttPacket(fd_, type, body)) {
+            break;
+        }
+        if ((type & 0xf0) != MQTT_PUBLISH || body.size() < 2) {
+            continue;   // acknowledgements and ping responses
+        }
+        size_t topic_size = (uint8_t)body[0] << 8 | (uint8_t)body[1];
+        size_t offset = 2 + topic_size;
+        int qos = (type >> 1) & 3;
+        if (qos > 0) {
+            WritePacket(MQTT_PUBACK, body.substr(offset, 2));
+            offset += 2;
+        }
+        if (offset > body.size()) {
+            continue;
+        }
+        if (on_message_callback_ != nullptr) {
+            on_message_callback_(body.substr(2, topic_size), body.substr(offset));
+        }
+    }
+    if (connected_.exchange(false) && on_disconnected_callback_ != nullptr) {
+        on_disconnected_callback_();
+    }
+}
+
+void HostMqtt::Disconnect() {
+    if (connected_.exchange(false)) {
+        WritePacket(MQTT_DISCONNECT, "");
+        shutdown(fd_, SHUT_RDWR);
+    }
+    if (receive_thread_.joinable()) {
+        if (receive_thread_.get_id() == std::this_thread::get_id()) {
+            receive_thread_.detach();
+        } else {
+            receive_thread_.join();
+        }
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool HostMqtt::Publish(const std::string topic, const std::string payload, int qos) {
+    // Everything the protocols publish is QoS 0
+    std::string body;
+    AppendMqttString(body, topic);
+    body += payload;
+    return connected_ && WritePacket(MQTT_PUBLISH, body);
+}
+
+bool HostMqtt::Subscribe(const std::string topic, int qos) {
+    std::string body;
+    uint16_t id = ++packet_id_;
+    body.push_back(id >> 8);
+    body.push_back(id & 0xff);
+    AppendMqttString(body, topic);
+    body.push_back(0);
+    return connected_ && WritePacket(MQTT_SUBSCRIBE, body);
+}
+
+bool HostMqtt::Unsubscribe(const std::string topic) {
+    std::string body;
+    uint16_t id = ++packet_id_;
+    body.push_back(id >> 8);
+    body.push_back(id & 0xff);
+    AppendMqttString(body, topic);
+    return connected_ && WritePacket(MQTT_UNSUBSCRIBE, body);
+}
+
+bool HostMqtt::IsConnected() {
+    return connected_;
+}
+
+HostUdp::HostUdp() {
+}
+
+HostUdp::~HostUdp() {
+    Disconnect();
+}
+
+bool HostUdp::Connect(const std::string& host, int port) {
+    addrinfo* address = nullptr;
+    if (HostSocket::Resolve(host, port, SOCK_DGRAM, &address) != 0) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host.c_str());
+        return false;
+    }
+    fd_ = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd_ >= 0 && connect(fd_, address->ai_addr, address->ai_addrlen) != 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    freeaddrinfo(address);
+    if (fd_ < 0) {
+        ESP_LOGE(TAG, "Failed to connect UDP to %s:%d", host.c_str(), port);
+        return false;
+    }
+
+    connected_ = true;
+    receive_thread_ = std::thread([this]() {
+        // Polls, a blocked recv on a UDP socket does not wake up for close
+        pollfd poll_fd = {fd_, POLLIN, 0};
+        std::string data;
+        while (!stop_) {
+            if (poll(&poll_fd, 1, 100) <= 0) {
+                continue;
+            }
+            data.resize(2048);
+            auto ret = recv(fd_, data.data(), data.size(), 0);
+            if (ret < 0) {
+                continue;
+            }
+            data.resize(ret);
+            if (message_callback_ != nullptr) {
+                message_callback_(data);
+            }
+        }
+    });
+    return true;
+}
+
+void HostUdp::Disconnect() {
+    stop_ = true;
+    if (receive_thread_.joinable()) {
+        receive_thread_.join();
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    connected_ = false;
+}
+
+int HostUdp::Send(const std::string& data) {
+    if (fd_ < 0) {
+        return -1;
+    }
+    return send(fd_, data.data(), data.size(), 0);
+}
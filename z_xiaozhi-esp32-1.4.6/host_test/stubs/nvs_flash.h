@@ -0,0 +1,8 @@
+#ifndef NVS_FLASH_STUB_H
+#define NVS_FLASH_STUB_H
+
+#include <cstdint>
+
+typedef uint32_t nvs_handle_t;
+
+#endif // NVS_FLASH_STUB_H
@@ -0,0 +1,46 @@
+#ifndef OPUS_STUB_H
+#define OPUS_STUB_H
+
+// Stand-in for libopus with its API and packet sizes but not its quality:
+// a packet carries the frame size and a coarse copy of the waveform, sized
+// for the encoder's bitrate. Frames that are all but silent become 3 byte
+// DTX packets.
+#include <cstdint>
+
+typedef int32_t opus_int32;
+typedef int16_t opus_int16;
+typedef struct OpusEncoder OpusEncoder;
+typedef struct OpusDecoder OpusDecoder;
+
+#define OPUS_OK 0
+#define OPUS_BAD_ARG -1
+#define OPUS_BUFFER_TOO_SMALL -2
+#define OPUS_INVALID_PACKET -4
+#define OPUS_UNIMPLEMENTED -5
+
+#define OPUS_AUTO -1000
+#define OPUS_APPLICATION_VOIP 2048
+
+#define OPUS_SET_BITRATE_REQUEST 4002
+#define OPUS_GET_BITRATE_REQUEST 4003
+#define OPUS_SET_COMPLEXITY_REQUEST 4010
+#define OPUS_SET_DTX_REQUEST 4016
+#define OPUS_RESET_STATE 4028
+
+#define OPUS_SET_BITRATE(x) OPUS_SET_BITRATE_REQUEST, (opus_int32)(x)
+#define OPUS_GET_BITRATE(x) OPUS_GET_BITRATE_REQUEST, (opus_int32*)(x)
+#define OPUS_SET_COMPLEXITY(x) OPUS_SET_COMPLEXITY_REQUEST, (opus_int32)(x)
+#define OPUS_SET_DTX(x) OPUS_SET_DTX_REQUEST, (opus_int32)(x)
+
+OpusEncoder* opus_encoder_create(opus_int32 sample_rate, int channels, int application, int* error);
+void opus_encoder_destroy(OpusEncoder* encoder);
+int opus_encoder_ctl(OpusEncoder* encoder, int request, ...);
+opus_int32 opus_encode(OpusEncoder* encoder, const opus_int16* pcm, int frame_size, unsigned char* data, opus_int32 max_data_bytes);
+
+OpusDecoder* opus_decoder_create(opus_int32 sample_rate, int channels, int* error);
+void opus_decoder_destroy(OpusDecoder* decoder);
+int opus_decoder_ctl(OpusDecoder* decoder, int request, ...);
+int opus_decode(OpusDecoder* decoder, const unsigned char* data, opus_int32 len, opus_int16* pcm, int frame_size, int decode_fec);
+int opus_decoder_get_nb_samples(const OpusDecoder* decoder, const unsigned char* packet, opus_int32 len);
+
+#endif // OPUS_STUB_H
@@ -0,0 +1,159 @@
+// Host stand-in for libopus, see stubs/opus.h
+#include <opus.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+
+struct OpusEncoder {
+    opus_int32 sample_rate;
+    int channels;
+    opus_int32 bitrate;
+    bool dtx;
+};
+
+struct OpusDecoder {
+    opus_int32 sample_rate;
+    int channels;
+    opus_int16 last_sample;
+};
+
+// Header: marker, frame size in samples per channel (big endian)
+static const unsigned char kPacketMarker = 0xf8;
+static const int kHeaderSize = 3;
+static const int kSilenceThreshold = 64;
+
+OpusEncoder* opus_encoder_create(opus_int32 sample_rate, int channels, int application, int* error) {
+    if (sample_rate <= 0 || channels < 1 || channels > 2) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusEncoder{sample_rate, channels, OPUS_AUTO, false};
+}
+
+void opus_encoder_destroy(OpusEncoder* encoder) {
+    delete encoder;
+}
+
+// Same as libopus for OPUS_AUTO: 60 * Fs / frame_size + Fs * channels at 20 ms frames
+static opus_int32 EncoderBitrate(const OpusEncoder* encoder) {
+    if (encoder->bitrate != OPUS_AUTO) {
+        return encoder->bitrate;
+    }
+    return 60 * 50 + encoder->sample_rate * encoder->channels;
+}
+
+int opus_encoder_ctl(OpusEncoder* encoder, int request, ...) {
+    va_list args;
+    va_start(args, request);
+    int ret = OPUS_OK;
+    switch (request) {
+    case OPUS_SET_BITRATE_REQUEST: {
+        opus_int32 bitrate = va_arg(args, opus_int32);
+        if (bitrate != OPUS_AUTO && bitrate <= 0) {
+            ret = OPUS_BAD_ARG;
+        } else {
+            encoder->bitrate = bitrate == OPUS_AUTO ? OPUS_AUTO : std::clamp(bitrate, 500, 512000);
+        }
+        break;
+    }
+    case OPUS_GET_BITRATE_REQUEST:
+        *va_arg(args, opus_int32*) = EncoderBitrate(encoder);
+        break;
+    case OPUS_SET_COMPLEXITY_REQUEST:
+        va_arg(args, opus_int32);
+        break;
+    case OPUS_SET_DTX_REQUEST:
+        encoder->dtx = va_arg(args, opus_int32) != 0;
+        break;
+    case OPUS_RESET_STATE:
+        break;
+    default:
+        ret = OPUS_UNIMPLEMENTED;
+        break;
+    }
+    va_end(args);
+    return ret;
+}
+
+opus_int32 opus_encode(OpusEncoder* encoder, const opus_int16* pcm, int frame_size, unsigned char* data, opus_int32 max_data_bytes) {
+    if (frame_size <= 0 || frame_size > encoder->sample_rate / 1000 * 120) {
+        return OPUS_BAD_ARG;
+    }
+    if (max_data_bytes < kHeaderSize) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    const int samples = frame_size * encoder->channels;
+    int peak = 0;
+    for (int i = 0; i < samples; i++) {
+        peak = std::max(peak, std::abs((int)pcm[i]));
+    }
+
+    int size = kHeaderSize;
+    if (!encoder->dtx || peak >= kSilenceThreshold) {
+        // Like the real encoder, max_data_bytes caps the bitrate of this frame
+        int64_t bytes = (int64_t)EncoderBitrate(encoder) * frame_size / encoder->sample_rate / 8;
+        size = std::clamp<int64_t>(bytes, kHeaderSize + 1, max_data_bytes);
+    }
+    data[0] = kPacketMarker;
+    data[1] = frame_size >> 8;
+    data[2] = frame_size & 0xff;
+    int payload = size - kHeaderSize;
+    for (int i = 0; i < payload; i++) {
+        data[kHeaderSize + i] = (unsigned char)(pcm[(int64_t)i * samples / payload] >> 8);
+    }
+    return size;
+}
+
+OpusDecoder* opus_decoder_create(opus_int32 sample_rate, int channels, int* error) {
+    if (sample_rate <= 0 || channels < 1 || channels > 2) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusDecoder{sample_rate, channels, 0};
+}
+
+void opus_decoder_destroy(OpusDecoder* decoder) {
+    delete decoder;
+}
+
+int opus_decoder_ctl(OpusDecoder* decoder, int request, ...) {
+    if (request == OPUS_RESET_STATE) {
+        decoder->last_sample = 0;
+        return OPUS_OK;
+    }
+    return OPUS_UNIMPLEMENTED;
+}
+
+// The frame size travels in the header, so encoder and decoder must share a rate
+int opus_decoder_get_nb_samples(const OpusDecoder* decoder, const unsigned char* packet, opus_int32 len) {
+    if (len < kHeaderSize || packet[0] != kPacketMarker) {
+        return OPUS_INVALID_PACKET;
+    }
+    return (packet[1] << 8) | packet[2];
+}
+
+int opus_decode(OpusDecoder* decoder, const unsigned char* data, opus_int32 len, opus_int16* pcm, int frame_size, int decode_fec) {
+    const int channels = decoder->channels;
+    if (data == nullptr || len == 0) {
+        // Concealment holds the last sample
+        std::fill(pcm, pcm + frame_size * channels, decoder->last_sample);
+        return frame_size;
+    }
+    int samples = opus_decoder_get_nb_samples(decoder, data, len);
+    if (samples < 0) {
+        return samples;
+    }
+    if (samples > frame_size) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    int payload = len - kHeaderSize;
+    for (int i = 0; i < samples * channels; i++) {
+        pcm[i] = payload > 0 ? (opus_int16)(data[kHeaderSize + (int64_t)i * payload / (samples * channels)] << 8) : 0;
+    }
+    decoder->last_sample = samples > 0 ? pcm[samples * channels - 1] : 0;
+    return samples;
+}
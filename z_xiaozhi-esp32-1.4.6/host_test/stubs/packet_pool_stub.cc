@@ -0,0 +1,15 @@
+// Host stand-in for the packet pool: plain heap allocations
+#include "packet_pool.h"
+
+#include <cstdlib>
+
+PacketPool::PacketPool() {
+}
+
+void* PacketPool::Allocate(size_t size) {
+    return malloc(size);
+}
+
+void PacketPool::Free(void* ptr, size_t size) {
+    free(ptr);
+}
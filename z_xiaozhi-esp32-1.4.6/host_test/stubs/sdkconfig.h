@@ -0,0 +1,72 @@
+// Kconfig defaults for host builds, a target overrides them with
+// target_compile_definitions
+#pragma once
+
+#ifndef CONFIG_IDF_TARGET
+#define CONFIG_IDF_TARGET "linux"
+#endif
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 2
+#define CONFIG_FREERTOS_HZ 1000
+
+#ifndef CONFIG_OTA_VERSION_URL
+#define CONFIG_OTA_VERSION_URL "http://127.0.0.1/ota/"
+#endif
+#ifndef CONFIG_WEBSOCKET_URL
+#define CONFIG_WEBSOCKET_URL "ws://127.0.0.1:8765/"
+#endif
+#ifndef CONFIG_WEBSOCKET_ACCESS_TOKEN
+#define CONFIG_WEBSOCKET_ACCESS_TOKEN "test-token"
+#endif
+#ifndef CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET
+#define CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET 1
+#endif
+#ifndef CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT
+#define CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT 600
+#endif
+#ifndef CONFIG_AUDIO_CHANNEL_KEEPALIVE_INTERVAL
+#define CONFIG_AUDIO_CHANNEL_KEEPALIVE_INTERVAL 30
+#endif
+#ifndef CONFIG_SEND_QUEUE_SIZE
+#define CONFIG_SEND_QUEUE_SIZE 16
+#endif
+#if !defined(CONFIG_SEND_QUEUE_DROP_OLDEST) && !defined(CONFIG_SEND_QUEUE_PAUSE_ENCODER)
+#define CONFIG_SEND_QUEUE_DROP_OLDEST 1
+#endif
+#ifndef CONFIG_ADAPTIVE_UPLINK_MAX_FRAME_DURATION
+#define CONFIG_ADAPTIVE_UPLINK_MAX_FRAME_DURATION 120
+#endif
+#ifndef CONFIG_ADAPTIVE_UPLINK_MAX_BITRATE
+#define CONFIG_ADAPTIVE_UPLINK_MAX_BITRATE 16000
+#endif
+#ifndef CONFIG_ADAPTIVE_UPLINK_MIN_BITRATE
+#define CONFIG_ADAPTIVE_UPLINK_MIN_BITRATE 10000
+#endif
+#ifndef CONFIG_PACKET_POOL_MAX_SIZE
+#define CONFIG_PACKET_POOL_MAX_SIZE 32
+#endif
+#ifndef CONFIG_DECODE_QUEUE_MAX_DURATION
+#define CONFIG_DECODE_QUEUE_MAX_DURATION 30000
+#endif
+#ifndef CONFIG_DECODE_QUEUE_MAX_INTERNAL_SIZE
+#define CONFIG_DECODE_QUEUE_MAX_INTERNAL_SIZE 32
+#endif
+#if !defined(CONFIG_DECODE_QUEUE_PAUSE_SERVER) && !defined(CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM)
+#define CONFIG_DECODE_QUEUE_PAUSE_SERVER 1
+#endif
+#ifndef CONFIG_SESSION_REPLAY_SPEED
+#define CONFIG_SESSION_REPLAY_SPEED 100
+#endif
+
+// Stack sizes only matter for the StackMonitor table on the device
+#define CONFIG_MAIN_LOOP_STACK_SIZE 8192
+#define CONFIG_BACKGROUND_TASK_STACK_SIZE 32768
+#define CONFIG_PROTOCOL_SEND_STACK_SIZE 8192
+#define CONFIG_OPEN_CHANNEL_STACK_SIZE 8192
+#define CONFIG_BOOT_STAGE_STACK_SIZE 8192
+#define CONFIG_CHECK_NEW_VERSION_STACK_SIZE 8192
+#define CONFIG_OTA_WRITER_STACK_SIZE 4096
+#define CONFIG_REPLAY_STACK_SIZE 4096
+#define CONFIG_ESP_MAIN_TASK_STACK_SIZE 3584
+#define CONFIG_ESP_TIMER_TASK_STACK_SIZE 3584
+#define CONFIG_ESP_SYSTEM_EVENT_TASK_STACK_SIZE 2304
+#define CONFIG_LWIP_TCPIP_TASK_STACK_SIZE 3072
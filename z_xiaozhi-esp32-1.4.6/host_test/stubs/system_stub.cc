@@ -0,0 +1,156 @@
+// Host versions of Settings, SystemInfo and Ota: settings live in memory,
+// and the version check always finds the running firmware up to date
+#include "settings.h"
+#include "system_info.h"
+#include "ota.h"
+#include "host_device.h"
+
+#include <esp_app_desc.h>
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+static thread_local int g_current_device = 0;
+
+void HostDevice::SetCurrent(int index) {
+    g_current_device = index;
+}
+
+int HostDevice::current() {
+    return g_current_device;
+}
+
+static std::mutex g_settings_mutex;
+static std::map<std::string, std::string> g_settings_strings;
+static std::map<std::string, int32_t> g_settings_ints;
+static std::map<std::string, std::vector<uint8_t>> g_settings_blobs;
+
+// Each device has its own copy of every namespace
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
+    if (HostDevice::current() != 0) {
+        ns_ = std::to_string(HostDevice::current()) + "/" + ns;
+    }
+}
+
+Settings::~Settings() {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    auto it = g_settings_strings.find(ns_ + "." + key);
+    return it != g_settings_strings.end() ? it->second : default_value;
+}
+
+void Settings::SetString(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    if (read_write_) {
+        g_settings_strings[ns_ + "." + key] = value;
+    }
+}
+
+int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    auto it = g_settings_ints.find(ns_ + "." + key);
+    return it != g_settings_ints.end() ? it->second : default_value;
+}
+
+void Settings::SetInt(const std::string& key, int32_t value) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    if (read_write_) {
+        g_settings_ints[ns_ + "." + key] = value;
+    }
+}
+
+std::vector<uint8_t> Settings::GetBlob(const std::string& key) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    auto it = g_settings_blobs.find(ns_ + "." + key);
+    return it != g_settings_blobs.end() ? it->second : std::vector<uint8_t>();
+}
+
+void Settings::SetBlob(const std::string& key, const void* data, size_t size) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    if (read_write_) {
+        auto bytes = (const uint8_t*)data;
+        g_settings_blobs[ns_ + "." + key] = std::vector<uint8_t>(bytes, bytes + size);
+    }
+}
+
+void Settings::EraseKey(const std::string& key) {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    if (read_write_) {
+        g_settings_strings.erase(ns_ + "." + key);
+        g_settings_ints.erase(ns_ + "." + key);
+        g_settings_blobs.erase(ns_ + "." + key);
+    }
+}
+
+void Settings::EraseAll() {
+    std::lock_guard<std::mutex> lock(g_settings_mutex);
+    if (!read_write_) {
+        return;
+    }
+    auto prefix = ns_ + ".";
+    auto erase_namespace = [&prefix](auto& map) {
+        for (auto it = map.begin(); it != map.end();) {
+            it = it->first.compare(0, prefix.size(), prefix) == 0 ? map.erase(it) : std::next(it);
+        }
+    };
+    erase_namespace(g_settings_strings);
+    erase_namespace(g_settings_ints);
+    erase_namespace(g_settings_blobs);
+}
+
+size_t SystemInfo::GetFlashSize() {
+    return 16 * 1024 * 1024;
+}
+
+size_t SystemInfo::GetMinimumFreeHeapSize() {
+    return 200 * 1024;
+}
+
+size_t SystemInfo::GetFreeHeapSize() {
+    return 200 * 1024;
+}
+
+std::string SystemInfo::GetMacAddress() {
+    int index = HostDevice::current() + 1;
+    char mac[18];
+    snprintf(mac, sizeof(mac), "02:00:00:%02x:%02x:%02x", (index >> 16) & 0xff, (index >> 8) & 0xff, index & 0xff);
+    return mac;
+}
+
+std::string SystemInfo::GetChipModelName() {
+    return "host";
+}
+
+Ota::Ota() {
+    current_version_ = esp_app_get_description()->version;
+}
+
+Ota::~Ota() {
+}
+
+void Ota::SetCheckVersionUrl(std::string check_version_url) {
+    check_version_url_ = check_version_url;
+}
+
+void Ota::SetHeader(const std::string& key, const std::string& value) {
+    headers_[key] = value;
+}
+
+void Ota::SetPostData(const std::string& post_data) {
+    post_data_ = post_data;
+}
+
+bool Ota::CheckVersion() {
+    firmware_version_ = current_version_;
+    has_new_version_ = false;
+    return true;
+}
+
+void Ota::MarkCurrentVersionValid() {
+}
+
+void Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
+}
@@ -0,0 +1,34 @@
+#ifndef WEB_SOCKET_STUB_H
+#define WEB_SOCKET_STUB_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+
+// The ml307 WebSocket client interface. The host version talks plain ws://
+// over a POSIX socket and ignores the transport the device chooses.
+class WebSocket {
+public:
+    WebSocket();
+    ~WebSocket();
+
+    void SetHeader(const char* key, const char* value);
+    bool IsConnected() const;
+    bool Connect(const char* uri);
+    bool Send(const std::string& data);
+    bool Send(const void* data, size_t len, bool binary = false, bool fin = true);
+    void Ping();
+    void Close();
+
+    void OnConnected(std::function<void()> callback);
+    void OnDisconnected(std::function<void()> callback);
+    void OnData(std::function<void(const char*, size_t, bool binary)> callback);
+    void OnError(std::function<void(int)> callback);
+
+private:
+    struct Impl;
+    Impl* impl_;
+};
+
+#endif // WEB_SOCKET_STUB_H
@@ -6,9 +6,22 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "replay_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
+#include "event_trace.h"
+#include "stack_monitor.h"
+#include "boot_sequence.h"
+#if CONFIG_CPU_MONITOR
+#include "cpu_monitor.h"
+#endif
+#if CONFIG_DEBUG_CONSOLE
+#include "debug_console.h"
+#endif
+#if CONFIG_TLS_SESSION_CACHE
+#include "tls_session_cache.h"
+#endif
 
 #include <cstring>
 #include <esp_log.h>
@@ -36,7 +49,7 @@ static const char* const STATE_STRINGS[] = {
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 8);
+    background_task_ = new BackgroundTask(CONFIG_BACKGROUND_TASK_STACK_SIZE);
 
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
@@ -110,7 +123,7 @@ void Application::CheckNewVersion() {
                 codec->EnableOutput(false);
                 {
                     std::lock_guard<std::mutex> lock(mutex_);
-                    audio_decode_queue_.clear();
+                    audio_decode_queue_.Clear();
                 }
                 background_task_->WaitForCompletion();
                 delete background_task_;
@@ -227,13 +240,11 @@ void Application::PlaySound(const std::string_view& sound) {
         p += sizeof(BinaryProtocol3);
 
         auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
+        OpusPacket opus(p3->payload, p3->payload + payload_size);
         p += payload_size;
 
         std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(opus));
+        audio_decode_queue_.Push(std::move(opus), esp_timer_get_time());
     }
 }
 
@@ -250,14 +261,11 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
-            }
-
-            keep_listening_ = true;
-            protocol_->SendStartListening(kListeningModeAutoStop);
-            SetDeviceState(kDeviceStateListening);
+            OpenAudioChannelAsync([this]() {
+                keep_listening_ = true;
+                protocol_->SendStartListening(kListeningModeAutoStop);
+                SetDeviceState(kDeviceStateListening);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -284,14 +292,15 @@ void Application::StartListening() {
     keep_listening_ = false;
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
+            auto start_listening = [this]() {
+                protocol_->SendStartListening(kListeningModeManualStop);
+                SetDeviceState(kDeviceStateListening);
+            };
             if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+                OpenAudioChannelAsync(start_listening);
+            } else {
+                start_listening();
             }
-            protocol_->SendStartListening(kListeningModeManualStop);
-            SetDeviceState(kDeviceStateListening);
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -305,6 +314,9 @@ void Application::StartListening() {
 void Application::StopListening() {
     Schedule([this]() {
         if (device_state_ == kDeviceStateListening) {
+            if (speech_end_time_ == 0) {
+                speech_end_time_ = esp_timer_get_time();
+            }
             protocol_->SendStopListening();
             SetDeviceState(kDeviceStateIdle);
         }
@@ -315,23 +327,80 @@ void Application::Start() {
     auto& board = Board::GetInstance();
     SetDeviceState(kDeviceStateStarting);
 
-    /* Setup the display */
-    auto display = board.GetDisplay();
+#if CONFIG_CPU_MONITOR
+    CpuMonitor::GetInstance().Start();
+#endif
+
+    BootSequence boot;
+    boot.AddStage("display", [&board]() {
+        board.GetDisplay();
+    });
+    boot.AddStage("audio", [this]() {
+        InitializeAudio();
+    }, {"display"});
+#if CONFIG_USE_AUDIO_PROCESSOR || CONFIG_USE_WAKE_WORD_DETECT
+    // Loading the AFE and wake word models from flash takes about as long as
+    // joining the network, and neither needs the other. The AFE's memory is
+    // not told apart from the network's then, it shows as unattributed.
+    boot.AddStage("models", [this]() {
+        InitializeAudioProcessing();
+    }, {"audio"}, true);
+#endif
+    boot.AddStage("network", [&board]() {
+        board.StartNetwork();
+    }, {"audio"});
+    boot.AddStage("protocol", [this]() {
+        InitializeProtocol();
+    }, {"network"});
+    // Check for new firmware version or get the MQTT broker address
+    boot.AddStage("ota", [this, &board]() {
+        ota_.SetCheckVersionUrl(CONFIG_OTA_VERSION_URL);
+        ota_.SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+        ota_.SetHeader("Client-Id", board.GetUuid());
+        ota_.SetHeader("Accept-Language", Lang::CODE);
+        auto app_desc = esp_app_get_description();
+        ota_.SetHeader("User-Agent", std::string(BOARD_NAME "/") + app_desc->version);
+
+        xTaskCreate([](void* arg) {
+            Application* app = (Application*)arg;
+            app->CheckNewVersion();
+            StackMonitor::GetInstance().RecordCurrentTask();
+            vTaskDelete(NULL);
+        }, "check_new_version", CONFIG_CHECK_NEW_VERSION_STACK_SIZE, this, 2, nullptr);
+    }, {"network"});
+    boot.Run();
+
+#if CONFIG_DEBUG_CONSOLE
+    RegisterConsoleCommands();
+    DebugConsole::GetInstance().Start();
+#endif
+#if CONFIG_EVENT_TRACE_AT_BOOT
+    EventTrace::GetInstance().Start();
+#endif
 
-    /* Setup the audio codec */
+    SetDeviceState(kDeviceStateIdle);
+    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+}
+
+void Application::InitializeAudio() {
+    auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
-    
+
     opus_decode_sample_rate_ = codec->output_sample_rate();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_decoder_ = std::make_unique<OpusPacketDecoder>(opus_decode_sample_rate_, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = std::make_unique<OpusPacketEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
     // For ML307 boards, we use complexity 5 to save bandwidth
     // For other boards, we use complexity 3 to save CPU
     if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        opus_complexity_ = 5;
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
-        opus_encoder_->SetComplexity(3);
+        opus_complexity_ = 3;
+    }
+    opus_encoder_->SetComplexity(opus_complexity_);
+    if (uplink_rate_controller_.bitrate() > 0) {
+        opus_encoder_->SetBitrate(uplink_rate_controller_.bitrate());
     }
 
     if (codec->input_sample_rate() != 16000) {
@@ -339,6 +408,7 @@ void Application::Start() {
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
     codec->OnInputReady([this, codec]() {
+        input_ready_time_ = esp_timer_get_time();
         BaseType_t higher_priority_task_woken = pdFALSE;
         xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
         return higher_priority_task_woken == pdTRUE;
@@ -355,26 +425,49 @@ void Application::Start() {
         Application* app = (Application*)arg;
         app->MainLoop();
         vTaskDelete(NULL);
-    }, "main_loop", 4096 * 2, this, 3, nullptr);
+    }, "main_loop", CONFIG_MAIN_LOOP_STACK_SIZE, this, 3, nullptr);
+}
 
-    /* Wait for the network to be ready */
-    board.StartNetwork();
+void Application::InitializeProtocol() {
+    auto& board = Board::GetInstance();
+    auto display = board.GetDisplay();
+    auto codec = board.GetAudioCodec();
 
-    // Initialize the protocol
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
-#ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
+#if CONFIG_SESSION_REPLAY
+    protocol_ = std::make_unique<ReplayProtocol>();
+#elif defined(CONFIG_CONNECTION_TYPE_WEBSOCKET)
     protocol_ = std::make_unique<WebsocketProtocol>();
 #else
     protocol_ = std::make_unique<MqttProtocol>();
 #endif
     protocol_->OnNetworkError([this](const std::string& message) {
-        SetDeviceState(kDeviceStateIdle);
-        Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
+        // Errors are reported from the connecting task and the network threads
+        Schedule([this, message]() {
+            SetDeviceState(kDeviceStateIdle);
+            Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
+        });
+    });
+    audio_decode_queue_.OnFlowControl([this](bool pause) {
+        ESP_LOGI(TAG, "Decode queue at %d ms, %s the server", audio_decode_queue_.duration_ms(), pause ? "pausing" : "resuming");
+        if (protocol_->IsAudioChannelOpened()) {
+            protocol_->SendFlowControl(pause);
+        }
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
+    protocol_->OnIncomingAudio([this](OpusPacket&& data) {
+        LogFirstResponse();
         std::lock_guard<std::mutex> lock(mutex_);
         if (device_state_ == kDeviceStateSpeaking) {
-            audio_decode_queue_.emplace_back(std::move(data));
+            if (awaiting_reply_audio_.exchange(false)) {
+                auto now = esp_timer_get_time();
+                auto speech_end_time = speech_end_time_.load();
+                if (speech_end_time != 0) {
+                    ESP_LOGI(TAG, "Reply audio %lld ms after end of speech", (now - speech_end_time) / 1000);
+                    response_latency_.Record(now - speech_end_time);
+                }
+                first_audio_time_ = now;
+            }
+            audio_decode_queue_.Push(std::move(data), esp_timer_get_time());
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -384,6 +477,14 @@ void Application::Start() {
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
         SetDecodeSampleRate(protocol_->server_sample_rate());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            audio_decode_queue_.EnableFlowControl(protocol_->flow_control());
+        }
+#if CONFIG_ADAPTIVE_UPLINK
+        int max_frame_duration = std::min(protocol_->max_frame_duration(), CONFIG_ADAPTIVE_UPLINK_MAX_FRAME_DURATION);
+        uplink_rate_controller_.SetMaxDuration(max_frame_duration);
+#endif
         auto& thing_manager = iot::ThingManager::GetInstance();
         protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
         std::string states;
@@ -394,12 +495,14 @@ void Application::Start() {
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
         Schedule([this]() {
+            LogLatencyStats();
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
+        LogFirstResponse();
         // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
         if (strcmp(type->valuestring, "tts") == 0) {
@@ -459,30 +562,23 @@ void Application::Start() {
         }
     });
     protocol_->Start();
+}
 
-    // Check for new firmware version or get the MQTT broker address
-    ota_.SetCheckVersionUrl(CONFIG_OTA_VERSION_URL);
-    ota_.SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    ota_.SetHeader("Client-Id", board.GetUuid());
-    ota_.SetHeader("Accept-Language", Lang::CODE);
-    auto app_desc = esp_app_get_description();
-    ota_.SetHeader("User-Agent", std::string(BOARD_NAME "/") + app_desc->version);
-
-    xTaskCreate([](void* arg) {
-        Application* app = (Application*)arg;
-        app->CheckNewVersion();
-        vTaskDelete(NULL);
-    }, "check_new_version", 4096 * 2, this, 2, nullptr);
+void Application::InitializeAudioProcessing() {
+    auto codec = Board::GetInstance().GetAudioCodec();
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_.Initialize(codec->input_channels(), codec->input_reference());
     audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+        auto scheduled_time = esp_timer_get_time();
+        background_task_->Schedule([this, data = std::move(data), scheduled_time]() mutable {
+            auto& tracer = LatencyTracer::GetInstance();
+            tracer.Record(kLatencyEncodeWait, scheduled_time);
+            auto start_time = esp_timer_get_time();
+            opus_encoder_->Encode(std::move(data), [this](OpusPacket&& opus) {
+                SendAudio(std::move(opus));
             });
+            tracer.Record(kLatencyEncode, start_time);
         });
     });
 #endif
@@ -494,8 +590,10 @@ void Application::Start() {
             if (device_state_ == kDeviceStateListening) {
                 if (speaking) {
                     voice_detected_ = true;
+                    speech_end_time_ = 0;
                 } else {
                     voice_detected_ = false;
+                    speech_end_time_ = esp_timer_get_time();
                 }
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -504,26 +602,25 @@ void Application::Start() {
     });
 
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
-        Schedule([this, &wake_word]() {
+        Schedule([this, wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
-                SetDeviceState(kDeviceStateConnecting);
                 wake_word_detect_.EncodeWakeWordData();
 
-                if (!protocol_->OpenAudioChannel()) {
-                    wake_word_detect_.StartDetection();
-                    return;
-                }
-                
-                std::vector<uint8_t> opus;
-                // Encode and send the wake word data to the server
-                while (wake_word_detect_.GetWakeWordOpus(opus)) {
-                    protocol_->SendAudio(opus);
-                }
-                // Set the chat state to wake word detected
-                protocol_->SendWakeWordDetected(wake_word);
-                ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
-                keep_listening_ = true;
-                SetDeviceState(kDeviceStateIdle);
+                // Whatever is said after the wake word is buffered while connecting
+                // and follows the wake word audio once the channel is open
+                OpenAudioChannelAsync([this, wake_word]() {
+                    OpusPacket opus;
+                    // Encode and send the wake word data to the server
+                    while (wake_word_detect_.GetWakeWordOpus(opus)) {
+                        protocol_->SendAudio(std::move(opus), false);
+                    }
+                    // Set the chat state to wake word detected
+                    protocol_->SendWakeWordDetected(wake_word);
+                    ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+                    keep_listening_ = true;
+                    protocol_->SendStartListening(kListeningModeAutoStop);
+                    SetDeviceState(kDeviceStateListening);
+                });
             } else if (device_state_ == kDeviceStateSpeaking) {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
             } else if (device_state_ == kDeviceStateActivating) {
@@ -534,22 +631,64 @@ void Application::Start() {
             wake_word_detect_.StartDetection();
         });
     });
+    // Detections before the boot is done are dropped by the state checks above
     wake_word_detect_.StartDetection();
+    ESP_LOGI(TAG, "Wake word detection ready %lld ms after power on", esp_timer_get_time() / 1000);
 #endif
-
-    SetDeviceState(kDeviceStateIdle);
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
 }
 
 void Application::OnClockTimer() {
     clock_ticks_++;
 
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM
+    // clock_ticks_ counts the seconds since the last state change
+    if (device_state_ == kDeviceStateIdle && clock_ticks_ % CONFIG_AUDIO_CHANNEL_KEEPALIVE_INTERVAL == 0) {
+        Schedule([this]() {
+            if (device_state_ != kDeviceStateIdle || !protocol_ || !protocol_->IsAudioChannelOpened()) {
+                return;
+            }
+            int idle_timeout = protocol_->idle_timeout() > 0 ? protocol_->idle_timeout() : CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT;
+            if (clock_ticks_ >= idle_timeout) {
+                ESP_LOGI(TAG, "Audio channel idle for %d seconds, closing", clock_ticks_);
+                protocol_->CloseAudioChannel();
+            } else {
+                protocol_->SendPing();
+            }
+        });
+    }
+#endif
+
+#if CONFIG_ADAPTIVE_UPLINK
+    if (device_state_ == kDeviceStateListening && protocol_) {
+        int bitrate = uplink_rate_controller_.bitrate();
+        uplink_rate_controller_.Update(protocol_->send_queue_depth(), CONFIG_SEND_QUEUE_SIZE,
+            protocol_->send_latency_ms(), protocol_->rtt_ms());
+        // Unlike the frame duration, a new bitrate applies to the running encoder
+        if (uplink_rate_controller_.bitrate() != bitrate) {
+            Schedule([this]() {
+                opus_encoder_->SetBitrate(uplink_rate_controller_.bitrate());
+            });
+        }
+        // Refresh the RTT, servers that don't answer pings simply leave it unknown
+        if (clock_ticks_ % 5 == 0) {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateListening) {
+                    protocol_->SendPing();
+                }
+            });
+        }
+    }
+#endif
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
-        // SystemInfo::PrintRealTimeStats(pdMS_TO_TICKS(1000));
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
         ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        MemoryTracker::GetInstance().Log(TAG);
+#if CONFIG_CPU_MONITOR
+        CpuMonitor::GetInstance().Log(TAG);
+#endif
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -582,6 +721,7 @@ void Application::MainLoop() {
         auto bits = xEventGroupWaitBits(event_group_,
             SCHEDULE_EVENT | AUDIO_INPUT_READY_EVENT | AUDIO_OUTPUT_READY_EVENT,
             pdTRUE, pdFALSE, portMAX_DELAY);
+        TRACE_SCOPE("main_loop");
 
         if (bits & AUDIO_INPUT_READY_EVENT) {
             InputAudio();
@@ -594,6 +734,7 @@ void Application::MainLoop() {
             std::list<std::function<void()>> tasks = std::move(main_tasks_);
             lock.unlock();
             for (auto& task : tasks) {
+                TRACE_SCOPE("schedule");
                 task();
             }
         }
@@ -603,7 +744,7 @@ void Application::MainLoop() {
 void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
     opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
+    audio_decode_queue_.Clear();
     last_output_time_ = std::chrono::steady_clock::now();
 }
 
@@ -625,34 +766,49 @@ void Application::OutputAudio() {
     }
 
     if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
+        audio_decode_queue_.Clear();
         return;
     }
 
     last_output_time_ = now;
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
+    DecodePacket packet;
+    audio_decode_queue_.Pop(packet);
     lock.unlock();
 
-    background_task_->Schedule([this, codec, opus = std::move(opus)]() mutable {
+    auto& tracer = LatencyTracer::GetInstance();
+    tracer.Record(kLatencyDecodeQueue, packet.arrival_time);
+    auto scheduled_time = esp_timer_get_time();
+    background_task_->Schedule([this, codec, &tracer, opus = std::move(packet.opus), scheduled_time]() mutable {
         if (aborted_) {
             return;
         }
+        tracer.Record(kLatencyDecodeWait, scheduled_time);
 
+        auto start_time = esp_timer_get_time();
         std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        if (!opus_decoder_->Decode(opus, pcm)) {
             return;
         }
+        tracer.Record(kLatencyDecode, start_time);
 
         // Resample if the sample rate is different
         if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
+            start_time = esp_timer_get_time();
             int target_size = output_resampler_.GetOutputSamples(pcm.size());
             std::vector<int16_t> resampled(target_size);
             output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
             pcm = std::move(resampled);
+            tracer.Record(kLatencyOutputResample, start_time);
         }
         
+        start_time = esp_timer_get_time();
         codec->OutputData(pcm);
+        tracer.Record(kLatencyOutput, start_time);
+
+        auto first_audio_time = first_audio_time_.exchange(0);
+        if (first_audio_time != 0) {
+            playout_delay_.Record(esp_timer_get_time() - first_audio_time);
+        }
     });
 }
 
@@ -662,8 +818,12 @@ void Application::InputAudio() {
     if (!codec->InputData(data)) {
         return;
     }
+    auto& tracer = LatencyTracer::GetInstance();
+    // Wraps every 71 minutes, the difference is still right
+    tracer.stage(kLatencyCapture).Record((uint32_t)esp_timer_get_time() - input_ready_time_);
 
     if (codec->input_sample_rate() != 16000) {
+        auto start_time = esp_timer_get_time();
         if (codec->input_channels() == 2) {
             auto mic_channel = std::vector<int16_t>(data.size() / 2);
             auto reference_channel = std::vector<int16_t>(data.size() / 2);
@@ -685,6 +845,7 @@ void Application::InputAudio() {
             input_resampler_.Process(data.data(), data.size(), resampled.data());
             data = std::move(resampled);
         }
+        tracer.Record(kLatencyResample, start_time);
     }
 
 #if CONFIG_USE_WAKE_WORD_DETECT
@@ -697,18 +858,211 @@ void Application::InputAudio() {
         audio_processor_.Input(data);
     }
 #else
-    if (device_state_ == kDeviceStateListening) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+    if (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateConnecting) {
+        auto scheduled_time = esp_timer_get_time();
+        background_task_->Schedule([this, data = std::move(data), scheduled_time]() mutable {
+            auto& tracer = LatencyTracer::GetInstance();
+            tracer.Record(kLatencyEncodeWait, scheduled_time);
+            auto start_time = esp_timer_get_time();
+            opus_encoder_->Encode(std::move(data), [this](OpusPacket&& opus) {
+                SendAudio(std::move(opus));
             });
+            tracer.Record(kLatencyEncode, start_time);
         });
     }
 #endif
 }
 
+void Application::OpenAudioChannelAsync(std::function<void()> on_opened) {
+    if (wake_up_time_ == 0) {
+        wake_up_time_ = esp_timer_get_time();
+    }
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM
+    // Skip connecting and the hello exchange if the channel was kept open
+    if (protocol_->IsAudioChannelOpened()) {
+        ESP_LOGI(TAG, "Reusing the warm audio channel");
+        on_opened();
+        return;
+    }
+#endif
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        preconnect_audio_.clear();
+        buffering_audio_ = true;
+    }
+    SetDeviceState(kDeviceStateConnecting);
+
+    // Connecting may take seconds, do it on a separate task so that the main loop
+    // keeps capturing audio, and continue on the main loop once it is done
+    auto task = new std::function<void()>([this, on_opened]() {
+        bool opened = protocol_->OpenAudioChannel();
+        Schedule([this, opened, on_opened]() {
+            if (!opened || device_state_ != kDeviceStateConnecting) {
+                FlushPreconnectAudio(false);
+                wake_up_time_ = 0;
+                if (opened) {
+                    // Given up on while connecting, nothing is going to use the channel
+                    ESP_LOGI(TAG, "Audio channel opened after the device left the connecting state, closing");
+                    protocol_->CloseAudioChannel();
+                }
+                if (device_state_ == kDeviceStateConnecting) {
+                    SetDeviceState(kDeviceStateIdle);
+                }
+                return;
+            }
+            ESP_LOGI(TAG, "Audio channel opened in %lld ms", (esp_timer_get_time() - wake_up_time_) / 1000);
+            on_opened();
+            FlushPreconnectAudio(true);
+        });
+    });
+    xTaskCreate([](void* arg) {
+        auto task = (std::function<void()>*)arg;
+        (*task)();
+        delete task;
+        StackMonitor::GetInstance().RecordCurrentTask();
+        vTaskDelete(NULL);
+    }, "open_channel", CONFIG_OPEN_CHANNEL_STACK_SIZE, task, 3, nullptr);
+}
+
+void Application::FlushPreconnectAudio(bool send) {
+    std::lock_guard<std::mutex> lock(preconnect_mutex_);
+    if (send && !preconnect_audio_.empty()) {
+        ESP_LOGI(TAG, "Sending %u packets captured while connecting", preconnect_audio_.size());
+        for (auto& opus : preconnect_audio_) {
+            protocol_->SendAudio(std::move(opus), false);
+        }
+    }
+    preconnect_audio_.clear();
+    buffering_audio_ = false;
+}
+
+// Called from the background task with every encoded packet
+void Application::SendAudio(OpusPacket&& packet) {
+    std::lock_guard<std::mutex> lock(preconnect_mutex_);
+    if (buffering_audio_) {
+        if (preconnect_audio_.size() >= MAX_PRECONNECT_AUDIO_MS / OPUS_FRAME_DURATION_MS) {
+            preconnect_audio_.pop_front();
+        }
+        preconnect_audio_.emplace_back(std::move(packet));
+        return;
+    }
+    // Only queued here, the protocol's sender task does the network I/O
+    protocol_->SendAudio(std::move(packet));
+}
+
+void Application::LogFirstResponse() {
+    auto wake_up_time = wake_up_time_.exchange(0);
+    if (wake_up_time != 0) {
+        ESP_LOGI(TAG, "First server response %lld ms after wake up", (esp_timer_get_time() - wake_up_time) / 1000);
+    }
+}
+
+#if CONFIG_DEBUG_CONSOLE
+void Application::RegisterConsoleCommands() {
+    DebugConsole::GetInstance().RegisterCommand("latency",
+        "Print the latency histograms as JSON, 'latency reset' clears them", [this](int argc, char** argv) {
+        auto& tracer = LatencyTracer::GetInstance();
+        std::vector<Histogram*> histograms = {
+            &response_latency_, &playout_delay_,
+            &protocol_->send_queue_delay(), &protocol_->send_duration(),
+            &protocol_->rtt(), &protocol_->downlink_lateness(),
+#if CONFIG_TLS_SESSION_CACHE
+            &TlsSessionCache::GetInstance().full_handshakes(),
+            &TlsSessionCache::GetInstance().resumed_handshakes(),
+#endif
+        };
+        if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+            tracer.Reset();
+            for (auto histogram : histograms) {
+                histogram->Reset();
+            }
+            return 0;
+        }
+        printf("%s\n", tracer.GetJson().c_str());
+        for (auto histogram : histograms) {
+            printf("%s\n", histogram->GetJson().c_str());
+        }
+        return 0;
+    });
+    DebugConsole::GetInstance().RegisterCommand("memory",
+        "Print the tagged memory usage as JSON, 'memory reset' restarts the peaks", [](int argc, char** argv) {
+        auto& tracker = MemoryTracker::GetInstance();
+        if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+            tracker.ResetPeaks();
+        }
+        printf("%s\n", tracker.GetJson().c_str());
+        return 0;
+    });
+    DebugConsole::GetInstance().RegisterCommand("queue",
+        "Print the downlink decode queue and its high-water marks as JSON, 'queue reset' restarts them", [this](int argc, char** argv) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+            audio_decode_queue_.ResetStats();
+        }
+        printf("%s\n", audio_decode_queue_.GetJson().c_str());
+        return 0;
+    });
+    DebugConsole::GetInstance().RegisterCommand("pool",
+        "Print the packet pool statistics as JSON, 'pool trim' releases free slabs", [](int argc, char** argv) {
+        auto& pool = PacketPool::GetInstance();
+        if (argc > 1 && strcmp(argv[1], "trim") == 0) {
+            pool.Trim();
+        }
+        printf("%s\n", pool.GetJson().c_str());
+        return 0;
+    });
+    DebugConsole::GetInstance().RegisterCommand("stacks",
+        "Print the peak stack use of each task with suggested sizes, 'stacks json' prints it as JSON", [](int argc, char** argv) {
+        auto& monitor = StackMonitor::GetInstance();
+        if (argc > 1 && strcmp(argv[1], "json") == 0) {
+            printf("%s\n", monitor.GetJson().c_str());
+        } else {
+            monitor.Print();
+        }
+        return 0;
+    });
+#if CONFIG_CPU_MONITOR
+    DebugConsole::GetInstance().RegisterCommand("cpu",
+        "Print the CPU load and stack high-water mark of every task, 'cpu json' prints it as JSON", [](int argc, char** argv) {
+        auto& monitor = CpuMonitor::GetInstance();
+        if (argc > 1 && strcmp(argv[1], "json") == 0) {
+            printf("%s\n", monitor.GetJson().c_str());
+        } else {
+            monitor.Print();
+        }
+        return 0;
+    });
+#endif
+#if CONFIG_EVENT_TRACE
+    DebugConsole::GetInstance().RegisterCommand("trace",
+        "Event tracing: 'trace start', 'trace stop' or 'trace dump'", [](int argc, char** argv) {
+        auto& trace = EventTrace::GetInstance();
+        if (argc > 1 && strcmp(argv[1], "start") == 0) {
+            trace.Start();
+        } else if (argc > 1 && strcmp(argv[1], "stop") == 0) {
+            trace.Stop();
+        } else if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+            trace.Dump();
+        } else {
+            printf("Usage: trace start|stop|dump\n");
+            return 1;
+        }
+        return 0;
+    });
+#endif
+}
+#endif
+
+void Application::LogLatencyStats() {
+    response_latency_.Log(TAG);
+    playout_delay_.Log(TAG);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_decode_queue_.Log(TAG);
+    }
+    LatencyTracer::GetInstance().Log();
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -724,6 +1078,7 @@ void Application::SetDeviceState(DeviceState state) {
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
+    TRACE_INSTANT(STATE_STRINGS[device_state_]);
     // The state is changed, wait for all background tasks to finish
     background_task_->WaitForCompletion();
 
@@ -740,17 +1095,31 @@ void Application::SetDeviceState(DeviceState state) {
 #if CONFIG_USE_AUDIO_PROCESSOR
             audio_processor_.Stop();
 #endif
+            // Give back the packet slabs a long reply needed
+            PacketPool::GetInstance().Trim();
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
             display->SetEmotion("neutral");
             display->SetChatMessage("system", "");
+            // Start capturing now, the packets are sent once the channel is open
+            opus_encoder_->ResetState();
+#if CONFIG_USE_AUDIO_PROCESSOR
+            audio_processor_.Start();
+#endif
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
             ResetDecoder();
-            opus_encoder_->ResetState();
+            speech_end_time_ = 0;
+            awaiting_reply_audio_ = true;
+            if (previous_state != kDeviceStateConnecting) {
+                // Continue the stream that was started while connecting,
+                // otherwise a new turn starts and the frame duration may change
+                UpdateUplinkEncoder();
+                opus_encoder_->ResetState();
+            }
 #if CONFIG_USE_AUDIO_PROCESSOR
             audio_processor_.Start();
 #endif
@@ -781,7 +1150,7 @@ void Application::SetDecodeSampleRate(int sample_rate) {
 
     opus_decode_sample_rate_ = sample_rate;
     opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
+    opus_decoder_ = std::make_unique<OpusPacketDecoder>(opus_decode_sample_rate_, 1, OPUS_FRAME_DURATION_MS);
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
@@ -790,6 +1159,20 @@ void Application::SetDecodeSampleRate(int sample_rate) {
     }
 }
 
+// Called between turns only, while no audio is being encoded
+void Application::UpdateUplinkEncoder() {
+    int duration_ms = uplink_rate_controller_.frame_duration();
+    if (opus_encoder_->duration_ms() == duration_ms) {
+        return;
+    }
+    ESP_LOGI(TAG, "Switching uplink frame duration to %d ms", duration_ms);
+    opus_encoder_ = std::make_unique<OpusPacketEncoder>(16000, 1, duration_ms);
+    opus_encoder_->SetComplexity(opus_complexity_);
+    if (uplink_rate_controller_.bitrate() > 0) {
+        opus_encoder_->SetBitrate(uplink_rate_controller_.bitrate());
+    }
+}
+
 void Application::UpdateIotStates() {
     auto& thing_manager = iot::ThingManager::GetInstance();
     std::string states;
@@ -805,12 +1188,22 @@ void Application::Reboot() {
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
     if (device_state_ == kDeviceStateIdle) {
-        ToggleChatState();
+        if (!protocol_) {
+            ESP_LOGE(TAG, "Protocol not initialized");
+            return;
+        }
         Schedule([this, wake_word]() {
-            if (protocol_) {
-                protocol_->SendWakeWordDetected(wake_word); 
+            if (device_state_ != kDeviceStateIdle) {
+                return;
             }
-        }); 
+            // Same as a detected wake word: nothing is sent before the channel is open
+            OpenAudioChannelAsync([this, wake_word]() {
+                protocol_->SendWakeWordDetected(wake_word);
+                keep_listening_ = true;
+                protocol_->SendStartListening(kListeningModeAutoStop);
+                SetDeviceState(kDeviceStateListening);
+            });
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
@@ -829,10 +1222,24 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
+#if !CONFIG_AUDIO_CHANNEL_KEEP_WARM
+    // A warm channel does not keep the device awake, it is closed on sleep instead
     if (protocol_ && protocol_->IsAudioChannelOpened()) {
         return false;
     }
+#endif
 
     // Now it is safe to enter sleep mode
     return true;
 }
+
+void Application::CloseWarmAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM
+    Schedule([this]() {
+        if (device_state_ == kDeviceStateIdle && protocol_ && protocol_->IsAudioChannelOpened()) {
+            ESP_LOGI(TAG, "Closing the warm audio channel for power saving");
+            protocol_->CloseAudioChannel();
+        }
+    });
+#endif
+}
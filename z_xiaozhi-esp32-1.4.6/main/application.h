@@ -9,14 +9,20 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <atomic>
 
-#include <opus_encoder.h>
-#include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "rate_controller.h"
+#include "histogram.h"
+#include "latency_tracer.h"
+#include "memory_tracker.h"
+#include "packet_pool.h"
+#include "decode_queue.h"
+#include "opus_codec.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
@@ -43,6 +49,8 @@ enum DeviceState {
 };
 
 #define OPUS_FRAME_DURATION_MS 60
+// Audio captured while the audio channel is opening is kept up to this length
+#define MAX_PRECONNECT_AUDIO_MS 3000
 
 class Application {
 public:
@@ -70,6 +78,7 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     void PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
+    void CloseWarmAudioChannel();
 
 private:
     Application();
@@ -96,21 +105,54 @@ private:
     // Audio encode / decode
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
-
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    DecodeQueue audio_decode_queue_{OPUS_FRAME_DURATION_MS};
+    // Set by the I2S receive interrupt, microseconds truncated to 32 bits
+    volatile uint32_t input_ready_time_ = 0;
+
+    // Opus packets encoded before the audio channel is open
+    std::mutex preconnect_mutex_;
+    bool buffering_audio_ = false;
+    std::list<OpusPacket> preconnect_audio_;
+    // Time the user asked for a conversation, cleared on the first server response
+    std::atomic<int64_t> wake_up_time_ = 0;
+    // Turn latency: end of the user's speech to the first reply audio,
+    // and that audio's arrival to the speaker
+    std::atomic<int64_t> speech_end_time_ = 0;
+    std::atomic<int64_t> first_audio_time_ = 0;
+    std::atomic<bool> awaiting_reply_audio_ = false;
+    Histogram response_latency_{"response_latency"};
+    Histogram playout_delay_{"playout_delay"};
+
+    std::unique_ptr<OpusPacketEncoder> opus_encoder_;
+    int opus_complexity_ = 3;
+#if CONFIG_ADAPTIVE_UPLINK
+    RateController uplink_rate_controller_{OPUS_FRAME_DURATION_MS, OPUS_FRAME_DURATION_MS,
+        CONFIG_ADAPTIVE_UPLINK_MIN_BITRATE, CONFIG_ADAPTIVE_UPLINK_MAX_BITRATE};
+#else
+    RateController uplink_rate_controller_{OPUS_FRAME_DURATION_MS, OPUS_FRAME_DURATION_MS};
+#endif
+    std::unique_ptr<OpusPacketDecoder> opus_decoder_;
 
     int opus_decode_sample_rate_ = -1;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
 
+    void InitializeAudio();
+    void InitializeProtocol();
+    void InitializeAudioProcessing();
     void MainLoop();
     void InputAudio();
     void OutputAudio();
     void ResetDecoder();
+    void OpenAudioChannelAsync(std::function<void()> on_opened);
+    void FlushPreconnectAudio(bool send);
+    void SendAudio(OpusPacket&& opus);
+    void LogFirstResponse();
+    void LogLatencyStats();
+    void RegisterConsoleCommands();
     void SetDecodeSampleRate(int sample_rate);
+    void UpdateUplinkEncoder();
     void CheckNewVersion();
     void ShowActivationCode();
     void OnClockTimer();
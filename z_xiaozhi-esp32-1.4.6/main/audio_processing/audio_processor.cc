@@ -1,5 +1,8 @@
 #include "audio_processor.h"
+#include "latency_tracer.h"
+#include "event_trace.h"
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define PROCESSOR_RUNNING 0x01
 
@@ -47,13 +50,16 @@ void AudioProcessor::Initialize(int channels, bool reference) {
         .fixed_first_channel = true,
     };
 
-    afe_communication_data_ = esp_afe_vc_v1.create_from_config(&afe_config);
+    {
+        MemoryTagScope memory_scope(kMemoryTagAfe);
+        afe_communication_data_ = esp_afe_vc_v1.create_from_config(&afe_config);
+    }
     
     xTaskCreate([](void* arg) {
         auto this_ = (AudioProcessor*)arg;
         this_->AudioProcessorTask();
         vTaskDelete(NULL);
-    }, "audio_communication", 4096 * 2, this, 2, NULL);
+    }, "audio_communication", CONFIG_AUDIO_COMMUNICATION_STACK_SIZE, this, 2, NULL);
 }
 
 AudioProcessor::~AudioProcessor() {
@@ -69,7 +75,10 @@ void AudioProcessor::Input(const std::vector<int16_t>& data) {
     auto feed_size = esp_afe_vc_v1.get_feed_chunksize(afe_communication_data_) * channels_;
     while (input_buffer_.size() >= feed_size) {
         auto chunk = input_buffer_.data();
+        uint32_t index = fed_chunks_;
+        feed_times_[index % kFeedTimeSlots] = esp_timer_get_time();
         esp_afe_vc_v1.feed(afe_communication_data_, chunk);
+        fed_chunks_ = index + 1;
         input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + feed_size);
     }
 }
@@ -100,9 +109,6 @@ void AudioProcessor::AudioProcessorTask() {
         xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
 
         auto res = esp_afe_vc_v1.fetch(afe_communication_data_);
-        if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
-            continue;
-        }
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             if (res != nullptr) {
                 ESP_LOGI(TAG, "Error code: %d", res->ret_value);
@@ -110,6 +116,17 @@ void AudioProcessor::AudioProcessorTask() {
             continue;
         }
 
+        // Time since the feed chunk holding the last fetched sample went in
+        fetched_samples_ += res->data_size / sizeof(int16_t);
+        uint32_t chunk = (fetched_samples_ - 1) / feed_size;
+        if (chunk < fed_chunks_ && fed_chunks_ - chunk <= kFeedTimeSlots) {
+            LatencyTracer::GetInstance().Record(kLatencyAfe, feed_times_[chunk % kFeedTimeSlots]);
+        }
+        if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
+            continue;
+        }
+
+        TRACE_SCOPE("afe_fetch");
         if (output_callback_) {
             output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
         }
@@ -9,6 +9,9 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
+
+#include "memory_tracker.h"
 
 class AudioProcessor {
 public:
@@ -25,10 +28,15 @@ public:
 private:
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_data_t* afe_communication_data_ = nullptr;
-    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t, InternalAllocator<int16_t, kMemoryTagAfe>> input_buffer_;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     int channels_;
     bool reference_;
+    // Feed times by chunk, so that fetched audio can be traced back to when it went in
+    static constexpr int kFeedTimeSlots = 16;
+    int64_t feed_times_[kFeedTimeSlots] = {};
+    std::atomic<uint32_t> fed_chunks_ = 0;
+    uint32_t fetched_samples_ = 0;
 
     void AudioProcessorTask();
 };
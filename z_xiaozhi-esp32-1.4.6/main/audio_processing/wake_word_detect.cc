@@ -1,5 +1,6 @@
 #include "wake_word_detect.h"
 #include "application.h"
+#include "stack_monitor.h"
 
 #include <esp_log.h>
 #include <model_path.h>
@@ -82,13 +83,16 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
         .fixed_first_channel = true,
     };
 
-    afe_detection_data_ = esp_afe_sr_v1.create_from_config(&afe_config);
+    {
+        MemoryTagScope memory_scope(kMemoryTagAfe);
+        afe_detection_data_ = esp_afe_sr_v1.create_from_config(&afe_config);
+    }
 
     xTaskCreate([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096 * 2, this, 2, nullptr);
+    }, "audio_detection", CONFIG_AUDIO_DETECTION_STACK_SIZE, this, 2, nullptr);
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -162,7 +166,7 @@ void WakeWordDetect::AudioDetectionTask() {
 
 void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
     // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
+    wake_word_pcm_.emplace_back(data, data + samples);
     // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
     while (wake_word_pcm_.size() > 2000 / 32) {
         wake_word_pcm_.pop_front();
@@ -172,17 +176,17 @@ void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
 void WakeWordDetect::EncodeWakeWordData() {
     wake_word_opus_.clear();
     if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(CONFIG_WAKE_WORD_ENCODE_STACK_SIZE, MALLOC_CAP_SPIRAM);
     }
     wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusPacketEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
             encoder->SetComplexity(0); // 0 is the fastest
 
             for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
+                encoder->Encode(std::vector<int16_t>(pcm.begin(), pcm.end()), [this_](OpusPacket&& opus) {
                     std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
                     this_->wake_word_opus_.emplace_back(std::move(opus));
                     this_->wake_word_cv_.notify_all();
@@ -195,14 +199,15 @@ void WakeWordDetect::EncodeWakeWordData() {
                 this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
 
             std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
+            this_->wake_word_opus_.push_back(OpusPacket());
             this_->wake_word_cv_.notify_all();
         }
+        StackMonitor::GetInstance().RecordCurrentTask();
         vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+    }, "encode_detect_packets", CONFIG_WAKE_WORD_ENCODE_STACK_SIZE, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
 }
 
-bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+bool WakeWordDetect::GetWakeWordOpus(OpusPacket& opus) {
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
     wake_word_cv_.wait(lock, [this]() {
         return !wake_word_opus_.empty();
@@ -15,6 +15,9 @@
 #include <mutex>
 #include <condition_variable>
 
+#include "memory_tracker.h"
+#include "packet_pool.h"
+
 
 class WakeWordDetect {
 public:
@@ -29,14 +32,14 @@ public:
     void StopDetection();
     bool IsDetectionRunning();
     void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    bool GetWakeWordOpus(OpusPacket& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
     esp_afe_sr_data_t* afe_detection_data_ = nullptr;
     char* wakenet_model_ = NULL;
     std::vector<std::string> wake_words_;
-    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t, InternalAllocator<int16_t, kMemoryTagAfe>> input_buffer_;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
@@ -48,8 +51,10 @@ private:
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    // Pre-roll sent to the server after a wake word, about 64 KB
+    using PcmBuffer = std::vector<int16_t, BulkAllocator<int16_t, kMemoryTagAfe>>;
+    std::list<PcmBuffer, BulkAllocator<PcmBuffer, kMemoryTagAfe>> wake_word_pcm_;
+    std::list<OpusPacket> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
@@ -1,4 +1,7 @@
 #include "background_task.h"
+#include "event_trace.h"
+#include "memory_tracker.h"
+#include "stack_monitor.h"
 
 #include <esp_log.h>
 #include <esp_task_wdt.h>
@@ -14,6 +17,7 @@ BackgroundTask::BackgroundTask(uint32_t stack_size) {
 
 BackgroundTask::~BackgroundTask() {
     if (background_task_handle_ != nullptr) {
+        StackMonitor::GetInstance().Record("background_task", uxTaskGetStackHighWaterMark(background_task_handle_));
         vTaskDelete(background_task_handle_);
     }
 }
@@ -24,9 +28,11 @@ void BackgroundTask::Schedule(std::function<void()> callback) {
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         if (free_sram < 10000) {
             ESP_LOGW(TAG, "active_tasks_ == %u, free_sram == %u", active_tasks_.load(), free_sram);
+            MemoryTracker::GetInstance().Log(TAG);
         }
     }
     active_tasks_++;
+    TRACE_COUNTER("background_jobs", active_tasks_);
     main_tasks_.emplace_back([this, cb = std::move(callback)]() {
         cb();
         {
@@ -57,6 +63,7 @@ void BackgroundTask::BackgroundTaskLoop() {
         lock.unlock();
 
         for (auto& task : tasks) {
+            TRACE_SCOPE("background_job");
             task();
         }
     }
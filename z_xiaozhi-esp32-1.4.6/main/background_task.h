@@ -7,6 +7,7 @@
 #include <list>
 #include <condition_variable>
 #include <atomic>
+#include <functional>
 
 class BackgroundTask {
 public:
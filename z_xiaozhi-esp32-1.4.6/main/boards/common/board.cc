@@ -3,6 +3,9 @@
 #include "settings.h"
 #include "display/display.h"
 #include "assets/lang_config.h"
+#if CONFIG_CPU_MONITOR
+#include "cpu_monitor.h"
+#endif
 
 #include <esp_log.h>
 #include <esp_ota_ops.h>
@@ -93,6 +96,12 @@ std::string Board::GetJson() {
             "ota": {
                 "label": "ota_0"
             },
+            "cpu": {
+                "window_ms": 1000,
+                "age_ms": 120,
+                "cores": [{"load": 12.5, "avg": 10.2}, ...],
+                "tasks": [{"name": "main_loop", "priority": 3, "state": "blocked", "load": 2.1, "avg": 1.8, "stack_free": 3012}, ...]
+            },
             "board": {
                 ...
             }
@@ -151,6 +160,10 @@ std::string Board::GetJson() {
     json += "\"label\":\"" + std::string(ota_partition->label) + "\"";
     json += "},";
 
+#if CONFIG_CPU_MONITOR
+    json += "\"cpu\":" + CpuMonitor::GetInstance().GetJson() + ",";
+#endif
+
     json += "\"board\":" + GetBoardJson();
 
     // Close the JSON object
@@ -63,6 +63,7 @@ void PowerSaveTimer::PowerSaveCheck() {
     if (seconds_to_sleep_ != -1 && ticks_ >= seconds_to_sleep_) {
         if (!in_sleep_mode_) {
             in_sleep_mode_ = true;
+            app.CloseWarmAudioChannel();
             if (on_enter_sleep_mode_) {
                 on_enter_sleep_mode_();
             }
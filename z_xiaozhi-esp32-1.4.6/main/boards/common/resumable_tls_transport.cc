@@ -0,0 +1,217 @@
+// The master secret is needed to tell a resumed handshake from a full one
+#define MBEDTLS_ALLOW_PRIVATE_ACCESS
+
+#include "resumable_tls_transport.h"
+#include "tls_session_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_crt_bundle.h>
+#include <mbedtls/platform_util.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define TAG "ResumableTls"
+
+ResumableTlsTransport::ResumableTlsTransport() {
+    mbedtls_net_init(&server_fd_);
+    mbedtls_ssl_init(&ssl_);
+    mbedtls_ssl_config_init(&conf_);
+    mbedtls_entropy_init(&entropy_);
+    mbedtls_ctr_drbg_init(&ctr_drbg_);
+}
+
+ResumableTlsTransport::~ResumableTlsTransport() {
+    Disconnect();
+    mbedtls_ssl_free(&ssl_);
+    mbedtls_ssl_config_free(&conf_);
+    mbedtls_ctr_drbg_free(&ctr_drbg_);
+    mbedtls_entropy_free(&entropy_);
+}
+
+bool ResumableTlsTransport::Configure() {
+    int ret = mbedtls_ctr_drbg_seed(&ctr_drbg_, mbedtls_entropy_func, &entropy_, nullptr, 0);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to seed the random generator: -0x%x", -ret);
+        return false;
+    }
+    ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to set TLS defaults: -0x%x", -ret);
+        return false;
+    }
+    mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &ctr_drbg_);
+    mbedtls_ssl_conf_read_timeout(&conf_, TLS_READ_TIMEOUT_MS);
+    if (esp_crt_bundle_attach(&conf_) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to attach the certificate bundle");
+        return false;
+    }
+    ret = mbedtls_ssl_setup(&ssl_, &conf_);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to set up TLS: -0x%x", -ret);
+        return false;
+    }
+    configured_ = true;
+    return true;
+}
+
+bool ResumableTlsTransport::OfferCachedSession(const std::string& server, unsigned char* master) {
+    auto data = TlsSessionCache::GetInstance().Get(server);
+    if (data.empty()) {
+        return false;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    bool offered = mbedtls_ssl_session_load(&session, data.data(), data.size()) == 0 &&
+        mbedtls_ssl_set_session(&ssl_, &session) == 0;
+    if (offered) {
+        memcpy(master, session.master, sizeof(session.master));
+    } else {
+        // Saved by a different mbedtls build or configuration
+        TlsSessionCache::GetInstance().Remove(server);
+    }
+    mbedtls_ssl_session_free(&session);
+    return offered;
+}
+
+void ResumableTlsTransport::SaveSession(const std::string& server, const unsigned char* offered_master, bool* resumed) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(&ssl_, &session) != 0) {
+        mbedtls_ssl_session_free(&session);
+        return;
+    }
+
+    // A resumed handshake keeps the master secret, a full one derives a new one.
+    // (Comparing session ids does not work with tickets, the client picks a random id.)
+    *resumed = offered_master != nullptr && memcmp(session.master, offered_master, sizeof(session.master)) == 0;
+
+    size_t length = 0;
+    mbedtls_ssl_session_save(&session, nullptr, 0, &length);
+    std::vector<uint8_t> data(length);
+    if (length > 0 && mbedtls_ssl_session_save(&session, data.data(), data.size(), &length) == 0) {
+        TlsSessionCache::GetInstance().Put(server, std::move(data));
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+bool ResumableTlsTransport::Connect(const char* host, int port) {
+    if (configured_) {
+        mbedtls_ssl_session_reset(&ssl_);
+    } else if (!Configure()) {
+        return false;
+    }
+
+    auto start_time = esp_timer_get_time();
+    std::string port_str = std::to_string(port);
+    int ret = mbedtls_net_connect(&server_fd_, host, port_str.c_str(), MBEDTLS_NET_PROTO_TCP);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d: -0x%x", host, port, -ret);
+        return false;
+    }
+    mbedtls_ssl_set_hostname(&ssl_, host);
+    // The timeout variant of recv, so that a stalled server can't hold the caller forever
+    mbedtls_ssl_set_bio(&ssl_, &server_fd_, mbedtls_net_send, nullptr, mbedtls_net_recv_timeout);
+    received_data_ = false;
+
+    std::string server = std::string(host) + ":" + port_str;
+    unsigned char offered_master[48];
+    bool offered = OfferCachedSession(server, offered_master);
+
+    // Step by step, so that a server trickling its handshake messages runs
+    // into the deadline; each read is bounded by the read timeout
+    auto handshake_start_time = esp_timer_get_time();
+    ret = 0;
+    while (!mbedtls_ssl_is_handshake_over(&ssl_)) {
+        ret = mbedtls_ssl_handshake_step(&ssl_);
+        if (ret != 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            break;
+        }
+        ret = 0;
+        if (!mbedtls_ssl_is_handshake_over(&ssl_) &&
+            esp_timer_get_time() - handshake_start_time >= TLS_HANDSHAKE_TIMEOUT_MS * 1000LL) {
+            ret = MBEDTLS_ERR_SSL_TIMEOUT;
+            break;
+        }
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS handshake with %s failed: -0x%x", server.c_str(), -ret);
+        if (offered) {
+            TlsSessionCache::GetInstance().Remove(server);
+        }
+        mbedtls_platform_zeroize(offered_master, sizeof(offered_master));
+        mbedtls_net_free(&server_fd_);
+        return false;
+    }
+
+    bool resumed = false;
+    SaveSession(server, offered ? offered_master : nullptr, &resumed);
+    mbedtls_platform_zeroize(offered_master, sizeof(offered_master));
+    auto duration_us = esp_timer_get_time() - start_time;
+    ESP_LOGI(TAG, "Connected to %s in %lld ms (%s handshake)", server.c_str(), duration_us / 1000, resumed ? "resumed" : "full");
+    TlsSessionCache::GetInstance().RecordHandshake(resumed, duration_us);
+
+    connected_ = true;
+    return true;
+}
+
+void ResumableTlsTransport::Disconnect() {
+    if (connected_) {
+        mbedtls_ssl_close_notify(&ssl_);
+        connected_ = false;
+    }
+    mbedtls_net_free(&server_fd_);
+}
+
+int ResumableTlsTransport::Send(const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int ret = mbedtls_ssl_write(&ssl_, (const unsigned char*)data + sent, length - sent);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to send: -0x%x", -ret);
+            connected_ = false;
+            return ret;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+int ResumableTlsTransport::Receive(char* buffer, size_t bufferSize) {
+    int ret;
+    while (true) {
+        ret = mbedtls_ssl_read(&ssl_, (unsigned char*)buffer, bufferSize);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        // Quiet is normal on an open channel, not while waiting for the
+        // server's first answer on the connecting task
+        if (ret == MBEDTLS_ERR_SSL_TIMEOUT && received_data_) {
+            continue;
+        }
+        break;
+    }
+    if (ret > 0) {
+        received_data_ = true;
+    }
+    if (ret == MBEDTLS_ERR_SSL_TIMEOUT) {
+        ESP_LOGE(TAG, "No answer from the server in %d ms", TLS_READ_TIMEOUT_MS);
+        connected_ = false;
+        return ret;
+    }
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        connected_ = false;
+        return 0;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to receive: -0x%x", -ret);
+        connected_ = false;
+    }
+    return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef RESUMABLE_TLS_TRANSPORT_H
+#define RESUMABLE_TLS_TRANSPORT_H
+
+#include <transport.h>
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+
+// A read waits at most this long for the server while connecting, until
+// the server sent its first data (the websocket upgrade response). Later
+// reads may wait as long as the connection stays quiet.
+#define TLS_READ_TIMEOUT_MS 10000
+// TCP connect excluded
+#define TLS_HANDSHAKE_TIMEOUT_MS 15000
+
+// TLS transport that offers the session of the previous connection to the
+// same server (see TlsSessionCache), turning reconnects into abbreviated handshakes.
+class ResumableTlsTransport : public Transport {
+public:
+    ResumableTlsTransport();
+    ~ResumableTlsTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t bufferSize) override;
+
+private:
+    mbedtls_net_context server_fd_;
+    mbedtls_ssl_context ssl_;
+    mbedtls_ssl_config conf_;
+    mbedtls_entropy_context entropy_;
+    mbedtls_ctr_drbg_context ctr_drbg_;
+    bool configured_ = false;
+    bool received_data_ = false;
+
+    bool Configure();
+    bool OfferCachedSession(const std::string& server, unsigned char* master);
+    void SaveSession(const std::string& server, const unsigned char* offered_master, bool* resumed);
+};
+
+#endif // RESUMABLE_TLS_TRANSPORT_H
@@ -0,0 +1,61 @@
+#include "tls_session_cache.h"
+#include "settings.h"
+
+#include <esp_log.h>
+
+#define TAG "TlsSessionCache"
+
+TlsSessionCache::TlsSessionCache()
+    : full_handshakes_("tls_full_handshake"), resumed_handshakes_("tls_resumed_handshake") {
+#if CONFIG_TLS_SESSION_CACHE_NVS
+    Settings settings("tls", false);
+    auto server = settings.GetString("server");
+    auto session = settings.GetBlob("session");
+    if (!server.empty() && !session.empty()) {
+        ESP_LOGI(TAG, "Loaded TLS session for %s", server.c_str());
+        sessions_[server] = std::move(session);
+    }
+#endif
+}
+
+std::vector<uint8_t> TlsSessionCache::Get(const std::string& server) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(server);
+    if (it == sessions_.end()) {
+        return std::vector<uint8_t>();
+    }
+    return it->second;
+}
+
+void TlsSessionCache::Put(const std::string& server, std::vector<uint8_t>&& session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = sessions_[server];
+    if (entry == session) {
+        return;
+    }
+    entry = std::move(session);
+#if CONFIG_TLS_SESSION_CACHE_NVS
+    // Only the latest session is persisted, NVS is not the place for a cache
+    Settings settings("tls", true);
+    settings.SetString("server", server);
+    settings.SetBlob("session", entry.data(), entry.size());
+#endif
+}
+
+void TlsSessionCache::Remove(const std::string& server) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(server);
+#if CONFIG_TLS_SESSION_CACHE_NVS
+    Settings settings("tls", true);
+    if (settings.GetString("server") == server) {
+        settings.EraseKey("server");
+        settings.EraseKey("session");
+    }
+#endif
+}
+
+void TlsSessionCache::RecordHandshake(bool resumed, int64_t duration_us) {
+    auto& histogram = resumed ? resumed_handshakes_ : full_handshakes_;
+    histogram.Record(duration_us);
+    histogram.Log(TAG);
+}
@@ -0,0 +1,39 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+
+#include "histogram.h"
+
+// Serialized TLS sessions per server ("host:port"), reused by reconnects to
+// get an abbreviated handshake. Optionally the latest session survives a reboot in NVS.
+class TlsSessionCache {
+public:
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    std::vector<uint8_t> Get(const std::string& server);
+    void Put(const std::string& server, std::vector<uint8_t>&& session);
+    void Remove(const std::string& server);
+
+    void RecordHandshake(bool resumed, int64_t duration_us);
+    Histogram& full_handshakes() { return full_handshakes_; }
+    Histogram& resumed_handshakes() { return resumed_handshakes_; }
+
+private:
+    TlsSessionCache();
+
+    std::mutex mutex_;
+    std::map<std::string, std::vector<uint8_t>> sessions_;
+    Histogram full_handshakes_;
+    Histogram resumed_handshakes_;
+};
+
+#endif // TLS_SESSION_CACHE_H
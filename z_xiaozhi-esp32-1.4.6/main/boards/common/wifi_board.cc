@@ -5,6 +5,7 @@
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
+#include "resumable_tls_transport.h"
 #include "assets/lang_config.h"
 
 #include <freertos/FreeRTOS.h>
@@ -117,7 +118,11 @@ WebSocket* WifiBoard::CreateWebSocket() {
 #ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
     std::string url = CONFIG_WEBSOCKET_URL;
     if (url.find("wss://") == 0) {
+#if CONFIG_TLS_SESSION_CACHE
+        return new WebSocket(new ResumableTlsTransport());
+#else
         return new WebSocket(new TlsTransport());
+#endif
     } else {
         return new WebSocket(new TcpTransport());
     }
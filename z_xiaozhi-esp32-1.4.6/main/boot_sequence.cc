@@ -0,0 +1,101 @@
+#include "boot_sequence.h"
+#include "stack_monitor.h"
+#include "memory_tracker.h"
+
+#include <cstring>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "Boot"
+
+void BootSequence::AddStage(const char* name, std::function<void()> run,
+    std::initializer_list<const char*> after, bool concurrent) {
+    if (stage_count_ >= kMaxStages) {
+        ESP_LOGE(TAG, "Too many boot stages, %s runs right away", name);
+        run();
+        return;
+    }
+    auto& stage = stages_[stage_count_];
+    stage = {};
+    stage.name = name;
+    stage.run = std::move(run);
+    stage.concurrent = concurrent;
+    for (auto dependency : after) {
+        int index = 0;
+        while (index < stage_count_ && strcmp(stages_[index].name, dependency) != 0) {
+            index++;
+        }
+        if (index == stage_count_) {
+            ESP_LOGE(TAG, "Stage %s depends on unknown stage %s", name, dependency);
+            continue;
+        }
+        stage.after |= 1u << index;
+    }
+    stage_count_++;
+}
+
+void BootSequence::RunStage(Stage& stage) {
+    stage.queued_time = esp_timer_get_time();
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_variable_.wait(lock, [this, &stage]() {
+            return (done_ & stage.after) == stage.after;
+        });
+    }
+    stage.start_time = esp_timer_get_time();
+    stage.run();
+    stage.end_time = esp_timer_get_time();
+    if (stage.concurrent) {
+        MemoryTracker::GetInstance().EndConcurrent();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ |= 1u << (&stage - stages_);
+    condition_variable_.notify_all();
+}
+
+void BootSequence::Run() {
+    for (int i = 0; i < stage_count_; i++) {
+        auto& stage = stages_[i];
+        if (!stage.concurrent) {
+            RunStage(stage);
+            continue;
+        }
+        // Same priority as the boot task: the two share the CPU while both
+        // are busy, and stages like joining the network mostly wait anyway
+        stage.sequence = this;
+        MemoryTracker::GetInstance().BeginConcurrent();
+        auto result = xTaskCreate([](void* arg) {
+            auto stage = (Stage*)arg;
+            stage->sequence->RunStage(*stage);
+            StackMonitor::GetInstance().RecordCurrentTask();
+            vTaskDelete(NULL);
+        }, "boot_stage", CONFIG_BOOT_STAGE_STACK_SIZE, &stage, uxTaskPriorityGet(nullptr), nullptr);
+        if (result != pdPASS) {
+            ESP_LOGW(TAG, "No task for stage %s, running it in sequence", stage.name);
+            MemoryTracker::GetInstance().EndConcurrent();
+            stage.concurrent = false;
+            RunStage(stage);
+        }
+    }
+
+    uint32_t all = (1u << stage_count_) - 1;
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this, all]() {
+        return done_ == all;
+    });
+    lock.unlock();
+    Log();
+}
+
+void BootSequence::Log() {
+    for (int i = 0; i < stage_count_; i++) {
+        auto& stage = stages_[i];
+        ESP_LOGI(TAG, "%-10s %6lld ms +%5lld ms, waited %lld ms%s", stage.name,
+            stage.start_time / 1000, (stage.end_time - stage.start_time) / 1000,
+            (stage.start_time - stage.queued_time) / 1000, stage.concurrent ? ", concurrent" : "");
+    }
+    ESP_LOGI(TAG, "Done %lld ms after power on", esp_timer_get_time() / 1000);
+}
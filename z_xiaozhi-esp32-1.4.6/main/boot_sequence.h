@@ -0,0 +1,50 @@
+#ifndef BOOT_SEQUENCE_H
+#define BOOT_SEQUENCE_H
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+
+// Boot as a small dependency graph. Stages run in the order they are added,
+// each once the stages named in its `after` list are done. A concurrent stage
+// gets a task of its own and runs alongside the stages added after it.
+// Run() returns when every stage is done and logs when each started, how
+// long it took and how long it waited for its dependencies.
+class BootSequence {
+public:
+    BootSequence() = default;
+    BootSequence(const BootSequence&) = delete;
+    BootSequence& operator=(const BootSequence&) = delete;
+
+    // `after` may only name stages added before
+    void AddStage(const char* name, std::function<void()> run,
+        std::initializer_list<const char*> after = {}, bool concurrent = false);
+    void Run();
+
+private:
+    static constexpr int kMaxStages = 16;
+
+    struct Stage {
+        const char* name;
+        std::function<void()> run;
+        uint32_t after;         // bit per stage index
+        bool concurrent;
+        BootSequence* sequence; // for the stage's own task
+        int64_t queued_time;    // esp_timer time the stage was reached
+        int64_t start_time;     // its dependencies were done
+        int64_t end_time;
+    };
+
+    void RunStage(Stage& stage);
+    void Log();
+
+    Stage stages_[kMaxStages];
+    int stage_count_ = 0;
+    uint32_t done_ = 0;
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+};
+
+#endif // BOOT_SEQUENCE_H
@@ -0,0 +1,230 @@
+#include "cpu_monitor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "CpuMonitor"
+
+static const char* const TASK_STATE_STRINGS[] = {
+    "running",
+    "ready",
+    "blocked",
+    "suspended",
+    "deleted",
+    "invalid",
+};
+
+// 0.1% units as a JSON number
+static void AppendLoad(std::string& json, int load) {
+    char buffer[16];
+    if (load < 0) {
+        snprintf(buffer, sizeof(buffer), "null");
+    } else {
+        snprintf(buffer, sizeof(buffer), "%d.%d", load / 10, load % 10);
+    }
+    json += buffer;
+}
+
+CpuMonitor::CpuMonitor() {
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        core_load_[core] = -1;
+        core_average_load_[core] = -1;
+    }
+}
+
+void CpuMonitor::Start() {
+    if (task_handle_ != nullptr) {
+        return;
+    }
+    // Lowest priority above idle: sampling never delays real work, and a
+    // growing age_ms is itself the sign that there is no headroom left
+    xTaskCreate([](void* arg) {
+        auto monitor = (CpuMonitor*)arg;
+        while (true) {
+            monitor->Sample();
+            vTaskDelay(pdMS_TO_TICKS(CONFIG_CPU_MONITOR_INTERVAL_MS));
+        }
+    }, "cpu_monitor", CONFIG_CPU_MONITOR_STACK_SIZE, this, 1, &task_handle_);
+}
+
+void CpuMonitor::Sample() {
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    int count = uxTaskGetSystemState(status_, CONFIG_CPU_MONITOR_MAX_TASKS, &total_run_time);
+    if (count == 0) {
+        if (!too_many_tasks_) {
+            ESP_LOGW(TAG, "More than %d tasks, increase CONFIG_CPU_MONITOR_MAX_TASKS", CONFIG_CPU_MONITOR_MAX_TASKS);
+            too_many_tasks_ = true;
+        }
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    uint32_t elapsed = (uint32_t)total_run_time - last_total_run_time_;
+    bool first = last_sample_time_ == 0;
+
+    TaskHandle_t idle_tasks[CONFIG_FREERTOS_NUMBER_OF_CORES];
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        idle_tasks[core] = xTaskGetIdleTaskHandleForCore(core);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto previous = tasks_[current_];
+    auto next = tasks_[current_ ^ 1];
+    for (int i = 0; i < count; i++) {
+        auto& status = status_[i];
+        auto& task = next[i];
+        task.handle = status.xHandle;
+        strncpy(task.name, status.pcTaskName, sizeof(task.name) - 1);
+        task.name[sizeof(task.name) - 1] = '\0';
+        task.run_time = status.ulRunTimeCounter;
+        task.priority = status.uxCurrentPriority;
+        task.state = status.eCurrentState;
+        task.stack_free = status.usStackHighWaterMark;
+        task.load = -1;
+        task.average_load = -1;
+
+        // Tasks created during the window only get a load from the next one
+        for (int j = 0; j < task_count_ && !first && elapsed > 0; j++) {
+            if (previous[j].handle == task.handle) {
+                uint32_t delta = task.run_time - previous[j].run_time;
+                task.load = std::min<uint64_t>((uint64_t)delta * 1000 / elapsed, 1000);
+                task.average_load = previous[j].average_load < 0 ? task.load
+                    : previous[j].average_load + (task.load - previous[j].average_load) / 8;
+                break;
+            }
+        }
+
+        for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+            if (task.handle == idle_tasks[core] && task.load >= 0) {
+                core_load_[core] = 1000 - task.load;
+                core_average_load_[core] = core_average_load_[core] < 0 ? core_load_[core]
+                    : core_average_load_[core] + (core_load_[core] - core_average_load_[core]) / 8;
+            }
+        }
+    }
+    current_ ^= 1;
+    task_count_ = count;
+    if (!first) {
+        window_ms_ = (now - last_sample_time_) / 1000;
+    }
+    last_sample_time_ = now;
+    last_total_run_time_ = total_run_time;
+}
+
+int CpuMonitor::core_load(int core) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return core_load_[core];
+}
+
+int CpuMonitor::core_average_load(int core) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return core_average_load_[core];
+}
+
+int CpuMonitor::min_stack_free() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int min_free = -1;
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[current_][i];
+        if (min_free < 0 || (int)task.stack_free < min_free) {
+            min_free = task.stack_free;
+        }
+    }
+    return min_free;
+}
+
+std::string CpuMonitor::GetJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json = "{\"window_ms\":" + std::to_string(window_ms_);
+    json += ",\"age_ms\":" + std::to_string(last_sample_time_ ? (esp_timer_get_time() - last_sample_time_) / 1000 : -1);
+    json += ",\"cores\":[";
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        json += core ? ",{\"load\":" : "{\"load\":";
+        AppendLoad(json, core_load_[core]);
+        json += ",\"avg\":";
+        AppendLoad(json, core_average_load_[core]);
+        json += "}";
+    }
+    json += "],\"tasks\":[";
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[current_][i];
+        json += i ? ",{\"name\":\"" : "{\"name\":\"";
+        json += task.name;
+        json += "\",\"priority\":" + std::to_string(task.priority);
+        json += ",\"state\":\"" + std::string(TASK_STATE_STRINGS[task.state]) + "\"";
+        json += ",\"load\":";
+        AppendLoad(json, task.load);
+        json += ",\"avg\":";
+        AppendLoad(json, task.average_load);
+        json += ",\"stack_free\":" + std::to_string(task.stack_free) + "}";
+    }
+    json += "]}";
+    return json;
+}
+
+void CpuMonitor::Log(const char* tag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    char line[160];
+    int length = snprintf(line, sizeof(line), "CPU");
+    if (core_load_[0] < 0) {
+        ESP_LOGI(tag, "CPU: no full sample window yet");
+        return;
+    }
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        length += snprintf(line + length, sizeof(line) - length, " %d.%d%%",
+            core_load_[core] / 10, core_load_[core] % 10);
+    }
+
+    // Three busiest tasks that are not idle tasks
+    int top[3] = {-1, -1, -1};
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[current_][i];
+        if (task.priority == 0 || task.load <= 0) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (top[k] < 0 || task.load > tasks_[current_][top[k]].load) {
+                for (int m = 2; m > k; m--) {
+                    top[m] = top[m - 1];
+                }
+                top[k] = i;
+                break;
+            }
+        }
+    }
+    for (int k = 0; k < 3 && top[k] >= 0 && length < (int)sizeof(line); k++) {
+        auto& task = tasks_[current_][top[k]];
+        length += snprintf(line + length, sizeof(line) - length, "%s %s %d.%d%%",
+            k ? "," : " |", task.name, task.load / 10, task.load % 10);
+    }
+    ESP_LOGI(tag, "%s", line);
+}
+
+void CpuMonitor::Print() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (core_load_[0] < 0) {
+        printf("No full sample window yet\n");
+        return;
+    }
+    printf("Window %d ms\n", window_ms_);
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        printf("Core %d: %d.%d%% (avg %d.%d%%)\n", core,
+            core_load_[core] / 10, core_load_[core] % 10,
+            core_average_load_[core] / 10, core_average_load_[core] % 10);
+    }
+    printf("| %-16s | Pri | State     |   Load |    Avg | Stack free\n", "Task");
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[current_][i];
+        if (task.load < 0) {
+            // Created during the last window
+            printf("| %-16s | %3d | %-9s |    new |    new | %lu\n", task.name, task.priority,
+                TASK_STATE_STRINGS[task.state], task.stack_free);
+            continue;
+        }
+        printf("| %-16s | %3d | %-9s | %3d.%d%% | %3d.%d%% | %lu\n", task.name, task.priority,
+            TASK_STATE_STRINGS[task.state], task.load / 10, task.load % 10,
+            task.average_load / 10, task.average_load % 10, task.stack_free);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef CPU_MONITOR_H
+#define CPU_MONITOR_H
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Background sampler of the FreeRTOS run time stats. Every interval it takes
+// one uxTaskGetSystemState() snapshot into fixed storage and keeps per task
+// and per core utilisation (last window and a rolling average) and stack
+// high-water marks. Nothing is allocated after Start() and readers never wait
+// for a sample window.
+class CpuMonitor {
+public:
+    static CpuMonitor& GetInstance() {
+        static CpuMonitor instance;
+        return instance;
+    }
+    CpuMonitor(const CpuMonitor&) = delete;
+    CpuMonitor& operator=(const CpuMonitor&) = delete;
+
+    void Start();
+
+    // Loads are in 0.1% of one core, -1 before the first full window
+    int core_load(int core);
+    int core_average_load(int core);
+    // Smallest stack high-water mark of all tasks, in bytes
+    int min_stack_free();
+
+    // {"window_ms":..,"age_ms":..,"cores":[{"load":..,"avg":..}],"tasks":[{"name":..,"priority":..,"state":..,"load":..,"avg":..,"stack_free":..}]}
+    std::string GetJson();
+    // Core loads and the busiest tasks in one line
+    void Log(const char* tag);
+    // Table of all tasks, for the console
+    void Print();
+
+private:
+    struct TaskLoad {
+        TaskHandle_t handle;
+        char name[configMAX_TASK_NAME_LEN];
+        uint32_t run_time;
+        uint8_t priority;
+        uint8_t state;
+        int16_t load;
+        int16_t average_load;
+        uint32_t stack_free;
+    };
+
+    CpuMonitor();
+    void Sample();
+
+    std::mutex mutex_;
+    TaskHandle_t task_handle_ = nullptr;
+    // Scratch for the sampler task only
+    TaskStatus_t status_[CONFIG_CPU_MONITOR_MAX_TASKS];
+    // Double buffered so the previous window's counters are at hand while
+    // the next one is built
+    TaskLoad tasks_[2][CONFIG_CPU_MONITOR_MAX_TASKS];
+    int current_ = 0;
+    int task_count_ = 0;
+    int16_t core_load_[CONFIG_FREERTOS_NUMBER_OF_CORES];
+    int16_t core_average_load_[CONFIG_FREERTOS_NUMBER_OF_CORES];
+    uint32_t last_total_run_time_ = 0;
+    int64_t last_sample_time_ = 0;
+    int window_ms_ = 0;
+    bool too_many_tasks_ = false;
+};
+
+#endif // CPU_MONITOR_H
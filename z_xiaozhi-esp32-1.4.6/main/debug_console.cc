@@ -0,0 +1,66 @@
+#include "debug_console.h"
+
+#include <esp_log.h>
+#include <esp_console.h>
+
+#define TAG "DebugConsole"
+
+void DebugConsole::Start() {
+    if (started_) {
+        return;
+    }
+
+    esp_console_repl_t* repl = nullptr;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "xiaozhi>";
+    esp_err_t err;
+#if defined(CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG)
+    esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+    err = esp_console_new_repl_usb_serial_jtag(&hw_config, &repl_config, &repl);
+#else
+    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    err = esp_console_new_repl_uart(&hw_config, &repl_config, &repl);
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the console: %s", esp_err_to_name(err));
+        return;
+    }
+    esp_console_register_help_command();
+    for (auto& [name, command] : commands_) {
+        Register(name, command);
+    }
+    esp_console_start_repl(repl);
+    started_ = true;
+}
+
+void DebugConsole::RegisterCommand(const char* name, const char* help, std::function<int(int argc, char** argv)> handler) {
+    // Registering a name again only replaces its handler
+    auto [it, inserted] = commands_.try_emplace(name, Command{help, handler});
+    if (!inserted) {
+        it->second.handler = handler;
+    } else if (started_) {
+        Register(it->first, it->second);
+    }
+}
+
+void DebugConsole::Register(const std::string& name, const Command& command) {
+    // The console takes plain function pointers, so every command goes
+    // through Dispatch, which looks the handler up by name
+    esp_console_cmd_t cmd = {};
+    cmd.command = name.c_str();
+    cmd.help = command.help.c_str();
+    cmd.func = &DebugConsole::Dispatch;
+    esp_err_t err = esp_console_cmd_register(&cmd);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register command %s: %s", name.c_str(), esp_err_to_name(err));
+    }
+}
+
+int DebugConsole::Dispatch(int argc, char** argv) {
+    auto& commands = GetInstance().commands_;
+    auto it = commands.find(argv[0]);
+    if (it == commands.end()) {
+        return 1;
+    }
+    return it->second.handler(argc, argv);
+}
@@ -0,0 +1,39 @@
+#ifndef DEBUG_CONSOLE_H
+#define DEBUG_CONSOLE_H
+
+#include <map>
+#include <string>
+#include <functional>
+
+// Serial REPL for runtime diagnostics (CONFIG_DEBUG_CONSOLE).
+// Modules register their own commands, before or after Start();
+// handlers run on the console task.
+class DebugConsole {
+public:
+    static DebugConsole& GetInstance() {
+        static DebugConsole instance;
+        return instance;
+    }
+    DebugConsole(const DebugConsole&) = delete;
+    DebugConsole& operator=(const DebugConsole&) = delete;
+
+    void Start();
+    void RegisterCommand(const char* name, const char* help, std::function<int(int argc, char** argv)> handler);
+
+private:
+    DebugConsole() = default;
+
+    struct Command {
+        std::string help;
+        std::function<int(int argc, char** argv)> handler;
+    };
+
+    bool started_ = false;
+    // Map nodes are stable, the console keeps pointers to the names and help texts
+    std::map<std::string, Command> commands_;
+
+    void Register(const std::string& name, const Command& command);
+    static int Dispatch(int argc, char** argv);
+};
+
+#endif // DEBUG_CONSOLE_H
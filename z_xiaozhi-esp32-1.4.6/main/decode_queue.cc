@@ -0,0 +1,212 @@
+#include "decode_queue.h"
+
+#include <cstdio>
+#include <cinttypes>
+#include <esp_log.h>
+
+DecodeQueue::DecodeQueue(int default_frame_duration_ms)
+    : default_frame_duration_us_(default_frame_duration_ms * 1000) {
+}
+
+void DecodeQueue::OnFlowControl(std::function<void(bool pause)> callback) {
+    on_flow_control_ = callback;
+}
+
+void DecodeQueue::EnableFlowControl(bool enable) {
+    flow_control_ = enable;
+}
+
+// Duration from the TOC byte and frame count (RFC 6716, section 3.1), so that
+// the limit holds whatever frame duration the server encodes with
+int DecodeQueue::PacketDuration(const OpusPacket& opus) const {
+    if (opus.empty()) {
+        return default_frame_duration_us_;
+    }
+    static const int kSilkFrameUs[] = { 10000, 20000, 40000, 60000 };
+    static const int kHybridFrameUs[] = { 10000, 20000 };
+    static const int kCeltFrameUs[] = { 2500, 5000, 10000, 20000 };
+    int config = opus[0] >> 3;
+    int frame_us;
+    if (config < 12) {
+        frame_us = kSilkFrameUs[config % 4];
+    } else if (config < 16) {
+        frame_us = kHybridFrameUs[config % 2];
+    } else {
+        frame_us = kCeltFrameUs[config % 4];
+    }
+    int frames;
+    switch (opus[0] & 0x03) {
+    case 0:
+        frames = 1;
+        break;
+    case 3:
+        if (opus.size() < 2) {
+            return default_frame_duration_us_;
+        }
+        frames = opus[1] & 0x3F;
+        break;
+    default:
+        frames = 2;
+        break;
+    }
+    return frame_us * frames;
+}
+
+size_t DecodeQueue::PacketSize(const DecodePacket& packet) const {
+#if CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM
+    if (!packet.spilled.empty()) {
+        return packet.spilled.size() + kPacketOverhead;
+    }
+#endif
+    return packet.opus.size() + kPacketOverhead;
+}
+
+bool DecodeQueue::InInternalRam(const DecodePacket& packet) const {
+#if CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM
+    if (!packet.spilled.empty()) {
+        return MemoryTracker::RegionOf(packet.spilled.data()) == kMemoryRegionInternal;
+    }
+#endif
+    return MemoryTracker::RegionOf(packet.opus.data()) == kMemoryRegionInternal;
+}
+
+bool DecodeQueue::Push(OpusPacket&& opus, int64_t arrival_time) {
+    int duration = PacketDuration(opus);
+    if (dropping_ || duration_us_ + duration > kMaxDurationUs) {
+        dropping_ = true;
+        dropped_++;
+        return false;
+    }
+
+    DecodePacket packet;
+    packet.opus = std::move(opus);
+    packet.arrival_time = arrival_time;
+    packet.duration_us = duration;
+    bool internal = InInternalRam(packet);
+    if (internal && internal_bytes_ + PacketSize(packet) > kMaxInternalBytes) {
+#if CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM
+        packet.spilled.assign(packet.opus.begin(), packet.opus.end());
+        OpusPacket().swap(packet.opus);
+        spilled_++;
+        // The copy lands in internal RAM too once PSRAM is full
+        internal = InInternalRam(packet);
+        if (internal) {
+            dropping_ = true;
+            dropped_++;
+            return false;
+        }
+#else
+        dropping_ = true;
+        dropped_++;
+        return false;
+#endif
+    }
+
+    size_t size = PacketSize(packet);
+    packets_.emplace_back(std::move(packet));
+    duration_us_ += duration;
+    bytes_ += size;
+    if (internal) {
+        internal_bytes_ += size;
+    }
+    if (duration_us_ > peak_duration_us_) {
+        peak_duration_us_ = duration_us_;
+    }
+    if (bytes_ > peak_bytes_) {
+        peak_bytes_ = bytes_;
+    }
+    if (internal_bytes_ > peak_internal_bytes_) {
+        peak_internal_bytes_ = internal_bytes_;
+    }
+    UpdateFlowControl();
+    return true;
+}
+
+bool DecodeQueue::Pop(DecodePacket& packet) {
+    if (packets_.empty()) {
+        return false;
+    }
+    auto& front = packets_.front();
+    size_t size = PacketSize(front);
+    duration_us_ -= front.duration_us;
+    bytes_ -= size;
+    if (InInternalRam(front)) {
+        internal_bytes_ -= size;
+    }
+    packet = std::move(front);
+    packets_.pop_front();
+    if (packets_.empty()) {
+        dropping_ = false;
+    }
+#if CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM
+    if (!packet.spilled.empty()) {
+        packet.opus.assign(packet.spilled.begin(), packet.spilled.end());
+        packet.spilled.clear();
+        packet.spilled.shrink_to_fit();
+    }
+#endif
+    UpdateFlowControl();
+    return true;
+}
+
+void DecodeQueue::Clear() {
+    packets_.clear();
+    duration_us_ = 0;
+    bytes_ = 0;
+    internal_bytes_ = 0;
+    dropping_ = false;
+    // Whatever the server was holding back is not wanted any more either
+    if (paused_) {
+        paused_ = false;
+        if (on_flow_control_) {
+            on_flow_control_(false);
+        }
+    }
+}
+
+void DecodeQueue::UpdateFlowControl() {
+#if CONFIG_DECODE_QUEUE_PAUSE_SERVER
+    if (!flow_control_) {
+        return;
+    }
+    // Pause at three quarters of either limit, resume at a quarter of both,
+    // the margin covers what is in flight when the server gets the message
+    bool pause = duration_us_ > kMaxDurationUs / 4 * 3 || internal_bytes_ > kMaxInternalBytes / 4 * 3;
+    bool resume = duration_us_ < kMaxDurationUs / 4 && internal_bytes_ < kMaxInternalBytes / 4;
+    if (!paused_ && pause) {
+        paused_ = true;
+        pauses_++;
+    } else if (paused_ && resume) {
+        paused_ = false;
+    } else {
+        return;
+    }
+    if (on_flow_control_) {
+        on_flow_control_(paused_);
+    }
+#endif
+}
+
+void DecodeQueue::ResetStats() {
+    peak_duration_us_ = duration_us_;
+    peak_bytes_ = bytes_;
+    peak_internal_bytes_ = internal_bytes_;
+    dropped_ = 0;
+    pauses_ = 0;
+    spilled_ = 0;
+}
+
+std::string DecodeQueue::GetJson() const {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "{\"duration_ms\":%d,\"bytes\":%u,\"internal_bytes\":%u,\"peak_duration_ms\":%d,\"peak_bytes\":%u,"
+        "\"peak_internal_bytes\":%u,\"dropped\":%" PRIu32 ",\"pauses\":%" PRIu32 ",\"spilled\":%" PRIu32 "}",
+        duration_us_ / 1000, bytes_, internal_bytes_, peak_duration_us_ / 1000, peak_bytes_,
+        peak_internal_bytes_, dropped_, pauses_, spilled_);
+    return buffer;
+}
+
+void DecodeQueue::Log(const char* tag) const {
+    ESP_LOGI(tag, "Decode queue peak %d ms, %u bytes (%u internal), %" PRIu32 " dropped, %" PRIu32 " pauses, %" PRIu32 " spilled",
+        peak_duration_us_ / 1000, peak_bytes_, peak_internal_bytes_, dropped_, pauses_, spilled_);
+}
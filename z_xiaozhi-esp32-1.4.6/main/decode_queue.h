@@ -0,0 +1,91 @@
+#ifndef DECODE_QUEUE_H
+#define DECODE_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include <sdkconfig.h>
+
+#include "memory_tracker.h"
+#include "packet_pool.h"
+
+// Downlink Opus packet waiting to be decoded
+struct DecodePacket {
+    OpusPacket opus;
+    int64_t arrival_time;
+    int duration_us;
+#if CONFIG_DECODE_QUEUE_SPILL_TO_PSRAM
+    // Takes the payload instead of opus while the queue is over its internal RAM limit
+    std::vector<uint8_t, TaggedAllocator<uint8_t, kMemoryTagAudio, kMemoryPlacementPsram>> spilled;
+#endif
+};
+
+// The server sends replies faster than real time, so this queue can hold a
+// whole reply. It is bounded by the queued audio duration and by the bytes it
+// keeps in internal RAM (CONFIG_DECODE_QUEUE_MAX_DURATION and
+// CONFIG_DECODE_QUEUE_MAX_INTERNAL_SIZE); on the way to a limit it either asks
+// the server to pause or spills to PSRAM, and at the limit it drops the
+// newest packets, which truncates a reply but never runs the heap dry. Once
+// it dropped one it drops the rest until it has drained or is cleared for the
+// next reply, so what plays is the start of the reply, not every other frame.
+// Not thread safe, the owner locks around it.
+class DecodeQueue {
+public:
+    explicit DecodeQueue(int default_frame_duration_ms);
+
+    // Called with true when the server should pause sending audio, with false
+    // when it may resume. Runs inside Push(), Pop() or Clear().
+    void OnFlowControl(std::function<void(bool pause)> callback);
+    // Only servers that echo flow_control in their hello understand flow
+    // messages, without it a full queue truncates the reply
+    void EnableFlowControl(bool enable);
+
+    // Returns false if the packet was dropped
+    bool Push(OpusPacket&& opus, int64_t arrival_time);
+    bool Pop(DecodePacket& packet);
+    void Clear();
+
+    inline bool empty() const { return packets_.empty(); }
+    inline int duration_ms() const { return duration_us_ / 1000; }
+    inline size_t size() const { return bytes_; }
+
+    // High-water marks and counters restart from now
+    void ResetStats();
+    // {"duration_ms":..,"bytes":..,"internal_bytes":..,"peak_duration_ms":..,"peak_bytes":..,
+    //  "peak_internal_bytes":..,"dropped":..,"pauses":..,"spilled":..}
+    std::string GetJson() const;
+    void Log(const char* tag) const;
+
+private:
+    static constexpr int kMaxDurationUs = CONFIG_DECODE_QUEUE_MAX_DURATION * 1000;
+    static constexpr size_t kMaxInternalBytes = CONFIG_DECODE_QUEUE_MAX_INTERNAL_SIZE * 1024;
+    // Rough cost of a list node on top of the payload
+    static constexpr size_t kPacketOverhead = sizeof(DecodePacket) + 2 * sizeof(void*);
+
+    int PacketDuration(const OpusPacket& opus) const;
+    size_t PacketSize(const DecodePacket& packet) const;
+    bool InInternalRam(const DecodePacket& packet) const;
+    void UpdateFlowControl();
+
+    int default_frame_duration_us_;
+    std::list<DecodePacket, BulkAllocator<DecodePacket, kMemoryTagAudio>> packets_;
+    std::function<void(bool pause)> on_flow_control_;
+    bool flow_control_ = false;
+    bool paused_ = false;
+    bool dropping_ = false;
+
+    int duration_us_ = 0;
+    size_t bytes_ = 0;
+    size_t internal_bytes_ = 0;
+    int peak_duration_us_ = 0;
+    size_t peak_bytes_ = 0;
+    size_t peak_internal_bytes_ = 0;
+    uint32_t dropped_ = 0;
+    uint32_t pauses_ = 0;
+    uint32_t spilled_ = 0;
+};
+
+#endif // DECODE_QUEUE_H
@@ -8,6 +8,8 @@
 
 #include <string>
 
+#include "event_trace.h"
+
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
     const lv_font_t* icon_font = nullptr;
@@ -63,12 +65,16 @@ protected:
 class DisplayLockGuard {
 public:
     DisplayLockGuard(Display *display) : display_(display) {
+        TRACE_BEGIN("display_lock_wait");
         if (!display_->Lock(3000)) {
             ESP_LOGE("Display", "Failed to lock display");
         }
+        TRACE_END("display_lock_wait");
+        TRACE_BEGIN("display_locked");
     }
     ~DisplayLockGuard() {
         display_->Unlock();
+        TRACE_END("display_locked");
     }
 
 private:
@@ -8,6 +8,7 @@
 #include "assets/lang_config.h"
 
 #include "board.h"
+#include "memory_tracker.h"
 
 #define TAG "LcdDisplay"
 
@@ -17,6 +18,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
                            DisplayFonts fonts)
     : LcdDisplay(panel_io, panel, fonts) {
+    MemoryTagScope memory_scope(kMemoryTagDisplay);
     width_ = width;
     height_ = height;
 
@@ -84,6 +86,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
                            bool mirror_x, bool mirror_y, bool swap_xy,
                            DisplayFonts fonts)
     : LcdDisplay(panel_io, panel, fonts) {
+    MemoryTagScope memory_scope(kMemoryTagDisplay);
     width_ = width;
     height_ = height;
     
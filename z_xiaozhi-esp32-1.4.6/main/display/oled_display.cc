@@ -1,6 +1,7 @@
 #include "oled_display.h"
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
+#include "memory_tracker.h"
 
 #include <string>
 #include <algorithm>
@@ -16,6 +17,7 @@ LV_FONT_DECLARE(font_awesome_30_1);
 OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
     int width, int height, bool mirror_x, bool mirror_y, DisplayFonts fonts)
     : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
+    MemoryTagScope memory_scope(kMemoryTagDisplay);
     width_ = width;
     height_ = height;
 
@@ -0,0 +1,85 @@
+#include "event_trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/task.h>
+
+#define TAG "EventTrace"
+
+void EventTrace::Start() {
+    enabled_ = false;
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        if (rings_[core] == nullptr) {
+            size_t size = sizeof(TraceEvent) * CONFIG_EVENT_TRACE_EVENTS;
+            rings_[core] = (TraceEvent*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+            if (rings_[core] == nullptr) {
+                rings_[core] = (TraceEvent*)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+            }
+            if (rings_[core] == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate the trace ring for core %d", core);
+                return;
+            }
+        }
+        heads_[core] = 0;
+    }
+    enabled_ = true;
+    ESP_LOGI(TAG, "Tracing started, %d events per core", CONFIG_EVENT_TRACE_EVENTS);
+}
+
+void EventTrace::Stop() {
+    enabled_ = false;
+}
+
+void EventTrace::Add(TraceEventType type, const char* name, int32_t value) {
+    if (!enabled()) {
+        return;
+    }
+    int core = xPortGetCoreID();
+    uint32_t index = heads_[core].fetch_add(1, std::memory_order_relaxed);
+    auto& event = rings_[core][index % CONFIG_EVENT_TRACE_EVENTS];
+    event.time_us = esp_timer_get_time();
+    event.name = name;
+    event.task = xTaskGetCurrentTaskHandle();
+    event.value = value;
+    event.type = type;
+    event.core = core;
+}
+
+void EventTrace::Dump() {
+    bool was_enabled = enabled_.exchange(false);
+    if (rings_[0] == nullptr) {
+        printf("Tracing was never started\n");
+        return;
+    }
+    // Let tasks that were in the middle of Add() finish their slot
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    printf("-----BEGIN XIAOZHI TRACE-----\n");
+    // The converter unwraps the 32 bit event times backwards from here
+    printf("now %lld\n", esp_timer_get_time());
+
+    // Task names, for the tasks that still exist
+    std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks() + 4);
+    tasks.resize(uxTaskGetSystemState(tasks.data(), tasks.size(), nullptr));
+    for (auto& task : tasks) {
+        printf("task %p %s\n", task.xHandle, task.pcTaskName);
+    }
+
+    for (int core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) {
+        uint32_t head = heads_[core];
+        uint32_t count = head < CONFIG_EVENT_TRACE_EVENTS ? head : CONFIG_EVENT_TRACE_EVENTS;
+        for (uint32_t i = head - count; i != head; i++) {
+            auto& event = rings_[core][i % CONFIG_EVENT_TRACE_EVENTS];
+            printf("event %d %lu %c %p %ld %s\n", core, event.time_us, event.type, event.task, event.value, event.name);
+        }
+    }
+    printf("-----END XIAOZHI TRACE-----\n");
+
+    if (was_enabled) {
+        enabled_ = true;
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <cstdint>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+
+// Chrome trace_event phases
+enum TraceEventType {
+    kTraceBegin = 'B',
+    kTraceEnd = 'E',
+    kTraceInstant = 'i',
+    kTraceCounter = 'C',
+};
+
+struct TraceEvent {
+    uint32_t time_us;       // esp_timer time, truncated to 32 bits
+    const char* name;       // must be a string literal (or otherwise never freed)
+    void* task;
+    int32_t value;          // counters only
+    uint8_t type;
+    uint8_t core;
+    uint16_t reserved;
+};
+
+// Ring of compact binary events per core. Adding an event claims a slot with
+// one atomic increment, no lock is taken, so it may be used from any task.
+// Old events are overwritten once a ring is full.
+// Dump() prints the rings as text, scripts/trace_to_chrome.py turns that
+// into a file for chrome://tracing or Perfetto.
+class EventTrace {
+public:
+    static EventTrace& GetInstance() {
+        static EventTrace instance;
+        return instance;
+    }
+    EventTrace(const EventTrace&) = delete;
+    EventTrace& operator=(const EventTrace&) = delete;
+
+    // Clears the rings and starts recording, they are allocated on first use
+    void Start();
+    void Stop();
+    void Dump();
+    inline bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Add(TraceEventType type, const char* name, int32_t value = 0);
+
+private:
+    EventTrace() = default;
+
+    std::atomic<bool> enabled_ = false;
+    TraceEvent* rings_[CONFIG_FREERTOS_NUMBER_OF_CORES] = {};
+    std::atomic<uint32_t> heads_[CONFIG_FREERTOS_NUMBER_OF_CORES] = {};
+};
+
+// Span covering the enclosing scope
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name) {
+        EventTrace::GetInstance().Add(kTraceBegin, name_);
+    }
+    ~TraceScope() {
+        EventTrace::GetInstance().Add(kTraceEnd, name_);
+    }
+
+private:
+    const char* name_;
+};
+
+#if CONFIG_EVENT_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_BEGIN(name) EventTrace::GetInstance().Add(kTraceBegin, name)
+#define TRACE_END(name) EventTrace::GetInstance().Add(kTraceEnd, name)
+#define TRACE_INSTANT(name) EventTrace::GetInstance().Add(kTraceInstant, name)
+#define TRACE_COUNTER(name, value) EventTrace::GetInstance().Add(kTraceCounter, name, value)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_INSTANT(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do {} while (0)
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif // EVENT_TRACE_H
@@ -0,0 +1,106 @@
+#include "histogram.h"
+
+#include <esp_log.h>
+#include <cinttypes>
+#include <cstdio>
+
+// Bucket upper bounds in microseconds, the last bucket is open ended
+const int32_t Histogram::kBucketLimits[kBucketCount] = {
+    50, 75, 100, 150, 200, 300, 500, 750,
+    1000, 1500, 2000, 3000, 5000, 7500,
+    10000, 15000, 20000, 30000, 50000, 75000,
+    100000, 150000, 200000, 300000, 500000, 750000,
+    1000000, 1500000, 2000000, 3000000, 5000000, 7500000,
+    10000000, INT32_MAX
+};
+
+// Short enough to read in a log line: "850us", "12.5ms", "1.25s"
+static void FormatDuration(char* buffer, size_t size, int64_t value_us) {
+    if (value_us < 1000) {
+        snprintf(buffer, size, "%" PRId64 "us", value_us);
+    } else if (value_us < 1000000) {
+        snprintf(buffer, size, "%" PRId64 ".%" PRId64 "ms", value_us / 1000, value_us % 1000 / 100);
+    } else {
+        snprintf(buffer, size, "%" PRId64 ".%02" PRId64 "s", value_us / 1000000, value_us % 1000000 / 10000);
+    }
+}
+
+Histogram::Histogram(const char* name) : name_(name) {
+}
+
+void Histogram::Record(int64_t value_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int bucket = 0;
+    while (bucket < kBucketCount - 1 && value_us > kBucketLimits[bucket]) {
+        bucket++;
+    }
+    buckets_[bucket]++;
+    if (count_ == 0 || value_us < min_) {
+        min_ = value_us;
+    }
+    if (count_ == 0 || value_us > max_) {
+        max_ = value_us;
+    }
+    count_++;
+    sum_ += value_us;
+}
+
+void Histogram::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& bucket : buckets_) {
+        bucket = 0;
+    }
+    count_ = 0;
+    sum_ = 0;
+    min_ = 0;
+    max_ = 0;
+}
+
+int64_t Histogram::PercentileLocked(int percent) const {
+    if (count_ == 0) {
+        return -1;
+    }
+    uint64_t target = ((uint64_t)count_ * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; i++) {
+        seen += buckets_[i];
+        if (seen >= target) {
+            // The open ended bucket reports the largest value seen instead
+            return i == kBucketCount - 1 ? max_ : kBucketLimits[i];
+        }
+    }
+    return max_;
+}
+
+int64_t Histogram::Percentile(int percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return PercentileLocked(percent);
+}
+
+std::string Histogram::GetJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    char json[256];
+    snprintf(json, sizeof(json),
+        "{\"name\":\"%s\",\"count\":%" PRIu32 ",\"min_us\":%" PRId64 ",\"max_us\":%" PRId64 ",\"mean_us\":%" PRId64
+        ",\"p50_us\":%" PRId64 ",\"p90_us\":%" PRId64 ",\"p99_us\":%" PRId64 "}",
+        name_, count_, min_, max_, count_ ? sum_ / count_ : 0,
+        PercentileLocked(50), PercentileLocked(90), PercentileLocked(99));
+    return json;
+}
+
+void Histogram::Log(const char* tag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        ESP_LOGI(tag, "%s: no samples", name_);
+        return;
+    }
+    char min[16], mean[16], max[16], p50[16], p90[16], p99[16];
+    FormatDuration(min, sizeof(min), min_);
+    FormatDuration(mean, sizeof(mean), sum_ / count_);
+    FormatDuration(max, sizeof(max), max_);
+    FormatDuration(p50, sizeof(p50), PercentileLocked(50));
+    FormatDuration(p90, sizeof(p90), PercentileLocked(90));
+    FormatDuration(p99, sizeof(p99), PercentileLocked(99));
+    ESP_LOGI(tag, "%s: count %" PRIu32 " min %s mean %s max %s p50 %s p90 %s p99 %s",
+        name_, count_, min, mean, max, p50, p90, p99);
+}
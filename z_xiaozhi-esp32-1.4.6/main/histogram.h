@@ -0,0 +1,43 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+
+// Fixed bucket histogram of durations in microseconds. Buckets are log spaced
+// (1, 1.5, 2, 3, 5, 7.5 per decade) from 50 us to 10 s, so a 200 us encode
+// and a 2 s handshake keep the same relative resolution.
+// Recording is allocation free and may happen from any task.
+class Histogram {
+public:
+    explicit Histogram(const char* name);
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void Record(int64_t value_us);
+    void Reset();
+    // Upper bound of the bucket that holds the given percentile, -1 if empty
+    int64_t Percentile(int percent);
+    // {"name":..,"count":..,"min_us":..,"max_us":..,"mean_us":..,"p50_us":..,"p90_us":..,"p99_us":..}
+    std::string GetJson();
+    void Log(const char* tag);
+
+    inline const char* name() const { return name_; }
+
+private:
+    static constexpr int kBucketCount = 34;
+    static const int32_t kBucketLimits[kBucketCount];
+
+    const char* name_;
+    std::mutex mutex_;
+    uint32_t buckets_[kBucketCount] = {};
+    uint32_t count_ = 0;
+    int64_t sum_ = 0;
+    int64_t min_ = 0;
+    int64_t max_ = 0;
+
+    int64_t PercentileLocked(int percent) const;
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,27 @@
+#include "latency_tracer.h"
+
+#define TAG "LatencyTracer"
+
+void LatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        histogram.Reset();
+    }
+}
+
+std::string LatencyTracer::GetJson() {
+    std::string json = "[";
+    for (auto& histogram : histograms_) {
+        if (json.size() > 1) {
+            json += ",";
+        }
+        json += histogram.GetJson();
+    }
+    json += "]";
+    return json;
+}
+
+void LatencyTracer::Log() {
+    for (auto& histogram : histograms_) {
+        histogram.Log(TAG);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <esp_timer.h>
+#include <string>
+
+#include "histogram.h"
+
+// Stages of the audio pipeline, in the order audio goes through them
+enum LatencyStage {
+    // Uplink
+    kLatencyCapture,        // I2S buffer ready -> read by the main loop
+    kLatencyResample,       // input resampling
+    kLatencyAfe,            // fed to the AFE -> fetched from it
+    kLatencyEncodeWait,     // waiting for the background task
+    kLatencyEncode,
+    // Downlink
+    kLatencyDecodeQueue,    // received -> taken for decoding
+    kLatencyDecodeWait,     // waiting for the background task
+    kLatencyDecode,
+    kLatencyOutputResample,
+    kLatencyOutput,         // handed to the codec (blocks while the I2S buffers are full)
+    kLatencyStageCount
+};
+
+// Per stage histograms of the time audio spends in the pipeline.
+// Recording takes a timer read and a short lock, cheap enough to stay on
+// in production builds.
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    // start_time is an esp_timer_get_time() value taken when the stage began
+    inline void Record(LatencyStage stage, int64_t start_time) {
+        histograms_[stage].Record(esp_timer_get_time() - start_time);
+    }
+    inline Histogram& stage(LatencyStage stage) { return histograms_[stage]; }
+
+    void Reset();
+    // JSON array with one object per stage
+    std::string GetJson();
+    void Log();
+
+private:
+    LatencyTracer() = default;
+
+    Histogram histograms_[kLatencyStageCount] = {
+        Histogram("capture"),
+        Histogram("resample"),
+        Histogram("afe"),
+        Histogram("encode_wait"),
+        Histogram("encode"),
+        Histogram("decode_queue"),
+        Histogram("decode_wait"),
+        Histogram("decode"),
+        Histogram("output_resample"),
+        Histogram("output"),
+    };
+};
+
+#endif // LATENCY_TRACER_H
@@ -7,6 +7,7 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "stack_monitor.h"
 
 #define TAG "main"
 
@@ -27,4 +28,5 @@ extern "C" void app_main(void)
     // Launch the application
     Application::GetInstance().Start();
     // The main thread will exit and release the stack memory
+    StackMonitor::GetInstance().RecordCurrentTask();
 }
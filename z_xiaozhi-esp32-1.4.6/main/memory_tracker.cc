@@ -0,0 +1,150 @@
+#include "memory_tracker.h"
+
+#include <cstdio>
+#include <cinttypes>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+
+static const char* const MEMORY_TAG_NAMES[] = {
+    "audio",
+    "protocol",
+    "display",
+    "afe",
+    "ota",
+    "packet_pool",
+};
+
+static const uint32_t MEMORY_REGION_CAPS[] = {
+    MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_SPIRAM,
+};
+
+MemoryRegion MemoryTracker::RegionOf(const void* ptr) {
+    return esp_ptr_external_ram(ptr) ? kMemoryRegionPsram : kMemoryRegionInternal;
+}
+
+void* MemoryTracker::Allocate(size_t size, MemoryPlacement placement) {
+    void* ptr = nullptr;
+    switch (placement) {
+    case kMemoryPlacementInternal:
+        ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        break;
+    case kMemoryPlacementBulk:
+#if CONFIG_AUDIO_BULK_BUFFERS_IN_PSRAM
+        ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#endif
+        break;
+    case kMemoryPlacementPsram:
+#if CONFIG_SPIRAM
+        ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#endif
+        break;
+    default:
+        break;
+    }
+    // operator new aborts with a proper message if even this fails
+    return ptr != nullptr ? ptr : ::operator new(size);
+}
+
+void MemoryTracker::Free(void* ptr, MemoryPlacement placement) {
+    if (placement == kMemoryPlacementDefault) {
+        ::operator delete(ptr);
+    } else {
+        // Covers the operator new fallback too, it allocates from the same heap
+        heap_caps_free(ptr);
+    }
+}
+
+void MemoryTracker::Add(MemoryTag tag, MemoryRegion region, int32_t size) {
+    int32_t current = current_[tag][region].fetch_add(size, std::memory_order_relaxed) + size;
+    auto& peak = peak_[tag][region];
+    int32_t last_peak = peak.load(std::memory_order_relaxed);
+    while (current > last_peak && !peak.compare_exchange_weak(last_peak, current, std::memory_order_relaxed)) {
+    }
+}
+
+void MemoryTracker::BeginConcurrent() {
+    concurrent_++;
+    concurrent_changes_++;
+}
+
+void MemoryTracker::EndConcurrent() {
+    concurrent_--;
+    concurrent_changes_++;
+}
+
+void MemoryTracker::ResetPeaks() {
+    for (int tag = 0; tag < kMemoryTagCount; tag++) {
+        for (int region = 0; region < kMemoryRegionCount; region++) {
+            peak_[tag][region] = current_[tag][region].load();
+        }
+    }
+}
+
+std::string MemoryTracker::GetJson() {
+    std::string json = "{";
+    for (int tag = 0; tag < kMemoryTagCount; tag++) {
+        char buffer[160];
+        if (unattributed_[tag]) {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":null", tag ? "," : "", MEMORY_TAG_NAMES[tag]);
+            json += buffer;
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer),
+            "%s\"%s\":{\"sram\":{\"current\":%" PRId32 ",\"peak\":%" PRId32 "},\"psram\":{\"current\":%" PRId32 ",\"peak\":%" PRId32 "}}",
+            tag ? "," : "", MEMORY_TAG_NAMES[tag],
+            current_[tag][kMemoryRegionInternal].load(), peak_[tag][kMemoryRegionInternal].load(),
+            current_[tag][kMemoryRegionPsram].load(), peak_[tag][kMemoryRegionPsram].load());
+        json += buffer;
+    }
+    json += "}";
+    return json;
+}
+
+void MemoryTracker::Log(const char* tag) {
+    // One line, in KB: name sram/peak psram/peak
+    char line[256];
+    int length = snprintf(line, sizeof(line), "Tagged memory KB (sram/peak psram/peak):");
+    for (int i = 0; i < kMemoryTagCount && length < (int)sizeof(line); i++) {
+        if (unattributed_[i]) {
+            length += snprintf(line + length, sizeof(line) - length, " %s -", MEMORY_TAG_NAMES[i]);
+            continue;
+        }
+        length += snprintf(line + length, sizeof(line) - length, " %s %" PRId32 "/%" PRId32 " %" PRId32 "/%" PRId32, MEMORY_TAG_NAMES[i],
+            current_[i][kMemoryRegionInternal].load() / 1024, peak_[i][kMemoryRegionInternal].load() / 1024,
+            current_[i][kMemoryRegionPsram].load() / 1024, peak_[i][kMemoryRegionPsram].load() / 1024);
+    }
+    ESP_LOGI(tag, "%s", line);
+}
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag) : tag_(tag),
+    concurrent_changes_(MemoryTracker::GetInstance().concurrent_changes_) {
+    for (int region = 0; region < kMemoryRegionCount; region++) {
+        free_[region] = heap_caps_get_free_size(MEMORY_REGION_CAPS[region]);
+    }
+}
+
+MemoryTagScope::~MemoryTagScope() {
+    Update();
+}
+
+void MemoryTagScope::Update() {
+    auto& tracker = MemoryTracker::GetInstance();
+    if (tracker.concurrent_ > 0 || tracker.concurrent_changes_ != concurrent_changes_) {
+        // Whatever this scope charged before the overlap began is taken back
+        for (int region = 0; region < kMemoryRegionCount; region++) {
+            tracker.Add(tag_, (MemoryRegion)region, -charged_[region]);
+            charged_[region] = 0;
+        }
+        tracker.unattributed_[tag_] = true;
+        return;
+    }
+    for (int region = 0; region < kMemoryRegionCount; region++) {
+        int32_t used = (int32_t)free_[region] - (int32_t)heap_caps_get_free_size(MEMORY_REGION_CAPS[region]);
+        if (used != charged_[region]) {
+            tracker.Add(tag_, (MemoryRegion)region, used - charged_[region]);
+            charged_[region] = used;
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+#include <string>
+
+enum MemoryTag {
+    kMemoryTagAudio,        // decode queue, audio buffers
+    kMemoryTagProtocol,     // send queue, packet payloads
+    kMemoryTagDisplay,      // LVGL and the display driver
+    kMemoryTagAfe,          // AFE instances and their input buffers
+    kMemoryTagOta,
+    kMemoryTagPacketPool,   // slabs of network and Opus packets
+    kMemoryTagCount
+};
+
+enum MemoryRegion {
+    kMemoryRegionInternal,
+    kMemoryRegionPsram,
+    kMemoryRegionCount
+};
+
+// Where a buffer should live. Internal RAM is the scarce one on most boards.
+enum MemoryPlacement {
+    kMemoryPlacementDefault,    // wherever malloc() puts it
+    kMemoryPlacementInternal,   // hot loop scratch, always internal RAM
+    kMemoryPlacementBulk,       // large and latency tolerant (queued audio, pre-roll), PSRAM
+                                // if CONFIG_AUDIO_BULK_BUFFERS_IN_PSRAM, otherwise default
+    kMemoryPlacementPsram,      // moved out of internal RAM on purpose, PSRAM whenever there is some
+};
+
+// Current and peak bytes per subsystem, separately for internal RAM and
+// PSRAM. Memory gets here three ways:
+//  - TaggedAllocator, for STL containers owned by a subsystem
+//  - Add(), for memory managed by hand (e.g. the packet pool's slabs)
+//  - MemoryTagScope, for allocations made inside libraries (AFE, LVGL, OTA)
+// Counting is two atomic updates per allocation.
+class MemoryTracker {
+public:
+    static MemoryTracker& GetInstance() {
+        static MemoryTracker instance;
+        return instance;
+    }
+    MemoryTracker(const MemoryTracker&) = delete;
+    MemoryTracker& operator=(const MemoryTracker&) = delete;
+
+    static MemoryRegion RegionOf(const void* ptr);
+    // Fall back to the default heap when the preferred one is exhausted, so
+    // placement never turns into an allocation failure
+    static void* Allocate(size_t size, MemoryPlacement placement);
+    static void Free(void* ptr, MemoryPlacement placement);
+
+    void Add(MemoryTag tag, MemoryRegion region, int32_t size);
+    inline void Add(MemoryTag tag, const void* ptr, int32_t size) { Add(tag, RegionOf(ptr), size); }
+    inline int32_t current(MemoryTag tag, MemoryRegion region) const { return current_[tag][region].load(std::memory_order_relaxed); }
+    inline int32_t peak(MemoryTag tag, MemoryRegion region) const { return peak_[tag][region].load(std::memory_order_relaxed); }
+
+    // While a concurrent boot stage runs, other tasks allocate alongside any
+    // MemoryTagScope. A scope that overlaps one charges nothing and its tag is
+    // reported as unattributed rather than with a figure that is not its own.
+    void BeginConcurrent();
+    void EndConcurrent();
+    inline bool attributed(MemoryTag tag) const { return !unattributed_[tag].load(std::memory_order_relaxed); }
+
+    // Peaks restart from the current values
+    void ResetPeaks();
+    // {"audio":{"sram":{"current":..,"peak":..},"psram":{"current":..,"peak":..}},...},
+    // null for an unattributed tag
+    std::string GetJson();
+    void Log(const char* tag);
+
+private:
+    MemoryTracker() = default;
+
+    std::atomic<int32_t> current_[kMemoryTagCount][kMemoryRegionCount] = {};
+    std::atomic<int32_t> peak_[kMemoryTagCount][kMemoryRegionCount] = {};
+    std::atomic<bool> unattributed_[kMemoryTagCount] = {};
+    std::atomic<int> concurrent_ = 0;
+    // Counts BeginConcurrent() and EndConcurrent() calls, a scope that saw it
+    // change overlapped a concurrent stage
+    std::atomic<uint32_t> concurrent_changes_ = 0;
+
+    friend class MemoryTagScope;
+};
+
+// STL allocator that counts its memory against a fixed tag and places it by
+// policy. With the default placement it allocates exactly like std::allocator.
+template <typename T, MemoryTag Tag, MemoryPlacement Placement = kMemoryPlacementDefault>
+class TaggedAllocator {
+public:
+    using value_type = T;
+    template <typename U>
+    struct rebind { using other = TaggedAllocator<U, Tag, Placement>; };
+
+    TaggedAllocator() = default;
+    template <typename U>
+    TaggedAllocator(const TaggedAllocator<U, Tag, Placement>&) {}
+
+    T* allocate(size_t n) {
+        auto ptr = static_cast<T*>(MemoryTracker::Allocate(n * sizeof(T), Placement));
+        MemoryTracker::GetInstance().Add(Tag, ptr, n * sizeof(T));
+        return ptr;
+    }
+    void deallocate(T* ptr, size_t n) {
+        MemoryTracker::GetInstance().Add(Tag, ptr, -(int32_t)(n * sizeof(T)));
+        MemoryTracker::Free(ptr, Placement);
+    }
+
+    template <typename U>
+    bool operator==(const TaggedAllocator<U, Tag, Placement>&) const { return true; }
+    template <typename U>
+    bool operator!=(const TaggedAllocator<U, Tag, Placement>&) const { return false; }
+};
+
+// Large, latency tolerant buffers that may live in PSRAM
+template <typename T, MemoryTag Tag>
+using BulkAllocator = TaggedAllocator<T, Tag, kMemoryPlacementBulk>;
+// Buffers touched in hot loops, kept in internal RAM even when malloc()
+// would put a block this size in PSRAM
+template <typename T, MemoryTag Tag>
+using InternalAllocator = TaggedAllocator<T, Tag, kMemoryPlacementInternal>;
+
+// Counts the change of free heap since the scope began against a tag, the
+// last count stays after the scope ends. Meant for library calls that
+// allocate internally (creating an AFE instance, setting up LVGL, an OTA
+// download). Allocations made by other tasks at the same time end up in the
+// delta too, so keep these scopes short or where little else runs. Scopes
+// overlapping a concurrent boot stage are not counted, see BeginConcurrent().
+class MemoryTagScope {
+public:
+    explicit MemoryTagScope(MemoryTag tag);
+    ~MemoryTagScope();
+    MemoryTagScope(const MemoryTagScope&) = delete;
+    MemoryTagScope& operator=(const MemoryTagScope&) = delete;
+
+    // Recount now, so that peaks inside long scopes are seen
+    void Update();
+
+private:
+    MemoryTag tag_;
+    uint32_t concurrent_changes_;
+    size_t free_[kMemoryRegionCount];
+    int32_t charged_[kMemoryRegionCount] = {};
+};
+
+#endif // MEMORY_TRACKER_H
@@ -0,0 +1,152 @@
+#include "opus_codec.h"
+
+#include <algorithm>
+#include <esp_log.h>
+
+#define TAG "OpusCodec"
+
+// Largest packet a single Opus frame can take
+#define OPUS_MAX_PACKET_SIZE 1275
+
+OpusPacketEncoder::OpusPacketEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * duration_ms;
+
+    SetDtx(true);
+    // Complexity 5 almost uses up all CPU of ESP32C3
+    SetComplexity(5);
+    UpdateMaxPacketSize();
+}
+
+OpusPacketEncoder::~OpusPacketEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusPacketEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void OpusPacketEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusPacketEncoder::SetBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+        UpdateMaxPacketSize();
+    }
+}
+
+// Twice the size a frame has at the encoder's bitrate. The size passed to
+// opus_encode also caps the instant bitrate, so a frame always fits in the
+// packet and never takes more than one pool block.
+void OpusPacketEncoder::UpdateMaxPacketSize() {
+    opus_int32 bitrate = 0;
+    opus_encoder_ctl(encoder_, OPUS_GET_BITRATE(&bitrate));
+    size_t size = (size_t)bitrate * duration_ms_ / 8000 * 2;
+    max_packet_size_ = std::clamp<size_t>(size, 64, OPUS_MAX_PACKET_SIZE);
+}
+
+void OpusPacketEncoder::Encode(std::vector<int16_t>&& pcm, std::function<void(OpusPacket&& opus)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        return;
+    }
+
+    if (in_buffer_.empty()) {
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+
+    const size_t samples = frame_size_ * channels_;
+    size_t offset = 0;
+    while (in_buffer_.size() - offset >= samples) {
+        OpusPacket opus(max_packet_size_);
+        auto ret = opus_encode(encoder_, in_buffer_.data() + offset, frame_size_, opus.data(), opus.size());
+        offset += samples;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            continue;
+        }
+        opus.resize(ret);
+        handler(std::move(opus));
+    }
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+}
+
+bool OpusPacketEncoder::IsBufferEmpty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_buffer_.empty();
+}
+
+void OpusPacketEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+OpusPacketDecoder::OpusPacketDecoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels) {
+    int error;
+    decoder_ = opus_decoder_create(sample_rate, channels, &error);
+    if (decoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio decoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * duration_ms;
+}
+
+OpusPacketDecoder::~OpusPacketDecoder() {
+    if (decoder_ != nullptr) {
+        opus_decoder_destroy(decoder_);
+    }
+}
+
+bool OpusPacketDecoder::Decode(const uint8_t* data, size_t size, std::vector<int16_t>& pcm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decoder_ == nullptr) {
+        return false;
+    }
+
+    int frame_size = frame_size_;
+    if (size > 0) {
+        frame_size = opus_decoder_get_nb_samples(decoder_, data, size);
+        if (frame_size < 0) {
+            ESP_LOGE(TAG, "Invalid audio packet, error code: %d", frame_size);
+            return false;
+        }
+    }
+    pcm.resize(frame_size * channels_);
+    auto ret = opus_decode(decoder_, size > 0 ? data : nullptr, size, pcm.data(), frame_size, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret * channels_);
+    return true;
+}
+
+void OpusPacketDecoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decoder_ != nullptr) {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef OPUS_CODEC_H
+#define OPUS_CODEC_H
+
+#include <opus.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "packet_pool.h"
+
+// Opus encoder that writes every frame straight into a pooled OpusPacket,
+// which then travels to the send queue without being copied.
+// PCM is buffered until a whole frame of duration_ms is available.
+class OpusPacketEncoder {
+public:
+    OpusPacketEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusPacketEncoder();
+    OpusPacketEncoder(const OpusPacketEncoder&) = delete;
+    OpusPacketEncoder& operator=(const OpusPacketEncoder&) = delete;
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    // Takes effect with the next frame, packets are sized for the new bitrate
+    void SetBitrate(int bitrate);
+    void Encode(std::vector<int16_t>&& pcm, std::function<void(OpusPacket&& opus)> handler);
+    bool IsBufferEmpty();
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;            // samples per channel
+    size_t max_packet_size_;    // packets are allocated this size and trimmed
+    std::vector<int16_t> in_buffer_;
+
+    void UpdateMaxPacketSize();
+};
+
+class OpusPacketDecoder {
+public:
+    OpusPacketDecoder(int sample_rate, int channels, int duration_ms);
+    ~OpusPacketDecoder();
+    OpusPacketDecoder(const OpusPacketDecoder&) = delete;
+    OpusPacketDecoder& operator=(const OpusPacketDecoder&) = delete;
+
+    inline int sample_rate() const { return sample_rate_; }
+
+    // An empty packet conceals one lost frame of duration_ms
+    bool Decode(const uint8_t* data, size_t size, std::vector<int16_t>& pcm);
+    inline bool Decode(const OpusPacket& opus, std::vector<int16_t>& pcm) {
+        return Decode(opus.data(), opus.size(), pcm);
+    }
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusDecoder* decoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int frame_size_;            // samples per channel of a concealed frame
+};
+
+#endif // OPUS_CODEC_H
@@ -2,6 +2,8 @@
 #include "system_info.h"
 #include "board.h"
 #include "settings.h"
+#include "memory_tracker.h"
+#include "stack_monitor.h"
 #include "sdkconfig.h"
 
 #include <cJSON.h>
@@ -9,9 +11,18 @@
 #include <esp_partition.h>
 #include <esp_ota_ops.h>
 #include <esp_app_format.h>
+#include <esp_timer.h>
+#include <spi_flash_mmap.h>
+#include <mbedtls/sha256.h>
+#include <miniz.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <cstring>
 #include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
 #include <sstream>
 #include <algorithm>
 
@@ -182,6 +193,312 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
+// Progress of an unfinished download, so that the next attempt continues with
+// a Range request instead of starting over. The hash of the image's first
+// bytes tells whether the partition still holds what was written.
+#define OTA_PROGRESS_NAMESPACE "ota"
+#define OTA_HEAD_SIZE 4096
+// Flash wear and NVS writes against data downloaded again after a drop
+#define OTA_PROGRESS_SAVE_INTERVAL (64 * 1024)
+
+static bool HashPartitionHead(const esp_partition_t* partition, uint8_t sha256[32]) {
+    std::vector<uint8_t> head(OTA_HEAD_SIZE);
+    if (esp_partition_read(partition, 0, head.data(), head.size()) != ESP_OK) {
+        return false;
+    }
+    return mbedtls_sha256(head.data(), head.size(), sha256, 0) == 0;
+}
+
+static void ClearOtaProgress() {
+    Settings settings(OTA_PROGRESS_NAMESPACE, true);
+    settings.EraseAll();
+}
+
+// A compressed image is this header followed by the app image as a zlib
+// stream, scripts/release.py makes them. Fields are little endian.
+#define OTA_COMPRESSED_MAGIC "XZOC"
+#define OTA_COMPRESSION_ZLIB 1
+
+struct OtaCompressedHeader {
+    char magic[4];
+    uint8_t algorithm;
+    uint8_t reserved[3];
+    uint32_t image_size;        // inflated
+    uint32_t compressed_size;   // following the header
+    char version[32];           // the app description's, checked before anything is written
+} __attribute__((packed));
+
+// Flashes the image on a task of its own while the caller downloads into the
+// other buffer, so that network reads and flash erase/write overlap instead
+// of taking turns. Writes go straight to the partition, erasing just ahead of
+// the data, so a download can continue at any offset it reached before;
+// esp_ota_set_boot_partition() verifies the whole image at the end.
+class OtaWriter {
+public:
+    OtaWriter(const esp_partition_t* partition, size_t buffer_size, size_t offset)
+        : partition_(partition), buffer_size_(buffer_size), written_(offset), saved_(offset), erased_(offset) {
+        for (int i = 0; i < kBufferCount; i++) {
+            // Latency tolerant and large, PSRAM if there is some
+            auto buffer = (uint8_t*)MemoryTracker::Allocate(buffer_size, kMemoryPlacementPsram);
+            buffers_[i] = buffer;
+            if (buffer == nullptr) {
+                // GetBuffer() returns nullptr from now on
+                ESP_LOGE(TAG, "Failed to allocate a %zu byte OTA buffer", buffer_size);
+                failed_ = true;
+                continue;
+            }
+            free_buffers_.push_back(buffer);
+        }
+    }
+
+    ~OtaWriter() {
+        if (task_handle_ != nullptr) {
+            Stop();
+        }
+        for (auto buffer : buffers_) {
+            MemoryTracker::Free(buffer, kMemoryPlacementPsram);
+        }
+        MemoryTracker::Free(inflator_, kMemoryPlacementPsram);
+        MemoryTracker::Free(window_, kMemoryPlacementPsram);
+    }
+
+    // The submitted data is a zlib stream of an image_size bytes image,
+    // inflated through a 32 KB window on its way to flash. Call before Begin()
+    bool EnableInflate(size_t image_size) {
+        inflator_ = (tinfl_decompressor*)MemoryTracker::Allocate(sizeof(tinfl_decompressor), kMemoryPlacementPsram);
+        window_ = (uint8_t*)MemoryTracker::Allocate(TINFL_LZ_DICT_SIZE, kMemoryPlacementPsram);
+        if (inflator_ == nullptr || window_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the inflate window");
+            return false;
+        }
+        tinfl_init(inflator_);
+        image_size_ = image_size;
+        return true;
+    }
+
+    inline bool begun() const { return begun_; }
+    inline size_t buffer_size() const { return buffer_size_; }
+
+    bool Begin() {
+        begun_ = true;
+        auto result = xTaskCreate([](void* arg) {
+            auto writer = (OtaWriter*)arg;
+            writer->WriterLoop();
+            StackMonitor::GetInstance().RecordCurrentTask();
+            vTaskDelete(NULL);
+        }, "ota_writer", CONFIG_OTA_WRITER_STACK_SIZE, this, uxTaskPriorityGet(nullptr), &task_handle_);
+        if (result != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create the OTA writer task");
+            task_handle_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    // Waits for a free buffer, nullptr once a write has failed
+    uint8_t* GetBuffer() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto start_time = esp_timer_get_time();
+        condition_variable_.wait(lock, [this]() {
+            return !free_buffers_.empty() || failed_;
+        });
+        wait_time_ += esp_timer_get_time() - start_time;
+        if (failed_) {
+            return nullptr;
+        }
+        auto buffer = free_buffers_.front();
+        free_buffers_.pop_front();
+        return buffer;
+    }
+
+    // Queues a filled buffer for flashing, an empty one just goes back
+    void Submit(uint8_t* buffer, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        full_buffers_.push_back({buffer, size});
+        condition_variable_.notify_all();
+    }
+
+    // Flashes what is queued, false if a write failed
+    bool End() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_variable_.wait(lock, [this]() {
+                return (full_buffers_.empty() && !writing_) || failed_;
+            });
+        }
+        Stop();
+        if (failed_) {
+            return false;
+        }
+        if (inflator_ != nullptr && !inflate_done_) {
+            ESP_LOGE(TAG, "Compressed image is truncated");
+            return false;
+        }
+        ESP_LOGI(TAG, "Flash writes took %lld ms, the download waited %lld ms for buffers",
+            write_time_ / 1000, wait_time_ / 1000);
+        return true;
+    }
+
+private:
+    static constexpr int kBufferCount = 2;
+
+    struct FullBuffer {
+        uint8_t* data;
+        size_t size;
+    };
+
+    esp_err_t Write(uint8_t* data, size_t size) {
+        if (written_ + size > partition_->size) {
+            ESP_LOGE(TAG, "Firmware image is larger than partition %s", partition_->label);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        // Encrypted writes go in 16 byte blocks, images are padded to 16 bytes
+        // anyway and every buffer but the last is full
+        size_t unpadded_size = size;
+        if (partition_->encrypted && size % 16 != 0) {
+            size_t padded = (size + 15) / 16 * 16;
+            memset(data + size, 0xFF, padded - size);
+            size = padded;
+        }
+        size_t end = written_ + size;
+        if (end > erased_) {
+            size_t erase_end = std::min<size_t>((end + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE,
+                partition_->size);
+            auto err = esp_partition_erase_range(partition_, erased_, erase_end - erased_);
+            if (err != ESP_OK) {
+                return err;
+            }
+            erased_ = erase_end;
+        }
+        auto err = esp_partition_write(partition_, written_, data, size);
+        if (err != ESP_OK) {
+            return err;
+        }
+        written_ = end;
+        // An offset into the inflated image maps back to none in the download,
+        // and one past padding to none in the image
+        if (inflator_ == nullptr && size == unpadded_size && written_ - saved_ >= OTA_PROGRESS_SAVE_INTERVAL) {
+            Settings settings(OTA_PROGRESS_NAMESPACE, true);
+            settings.SetInt("offset", written_);
+            saved_ = written_;
+        }
+        return ESP_OK;
+    }
+
+    // Flash gets the window's new bytes whenever the input runs out or the
+    // window is full, the window then starts over as tinfl expects
+    esp_err_t Inflate(const uint8_t* data, size_t size) {
+        tinfl_status status;
+        do {
+            size_t in_size = size;
+            size_t out_size = TINFL_LZ_DICT_SIZE - window_next_;
+            status = tinfl_decompress(inflator_, data, &in_size, window_, window_ + window_next_, &out_size,
+                TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+            data += in_size;
+            size -= in_size;
+            window_next_ += out_size;
+            inflated_ += out_size;
+            if (status < TINFL_STATUS_DONE) {
+                ESP_LOGE(TAG, "Failed to inflate the image: %d", status);
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            inflate_done_ = status == TINFL_STATUS_DONE;
+            if (inflate_done_ && inflated_ != image_size_) {
+                ESP_LOGE(TAG, "Inflated %zu bytes, the header said %zu", inflated_, image_size_);
+                return ESP_ERR_INVALID_SIZE;
+            }
+
+            // Encrypted writes go in whole blocks until the end, the window size is one
+            size_t end = window_next_;
+            if (partition_->encrypted && !inflate_done_) {
+                end = end / 16 * 16;
+            }
+            if (end > window_flushed_) {
+                auto err = Write(window_ + window_flushed_, end - window_flushed_);
+                if (err != ESP_OK) {
+                    return err;
+                }
+                window_flushed_ = end;
+            }
+            if (window_next_ == TINFL_LZ_DICT_SIZE) {
+                window_next_ = 0;
+                window_flushed_ = 0;
+            }
+        } while (!inflate_done_ && (size > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT));
+        return ESP_OK;
+    }
+
+    void WriterLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_variable_.wait(lock, [this]() {
+                return !full_buffers_.empty() || stop_;
+            });
+            if (full_buffers_.empty()) {
+                break;
+            }
+            auto buffer = full_buffers_.front();
+            full_buffers_.pop_front();
+            writing_ = true;
+            lock.unlock();
+
+            esp_err_t err = ESP_OK;
+            if (!failed_ && buffer.size > 0) {
+                auto start_time = esp_timer_get_time();
+                err = inflator_ != nullptr ? Inflate(buffer.data, buffer.size) : Write(buffer.data, buffer.size);
+                write_time_ += esp_timer_get_time() - start_time;
+            }
+
+            lock.lock();
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+                failed_ = true;
+            }
+            writing_ = false;
+            free_buffers_.push_back(buffer.data);
+            condition_variable_.notify_all();
+        }
+        task_handle_ = nullptr;
+        condition_variable_.notify_all();
+    }
+
+    void Stop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stop_ = true;
+        condition_variable_.notify_all();
+        condition_variable_.wait(lock, [this]() {
+            return task_handle_ == nullptr;
+        });
+    }
+
+    const esp_partition_t* partition_;
+    size_t buffer_size_;
+    bool begun_ = false;
+    TaskHandle_t task_handle_ = nullptr;
+    // Writer task only
+    size_t written_;
+    size_t saved_;
+    size_t erased_;
+    tinfl_decompressor* inflator_ = nullptr;
+    uint8_t* window_ = nullptr;
+    size_t window_next_ = 0;
+    size_t window_flushed_ = 0;
+    size_t inflated_ = 0;
+    size_t image_size_ = 0;
+    bool inflate_done_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    uint8_t* buffers_[kBufferCount];
+    std::list<uint8_t*> free_buffers_;
+    std::list<FullBuffer> full_buffers_;
+    bool writing_ = false;
+    bool failed_ = false;
+    bool stop_ = false;
+    int64_t write_time_ = 0;
+    int64_t wait_time_ = 0;
+};
+
 void Ota::Upgrade(const std::string& firmware_url) {
 #ifdef CONFIG_DISABLE_OTA_UPDATE
     ESP_LOGI(TAG, "OTA upgrade is disabled by configuration");
@@ -189,7 +506,8 @@ void Ota::Upgrade(const std::string& firmware_url) {
 #endif
 
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
+    // Everything else is stopped while upgrading, so the heap change is ours
+    MemoryTagScope memory_scope(kMemoryTagOta);
     auto update_partition = esp_ota_get_next_update_partition(NULL);
     if (update_partition == NULL) {
         ESP_LOGE(TAG, "Failed to get update partition");
@@ -197,10 +515,37 @@ void Ota::Upgrade(const std::string& firmware_url) {
     }
 
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
+
+    // Continue an earlier download of the same image into the same partition
+    size_t offset = 0;
+    size_t image_size = 0;
+    std::string etag;
+    {
+        Settings settings(OTA_PROGRESS_NAMESPACE);
+        if (settings.GetString("url") == firmware_url && settings.GetString("partition") == update_partition->label) {
+            offset = settings.GetInt("offset");
+            image_size = settings.GetInt("size");
+            etag = settings.GetString("etag");
+            auto head_sha256 = settings.GetBlob("head_sha256");
+            uint8_t sha256[32];
+            if (offset < OTA_HEAD_SIZE || head_sha256.size() != sizeof(sha256) ||
+                !HashPartitionHead(update_partition, sha256) || memcmp(sha256, head_sha256.data(), sizeof(sha256)) != 0) {
+                offset = 0;
+            }
+        }
+    }
+
+    // Sectors are erased whole, redo the one the last attempt stopped in
+    offset = offset / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
 
     auto http = Board::GetInstance().CreateHttp();
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+        // A changed image comes back whole, with status 200
+        if (!etag.empty()) {
+            http->SetHeader("If-Range", etag);
+        }
+    }
     if (!http->Open("GET", firmware_url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         delete http;
@@ -214,85 +559,160 @@ void Ota::Upgrade(const std::string& firmware_url) {
         return;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
+    int status_code = http->GetStatusCode();
+    if (offset > 0 && status_code == 206) {
+        // Content-Range: bytes <offset>-<last>/<size>
+        auto content_range = http->GetResponseHeader("Content-Range");
+        auto expected = "bytes " + std::to_string(offset) + "-";
+        auto slash = content_range.rfind('/');
+        if (content_range.compare(0, expected.size(), expected) != 0 || slash == std::string::npos ||
+            strtoul(content_range.c_str() + slash + 1, nullptr, 10) != image_size || offset + content_length != image_size) {
+            ESP_LOGE(TAG, "Unexpected Content-Range: %s", content_range.c_str());
+            ClearOtaProgress();
+            delete http;
+            return;
+        }
+        ESP_LOGI(TAG, "Resuming download at %zu of %zu bytes", offset, image_size);
+    } else if (status_code == 200) {
+        if (offset > 0) {
+            ESP_LOGI(TAG, "The server sent the whole image, starting over");
+        }
+        offset = 0;
+        image_size = content_length;
+    } else {
+        ESP_LOGE(TAG, "Unexpected HTTP status code: %d", status_code);
+        ClearOtaProgress();
+        delete http;
+        return;
+    }
+
+    OtaWriter writer(update_partition, CONFIG_OTA_BUFFER_SIZE * 1024, offset);
+    size_t total_read = offset, recent_read = 0;
     auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+    bool finished = false;
+    while (!finished) {
+        auto buffer = writer.GetBuffer();
+        if (buffer == nullptr) {
             delete http;
             return;
         }
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+        // Fill the whole buffer, the writer flashes the other one meanwhile
+        size_t size = 0;
+        while (size < writer.buffer_size()) {
+            int ret = http->Read((char*)buffer + size, writer.buffer_size() - size);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+                delete http;
+                return;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
-        }
 
-        if (ret == 0) {
-            break;
-        }
+            // Calculate speed and progress every second
+            recent_read += ret;
+            total_read += ret;
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
+                size_t progress = total_read * 100 / image_size;
+                ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, total_read, image_size, recent_read);
+                if (upgrade_callback_) {
+                    upgrade_callback_(progress, recent_read);
+                }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+                memory_scope.Update();
+            }
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+            if (ret == 0) {
+                finished = true;
+                break;
+            }
+            size += ret;
+        }
 
-                auto current_version = esp_app_get_description()->version;
-                if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
-                    ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
+        if (!writer.begun() && offset == 0) {
+            // The buffer is at least 4 KB, the header and app description are in the first one
+            bool compressed = size >= sizeof(OtaCompressedHeader) && memcmp(buffer, OTA_COMPRESSED_MAGIC, 4) == 0;
+            esp_app_desc_t new_app_info = {};
+            if (compressed) {
+                OtaCompressedHeader header;
+                memcpy(&header, buffer, sizeof(header));
+                if (header.algorithm != OTA_COMPRESSION_ZLIB || header.image_size > update_partition->size ||
+                    sizeof(header) + header.compressed_size != image_size) {
+                    ESP_LOGE(TAG, "Unsupported compressed image, algorithm %d, %lu bytes",
+                        header.algorithm, (unsigned long)header.image_size);
                     delete http;
                     return;
                 }
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
+                if (!writer.EnableInflate(header.image_size)) {
                     delete http;
-                    ESP_LOGE(TAG, "Failed to begin OTA");
                     return;
                 }
+                memcpy(new_app_info.version, header.version, sizeof(new_app_info.version));
+                ESP_LOGI(TAG, "Compressed image, %lu bytes inflated", (unsigned long)header.image_size);
+                // Only the zlib stream goes to the writer
+                size -= sizeof(header);
+                memmove(buffer, buffer + sizeof(header), size);
+            } else if (size < OTA_HEAD_SIZE || buffer[0] != ESP_IMAGE_HEADER_MAGIC) {
+                ESP_LOGE(TAG, "Not a firmware image");
+                delete http;
+                return;
+            } else {
+                memcpy(&new_app_info, buffer + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+            }
+            ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
 
-                image_header_checked = true;
-                std::string().swap(image_header);
+            auto current_version = esp_app_get_description()->version;
+            if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
+                ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
+                delete http;
+                return;
+            }
+
+            if (compressed) {
+                // Not resumable, and whatever an earlier download left is stale now
+                ClearOtaProgress();
+            } else {
+                uint8_t head_sha256[32];
+                mbedtls_sha256(buffer, OTA_HEAD_SIZE, head_sha256, 0);
+                Settings settings(OTA_PROGRESS_NAMESPACE, true);
+                settings.SetString("url", firmware_url);
+                settings.SetString("partition", update_partition->label);
+                settings.SetString("etag", http->GetResponseHeader("ETag"));
+                settings.SetInt("size", image_size);
+                settings.SetInt("offset", 0);
+                settings.SetBlob("head_sha256", head_sha256, sizeof(head_sha256));
             }
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
+        if (!writer.begun() && !writer.Begin()) {
             delete http;
             return;
         }
+        writer.Submit(buffer, size);
     }
     delete http;
 
-    esp_err_t err = esp_ota_end(update_handle);
+    if (!writer.End()) {
+        return;
+    }
+    // A dropped connection looks like the end of the body. What was written
+    // stays, and the saved progress lets the next attempt resume from there
+    if (total_read != image_size) {
+        ESP_LOGE(TAG, "Download ended after %zu of %zu bytes", total_read, image_size);
+        return;
+    }
+
+    // Verifies the image, including its hash
+    auto err = esp_ota_set_boot_partition(update_partition);
+    // Either way the partition's content is done with
+    ClearOtaProgress();
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
         } else {
-            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
         }
         return;
     }
 
-    err = esp_ota_set_boot_partition(update_partition);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
-        return;
-    }
-
     ESP_LOGI(TAG, "Firmware upgrade successful, rebooting in 3 seconds...");
     vTaskDelay(pdMS_TO_TICKS(3000));
     esp_restart();
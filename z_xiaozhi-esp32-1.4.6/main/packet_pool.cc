@@ -0,0 +1,165 @@
+#include "packet_pool.h"
+#include "memory_tracker.h"
+
+#include <cstdio>
+#include <cinttypes>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "PacketPool"
+
+PacketPool::PacketPool() {
+    // Opus frames of 60 ms at 16 kHz are mostly 50 to 250 bytes, the largest
+    // class takes a maximum size Opus frame (1275 bytes) plus headers
+    static const size_t kBlockSizes[kClassCount] = { 128, 256, 512, 1536 };
+    static const size_t kBlocksPerSlab[kClassCount] = { 32, 16, 8, 4 };
+    for (int i = 0; i < kClassCount; i++) {
+        auto& size_class = classes_[i];
+        size_class = {};
+        size_class.block_size = kBlockSizes[i];
+        size_class.blocks_per_slab = kBlocksPerSlab[i];
+    }
+}
+
+PacketPool::SizeClass* PacketPool::ClassFor(size_t size) {
+    for (auto& size_class : classes_) {
+        if (size <= size_class.block_size) {
+            return &size_class;
+        }
+    }
+    return nullptr;
+}
+
+int PacketPool::SlabOf(const SizeClass& size_class, const void* ptr) const {
+    auto p = (const uint8_t*)ptr;
+    size_t slab_size = size_class.block_size * size_class.blocks_per_slab;
+    for (int i = 0; i < size_class.slab_count; i++) {
+        if (p >= size_class.slabs[i] && p < size_class.slabs[i] + slab_size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool PacketPool::Grow(SizeClass& size_class) {
+    size_t slab_size = size_class.block_size * size_class.blocks_per_slab;
+    if (size_class.slab_count >= kMaxSlabsPerClass || total_size_ + slab_size > CONFIG_PACKET_POOL_MAX_SIZE * 1024) {
+        return false;
+    }
+#if CONFIG_AUDIO_BULK_BUFFERS_IN_PSRAM
+    auto slab = (uint8_t*)heap_caps_malloc(slab_size, MALLOC_CAP_SPIRAM);
+#else
+    auto slab = (uint8_t*)heap_caps_malloc(slab_size, MALLOC_CAP_DEFAULT);
+#endif
+    if (slab == nullptr) {
+        return false;
+    }
+    MemoryTracker::GetInstance().Add(kMemoryTagPacketPool, slab, slab_size);
+    total_size_ += slab_size;
+
+    int index = size_class.slab_count++;
+    size_class.slabs[index] = slab;
+    size_class.slab_free[index] = size_class.blocks_per_slab;
+    for (size_t i = 0; i < size_class.blocks_per_slab; i++) {
+        auto block = (FreeBlock*)(slab + i * size_class.block_size);
+        block->next = size_class.free_list;
+        size_class.free_list = block;
+    }
+    return true;
+}
+
+void* PacketPool::Allocate(size_t size) {
+    auto size_class = ClassFor(size);
+    if (size_class != nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size_class->free_list != nullptr || Grow(*size_class)) {
+            auto block = size_class->free_list;
+            size_class->free_list = block->next;
+            size_class->slab_free[SlabOf(*size_class, block)]--;
+            size_class->allocations++;
+            if (++size_class->in_use > size_class->peak) {
+                size_class->peak = size_class->in_use;
+            }
+            return block;
+        }
+        size_class->fallbacks++;
+    }
+    return MemoryTracker::Allocate(size, kMemoryPlacementBulk);
+}
+
+void PacketPool::Free(void* ptr, size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto size_class = ClassFor(size);
+    if (size_class != nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int slab = SlabOf(*size_class, ptr);
+        if (slab >= 0) {
+            auto block = (FreeBlock*)ptr;
+            block->next = size_class->free_list;
+            size_class->free_list = block;
+            size_class->slab_free[slab]++;
+            size_class->in_use--;
+            return;
+        }
+    }
+    MemoryTracker::Free(ptr, kMemoryPlacementBulk);
+}
+
+void PacketPool::Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& size_class : classes_) {
+        size_t slab_size = size_class.block_size * size_class.blocks_per_slab;
+        for (int i = size_class.slab_count - 1; i >= 1; i--) {
+            if (size_class.slab_free[i] != size_class.blocks_per_slab) {
+                continue;
+            }
+            // Unlink the slab's blocks from the free list
+            auto slab = size_class.slabs[i];
+            FreeBlock** link = &size_class.free_list;
+            while (*link != nullptr) {
+                auto p = (uint8_t*)*link;
+                if (p >= slab && p < slab + slab_size) {
+                    *link = (*link)->next;
+                } else {
+                    link = &(*link)->next;
+                }
+            }
+            MemoryTracker::GetInstance().Add(kMemoryTagPacketPool, slab, -(int32_t)slab_size);
+            heap_caps_free(slab);
+            total_size_ -= slab_size;
+
+            int last = --size_class.slab_count;
+            size_class.slabs[i] = size_class.slabs[last];
+            size_class.slab_free[i] = size_class.slab_free[last];
+        }
+    }
+}
+
+std::string PacketPool::GetJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json = "[";
+    for (auto& size_class : classes_) {
+        char buffer[192];
+        snprintf(buffer, sizeof(buffer),
+            "%s{\"block_size\":%u,\"slabs\":%d,\"blocks\":%u,\"in_use\":%" PRIu32 ",\"peak\":%" PRIu32
+            ",\"allocations\":%" PRIu32 ",\"fallbacks\":%" PRIu32 "}",
+            json.size() > 1 ? "," : "", size_class.block_size, size_class.slab_count,
+            size_class.slab_count * size_class.blocks_per_slab, size_class.in_use, size_class.peak,
+            size_class.allocations, size_class.fallbacks);
+        json += buffer;
+    }
+    json += "]";
+    return json;
+}
+
+void PacketPool::Log(const char* tag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& size_class : classes_) {
+        ESP_LOGI(tag, "Packets <= %u: %" PRIu32 "/%u in use, peak %" PRIu32 ", %" PRIu32 " allocations, %" PRIu32 " from the heap",
+            size_class.block_size, size_class.in_use, size_class.slab_count * size_class.blocks_per_slab,
+            size_class.peak, size_class.allocations, size_class.fallbacks);
+    }
+    ESP_LOGI(tag, "Pool size %u bytes", total_size_);
+}
@@ -0,0 +1,93 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Slab allocator for network and Opus packets. Packets are small, similarly
+// sized and created and freed by the thousand during a reply; serving them
+// from a few size classes of fixed slabs keeps them from fragmenting the heap
+// around longer lived allocations.
+// Slabs are added on demand up to CONFIG_PACKET_POOL_MAX_SIZE and given back
+// by Trim() once they are completely free. Requests larger than the biggest
+// class, or made while the pool is at its limit, go to the heap.
+class PacketPool {
+public:
+    static PacketPool& GetInstance() {
+        static PacketPool instance;
+        return instance;
+    }
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    void* Allocate(size_t size);
+    // size must be the size passed to Allocate
+    void Free(void* ptr, size_t size);
+    // Releases the free slabs beyond the first of each class, call when idle
+    void Trim();
+
+    // [{"block_size":..,"slabs":..,"blocks":..,"in_use":..,"peak":..,"allocations":..,"fallbacks":..},...]
+    std::string GetJson();
+    void Log(const char* tag);
+
+private:
+    static constexpr int kClassCount = 4;
+    static constexpr int kMaxSlabsPerClass = 32;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct SizeClass {
+        size_t block_size;
+        size_t blocks_per_slab;
+        uint8_t* slabs[kMaxSlabsPerClass];
+        uint16_t slab_free[kMaxSlabsPerClass];
+        int slab_count;
+        FreeBlock* free_list;
+        uint32_t in_use;
+        uint32_t peak;
+        uint32_t allocations;
+        uint32_t fallbacks;
+    };
+
+    PacketPool();
+    bool Grow(SizeClass& size_class);
+    int SlabOf(const SizeClass& size_class, const void* ptr) const;
+    SizeClass* ClassFor(size_t size);
+
+    std::mutex mutex_;
+    SizeClass classes_[kClassCount];
+    size_t total_size_ = 0;
+};
+
+// STL allocator backed by the packet pool
+template <typename T>
+class PacketAllocator {
+public:
+    using value_type = T;
+
+    PacketAllocator() = default;
+    template <typename U>
+    PacketAllocator(const PacketAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(PacketPool::GetInstance().Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) {
+        PacketPool::GetInstance().Free(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PacketAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PacketAllocator<U>&) const { return false; }
+};
+
+// An encoded audio frame or a message payload
+using OpusPacket = std::vector<uint8_t, PacketAllocator<uint8_t>>;
+
+#endif // PACKET_POOL_H
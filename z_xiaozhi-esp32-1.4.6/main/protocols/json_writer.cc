@@ -0,0 +1,134 @@
+#include "json_writer.h"
+
+#include <cstdio>
+#include <cinttypes>
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {
+    if (capacity_ > 0) {
+        buffer_[0] = '\0';
+    } else {
+        overflow_ = true;
+    }
+}
+
+void JsonWriter::Put(char c) {
+    // Always keep one byte for the terminating zero
+    if (overflow_ || length_ + 1 >= capacity_) {
+        overflow_ = true;
+        return;
+    }
+    buffer_[length_++] = c;
+    buffer_[length_] = '\0';
+}
+
+void JsonWriter::Put(std::string_view text) {
+    if (overflow_ || length_ + text.size() >= capacity_) {
+        overflow_ = true;
+        return;
+    }
+    for (char c : text) {
+        buffer_[length_++] = c;
+    }
+    buffer_[length_] = '\0';
+}
+
+void JsonWriter::PutEscaped(std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    Put('"');
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"': Put("\\\""); break;
+            case '\\': Put("\\\\"); break;
+            case '\b': Put("\\b"); break;
+            case '\f': Put("\\f"); break;
+            case '\n': Put("\\n"); break;
+            case '\r': Put("\\r"); break;
+            case '\t': Put("\\t"); break;
+            default:
+                if (c < 0x20) {
+                    char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F]};
+                    Put(std::string_view(escaped, sizeof(escaped)));
+                } else {
+                    // UTF-8 multibyte sequences are passed through untouched
+                    Put((char)c);
+                }
+                break;
+        }
+    }
+    Put('"');
+}
+
+void JsonWriter::BeginValue() {
+    if (depth_ == 0) {
+        return;
+    }
+    uint32_t bit = 1u << (depth_ - 1);
+    if (has_items_ & bit) {
+        Put(',');
+    }
+    has_items_ |= bit;
+}
+
+void JsonWriter::PutKey(std::string_view key) {
+    BeginValue();
+    PutEscaped(key);
+    Put(':');
+}
+
+void JsonWriter::OpenObject() {
+    Put('{');
+    if (depth_ >= 32) {
+        overflow_ = true;
+        return;
+    }
+    depth_++;
+    has_items_ &= ~(1u << (depth_ - 1));
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    BeginValue();
+    OpenObject();
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginObject(std::string_view key) {
+    PutKey(key);
+    OpenObject();
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    if (depth_ == 0) {
+        overflow_ = true;
+        return *this;
+    }
+    depth_--;
+    Put('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddString(std::string_view key, std::string_view value) {
+    PutKey(key);
+    PutEscaped(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddInt(std::string_view key, int64_t value) {
+    char number[24];
+    int length = snprintf(number, sizeof(number), "%" PRId64, value);
+    PutKey(key);
+    Put(std::string_view(number, length));
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddBool(std::string_view key, bool value) {
+    PutKey(key);
+    Put(value ? std::string_view("true") : std::string_view("false"));
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddRaw(std::string_view key, std::string_view json) {
+    PutKey(key);
+    Put(json);
+    return *this;
+}
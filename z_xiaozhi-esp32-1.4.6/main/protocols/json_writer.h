@@ -0,0 +1,74 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string_view>
+
+// Minimal streaming JSON writer over a caller supplied buffer.
+// It never allocates: if the output does not fit, the writer is marked as
+// overflowed and the caller must drop the message.
+class JsonWriter {
+public:
+    JsonWriter(char* buffer, size_t capacity);
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginObject(std::string_view key);
+    JsonWriter& AddString(std::string_view key, std::string_view value);
+    JsonWriter& AddInt(std::string_view key, int64_t value);
+    JsonWriter& AddBool(std::string_view key, bool value);
+    // Append an already serialized JSON value without escaping
+    JsonWriter& AddRaw(std::string_view key, std::string_view json);
+
+    inline bool ok() const { return !overflow_ && depth_ == 0; }
+    inline size_t size() const { return length_; }
+    inline const char* c_str() const { return buffer_; }
+    inline std::string_view view() const { return std::string_view(buffer_, length_); }
+
+private:
+    char* buffer_;
+    size_t capacity_;
+    size_t length_ = 0;
+    bool overflow_ = false;
+    int depth_ = 0;
+    uint32_t has_items_ = 0;
+
+    void Put(char c);
+    void Put(std::string_view text);
+    void PutEscaped(std::string_view text);
+    void PutKey(std::string_view key);
+    void BeginValue();
+    void OpenObject();
+};
+
+// JsonWriter with inline storage, meant to live on the caller's stack
+template <size_t N>
+class StackJsonWriter : public JsonWriter {
+public:
+    StackJsonWriter() : JsonWriter(storage_, N) {}
+
+private:
+    char storage_[N];
+};
+
+// Owns the buffer of a HeapJsonWriter, a base class so that it is allocated
+// before the writer is constructed over it
+struct JsonHeapBuffer {
+    explicit JsonHeapBuffer(size_t capacity) : storage(new (std::nothrow) char[capacity]) {}
+    std::unique_ptr<char[]> storage;
+};
+
+// JsonWriter with a heap buffer, for messages that embed values whose size
+// is only known at run time. If the allocation fails the writer overflows.
+class HeapJsonWriter : private JsonHeapBuffer, public JsonWriter {
+public:
+    explicit HeapJsonWriter(size_t capacity)
+        : JsonHeapBuffer(capacity), JsonWriter(storage.get(), storage ? capacity : 0) {}
+};
+
+#endif // JSON_WRITER_H
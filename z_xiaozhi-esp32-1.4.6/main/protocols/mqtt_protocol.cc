@@ -12,18 +12,46 @@
 
 #define TAG "MQTT"
 
-MqttProtocol::MqttProtocol() {
+MqttProtocol::MqttProtocol() : reorder_buffer_(MQTT_UDP_REORDER_WINDOW, MQTT_UDP_MAX_CONCEALED_PACKETS) {
     event_group_handle_ = xEventGroupCreate();
+    mbedtls_aes_init(&aes_ctx_);
+    // Reserve the packet buffer once so that WriteAudio never reallocates
+    udp_packet_.reserve(MQTT_UDP_MAX_PACKET_SIZE);
+
+    // In-order packets go to the decoder, empty ones mark a frame to conceal
+    reorder_buffer_.OnPacket([this](OpusPacket&& payload) {
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(payload));
+        }
+    });
+
+    // Stop waiting for a missing packet once the held ones would be late
+    esp_timer_create_args_t reorder_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (MqttProtocol*)arg;
+            std::lock_guard<std::mutex> lock(protocol->reorder_mutex_);
+            protocol->reorder_buffer_.Flush();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "udp_reorder",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&reorder_timer_args, &reorder_timer_);
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    StopSender();
     if (udp_ != nullptr) {
         delete udp_;
     }
-    if (mqtt_ != nullptr) {
-        delete mqtt_;
+    mqtt_.reset();
+    if (reorder_timer_ != nullptr) {
+        esp_timer_stop(reorder_timer_);
+        esp_timer_delete(reorder_timer_);
     }
+    mbedtls_aes_free(&aes_ctx_);
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -32,9 +60,18 @@ void MqttProtocol::Start() {
 }
 
 bool MqttProtocol::StartMqttClient(bool report_error) {
-    if (mqtt_ != nullptr) {
+    std::shared_ptr<Mqtt> old_mqtt;
+    {
+        // The sender task must not publish to a half replaced client
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        old_mqtt.swap(mqtt_);
+        publish_topic_.clear();
+    }
+    if (old_mqtt != nullptr) {
         ESP_LOGW(TAG, "Mqtt client already started");
-        delete mqtt_;
+        // If the sender task is publishing, it deletes the client once that returns
+        old_mqtt->Disconnect();
+        old_mqtt.reset();
     }
 
     Settings settings("mqtt", false);
@@ -42,7 +79,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     client_id_ = settings.GetString("client_id");
     username_ = settings.GetString("username");
     password_ = settings.GetString("password");
-    publish_topic_ = settings.GetString("publish_topic");
+    auto publish_topic = settings.GetString("publish_topic");
 
     if (endpoint_.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
@@ -52,14 +89,14 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         return false;
     }
 
-    mqtt_ = Board::GetInstance().CreateMqtt();
-    mqtt_->SetKeepAlive(90);
+    std::shared_ptr<Mqtt> mqtt(Board::GetInstance().CreateMqtt());
+    mqtt->SetKeepAlive(90);
 
-    mqtt_->OnDisconnected([this]() {
+    mqtt->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
     });
 
-    mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
+    mqtt->OnMessage([this](const std::string& topic, const std::string& payload) {
         cJSON* root = cJSON_Parse(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
@@ -74,6 +111,8 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 
         if (strcmp(type->valuestring, "hello") == 0) {
             ParseServerHello(root);
+        } else if (strcmp(type->valuestring, "pong") == 0) {
+            ParsePong(root);
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
@@ -90,7 +129,12 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     ESP_LOGI(TAG, "Connecting to endpoint %s", endpoint_.c_str());
-    if (!mqtt_->Connect(endpoint_, 8883, client_id_, username_, password_)) {
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        mqtt_ = mqtt;
+        publish_topic_ = std::move(publish_topic);
+    }
+    if (!mqtt->Connect(endpoint_, 8883, client_id_, username_, password_)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
@@ -100,41 +144,83 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     return true;
 }
 
-void MqttProtocol::SendText(const std::string& text) {
-    if (publish_topic_.empty()) {
-        return;
+void MqttProtocol::WriteText(std::string_view text) {
+    std::shared_ptr<Mqtt> mqtt;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (mqtt_ == nullptr || publish_topic_.empty()) {
+            return;
+        }
+        mqtt = mqtt_;
+        write_topic_.assign(publish_topic_);
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
-        ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+    publish_payload_.assign(text.data(), text.size());
+    if (!mqtt->Publish(write_topic_, publish_payload_)) {
+        ESP_LOGE(TAG, "Failed to publish message: %s", publish_payload_.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
     }
 }
 
-void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void MqttProtocol::WriteAudio(const std::vector<uint8_t>& data) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+    {
+        std::lock_guard<std::mutex> crypto_lock(crypto_mutex_);
+        const size_t nonce_size = aes_nonce_.size();
+        if (nonce_size + data.size() > udp_packet_.capacity()) {
+            ESP_LOGE(TAG, "Audio packet too large: %zu", data.size());
+            return;
+        }
+
+        // Packet = nonce header (with payload size and sequence) + encrypted payload,
+        // assembled in the preallocated buffer without any temporary copies
+        udp_packet_.resize(nonce_size + data.size());
+        auto packet = (uint8_t*)udp_packet_.data();
+        memcpy(packet, aes_nonce_.data(), nonce_size);
+        *(uint16_t*)&packet[2] = htons(data.size());
+        *(uint32_t*)&packet[12] = htonl(++local_sequence_);
+
+        // The counter block is modified by mbedtls, so work on a stack copy of the header
+        uint8_t nonce_counter[16];
+        memcpy(nonce_counter, packet, sizeof(nonce_counter));
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, nonce_counter, stream_block,
+            data.data(), packet + nonce_size) != 0) {
+            ESP_LOGE(TAG, "Failed to encrypt audio data");
+            return;
+        }
+    }
+    udp_->Send(udp_packet_);
+}
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+void MqttProtocol::OnUdpAudio(uint32_t sequence, OpusPacket&& payload) {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    if (reorder_buffer_.Push(sequence, std::move(payload))) {
+        if (!esp_timer_is_active(reorder_timer_)) {
+            esp_timer_start_once(reorder_timer_, MQTT_UDP_REORDER_TIMEOUT_MS * 1000);
+        }
+    } else {
+        esp_timer_stop(reorder_timer_);
+    }
+}
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+void MqttProtocol::LogAudioStats() {
+    std::lock_guard<std::mutex> lock(reorder_mutex_);
+    auto& stats = reorder_buffer_.stats();
+    if (stats.received == 0) {
         return;
     }
-    udp_->Send(encrypted);
+    ESP_LOGI(TAG, "UDP audio: received %lu, lost %lu, reordered %lu, duplicated %lu, late %lu",
+        stats.received, stats.lost, stats.reordered, stats.duplicated, stats.late);
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    // Only the goodbye is left to send for this session
+    ClearSendQueue();
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         if (udp_ != nullptr) {
@@ -142,12 +228,16 @@ void MqttProtocol::CloseAudioChannel() {
             udp_ = nullptr;
         }
     }
+    esp_timer_stop(reorder_timer_);
+    LogAudioStats();
+    LogSendQueueStats();
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    StackJsonWriter<256> goodbye;
+    goodbye.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "goodbye")
+        .EndObject();
+    StartSending(goodbye);
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -162,19 +252,27 @@ bool MqttProtocol::OpenAudioChannel() {
         }
     }
 
+    // Messages of the previous session are dropped, new ones follow the hello
+    ClearSendQueue();
     error_occurred_ = false;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    SendText(message);
+    StackJsonWriter<256> hello;
+    hello.BeginObject()
+        .AddString("type", "hello")
+        .AddInt("version", 3)
+        .AddString("transport", "udp")
+        .BeginObject("audio_params")
+            .AddString("format", "opus")
+            .AddInt("sample_rate", 16000)
+            .AddInt("channels", 1)
+            .AddInt("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject();
+    WriteHelloOptions(hello);
+    hello.EndObject();
+    StartSending(hello);
 
     // 等待服务器响应
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -190,7 +288,9 @@ bool MqttProtocol::OpenAudioChannel() {
     }
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        // The nonce is 16 bytes, a new server hello only changes its content
+        const size_t nonce_size = 16;
+        if (data.size() < nonce_size) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -199,30 +299,26 @@ bool MqttProtocol::OpenAudioChannel() {
             return;
         }
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        std::vector<uint8_t> decrypted;
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        // Decrypt straight into the buffer handed over to the decoder
+        size_t decrypted_size = data.size() - nonce_size;
+        OpusPacket decrypted(decrypted_size);
+        uint8_t nonce_counter[16];
+        memcpy(nonce_counter, data.data(), sizeof(nonce_counter));
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
+        auto encrypted = (const uint8_t*)data.data() + nonce_size;
+        int ret;
+        {
+            // A server hello may be setting a new key meanwhile
+            std::lock_guard<std::mutex> lock(crypto_mutex_);
+            ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce_counter, stream_block, encrypted, decrypted.data());
+        }
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(decrypted));
-        }
-        remote_sequence_ = sequence;
+        OnUdpAudio(sequence, std::move(decrypted));
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -247,6 +343,8 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    ParseHelloOptions(root);
+
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (audio_params != NULL) {
@@ -268,11 +366,23 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
-    local_sequence_ = 0;
-    remote_sequence_ = 0;
+    auto aes_nonce = DecodeHexString(nonce);
+    if (aes_nonce.size() != 16) {
+        ESP_LOGE(TAG, "Invalid nonce size: %zu", aes_nonce.size());
+        return;
+    }
+    {
+        // WriteAudio may be encrypting on the sender task right now, and
+        // the UDP receive task decrypting
+        std::lock_guard<std::mutex> lock(crypto_mutex_);
+        aes_nonce_ = std::move(aes_nonce);
+        mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+        local_sequence_ = 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reorder_mutex_);
+        reorder_buffer_.Reset();
+    }
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -3,30 +3,41 @@
 
 
 #include "protocol.h"
+#include "reorder_buffer.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
 #include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
 
 #include <functional>
 #include <string>
 #include <map>
 #include <mutex>
+#include <memory>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Upper bound of one encrypted UDP audio packet (nonce + opus payload)
+#define MQTT_UDP_MAX_PACKET_SIZE 1500
+// Incoming audio may arrive up to this many packets out of order
+#define MQTT_UDP_REORDER_WINDOW 4
+// Gaps longer than this are skipped instead of concealed
+#define MQTT_UDP_MAX_CONCEALED_PACKETS 8
+// How long packets are held back waiting for a missing one
+#define MQTT_UDP_REORDER_TIMEOUT_MS 120
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
     ~MqttProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -38,23 +49,40 @@ private:
     std::string client_id_;
     std::string username_;
     std::string password_;
-    std::string publish_topic_;
+    std::string publish_topic_;     // guarded by channel_mutex_
+    // Used by the sender task only, their capacity survives between messages
+    std::string write_topic_;
+    std::string publish_payload_;
 
+    // Guards the clients against being replaced while the sender task picks
+    // them up. It keeps its own reference to the MQTT client while publishing,
+    // so a reconnect never waits for a blocked publish.
     std::mutex channel_mutex_;
-    Mqtt* mqtt_ = nullptr;
+    std::shared_ptr<Mqtt> mqtt_;
     Udp* udp_ = nullptr;
+    std::string udp_packet_;
+    // The key and nonce, used by the sender task, the UDP receive task and
+    // the server hello on the MQTT task. Held only around the crypto, not
+    // while the socket is created or deleted.
+    std::mutex crypto_mutex_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
     std::string udp_server_;
     int udp_port_;
-    uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    uint32_t local_sequence_;    // guarded by crypto_mutex_
+
+    std::mutex reorder_mutex_;
+    ReorderBuffer reorder_buffer_;
+    esp_timer_handle_t reorder_timer_ = nullptr;
 
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    void OnUdpAudio(uint32_t sequence, OpusPacket&& payload);
+    void LogAudioStats();
 
-    void SendText(const std::string& text) override;
+    void WriteText(std::string_view text) override;
+    void WriteAudio(const std::vector<uint8_t>& data) override;
 };
 
 
@@ -1,14 +1,405 @@
 #include "protocol.h"
+#include "event_trace.h"
+#include "stack_monitor.h"
+#if CONFIG_SESSION_RECORDER
+#include "session_recorder.h"
+#endif
 
+#include <cstring>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #define TAG "Protocol"
 
+// Audio waits at most this long for room in the queue before the oldest packet is dropped
+#define SEND_QUEUE_MAX_PAUSE_MS 500
+// Slots beyond a full queue of audio, for control messages
+#define SEND_QUEUE_CONTROL_SLOTS 8
+// Text capacity of a slot, control messages up to this size never allocate
+#define SEND_QUEUE_TEXT_CAPACITY 256
+
+Protocol::Protocol() : send_duration_("send_duration"), send_queue_delay_("send_queue_delay"),
+    rtt_("rtt"), downlink_lateness_("downlink_lateness") {
+    // Bursts that don't count against the queue size add slots when needed,
+    // they are kept for later
+    free_slots_.resize(CONFIG_SEND_QUEUE_SIZE + SEND_QUEUE_CONTROL_SLOTS);
+    for (auto& slot : free_slots_) {
+        slot.text.reserve(SEND_QUEUE_TEXT_CAPACITY);
+    }
+
+    // Network writes happen on this task, so that neither the main loop
+    // nor the encoder ever block on a slow socket
+    sender_running_ = true;
+    auto result = xTaskCreate([](void* arg) {
+        auto protocol = (Protocol*)arg;
+        protocol->SenderLoop();
+        StackMonitor::GetInstance().RecordCurrentTask();
+        vTaskDelete(NULL);
+    }, "protocol_send", CONFIG_PROTOCOL_SEND_STACK_SIZE, this, 4, nullptr);
+    if (result != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the sender task");
+        sender_running_ = false;
+    }
+}
+
+Protocol::~Protocol() {
+    StopSender();
+}
+
+void Protocol::StopSender() {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    sender_stop_ = true;
+    send_cv_.notify_all();
+    send_cv_.wait(lock, [this]() {
+        return !sender_running_;
+    });
+}
+
+void Protocol::SenderLoop() {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    while (true) {
+        send_cv_.wait(lock, [this]() {
+            return sender_stop_ || (!send_queue_.empty() && !send_held_);
+        });
+        if (sender_stop_) {
+            break;
+        }
+
+        // Audio that piled up behind this packet goes out in the same message,
+        // so a slow link gets fewer, larger messages without waiting for frames
+        auto last = std::next(send_queue_.begin());
+        if (send_queue_.front().binary) {
+            int max_frames = frames_per_packet_;
+            for (int count = 1; count < max_frames && last != send_queue_.end() && last->binary; count++) {
+                ++last;
+            }
+        }
+        for (auto it = send_queue_.begin(); it != last; ++it) {
+            if (it->droppable) {
+                queued_audio_--;
+            }
+        }
+        send_stats_.sent++;
+        sending_.splice(sending_.end(), send_queue_, send_queue_.begin(), last);
+        lock.unlock();
+        space_cv_.notify_all();
+
+        {
+            auto& packet = sending_.front();
+            TRACE_SCOPE(packet.binary ? "send_audio" : "send_text");
+            auto start_time = esp_timer_get_time();
+            send_queue_delay_.Record(start_time - packet.queued_time);
+            if (packet.binary) {
+                WriteAudioFrames(sending_);
+            } else {
+                WriteText(packet.text);
+            }
+            int64_t duration_us = esp_timer_get_time() - start_time;
+            int duration_ms = duration_us / 1000;
+            send_duration_.Record(duration_us);
+            send_latency_ms_ = (send_latency_ms_ * 7 + duration_ms) / 8;
+        }
+
+        lock.lock();
+        ReleaseSlots(sending_, sending_.begin(), sending_.end());
+    }
+    sender_running_ = false;
+    send_cv_.notify_all();
+}
+
+Protocol::PacketList::iterator Protocol::TakeSlot() {
+    if (free_slots_.empty()) {
+        free_slots_.emplace_back();
+    }
+    return free_slots_.begin();
+}
+
+void Protocol::ReleaseSlots(PacketList& list, PacketList::iterator first, PacketList::iterator last) {
+    for (auto it = first; it != last; ++it) {
+        // Audio goes back to the packet pool, text keeps its capacity
+        it->data = OpusPacket();
+        it->text.clear();
+    }
+    free_slots_.splice(free_slots_.end(), list, first, last);
+}
+
+void Protocol::WriteAudioFrames(PacketList& frames) {
+    bool packed = frames_per_packet_ > 1;
+    int version = binary_version_;
+    auto& first = frames.front();
+    if (!packed && version < 2) {
+        pack_buffer_.assign(first.data.begin(), first.data.end());
+        WriteAudio(pack_buffer_);
+        return;
+    }
+
+    size_t payload_size = first.data.size();
+    if (packed) {
+        payload_size = sizeof(BinaryProtocolPacked);
+        for (auto& frame : frames) {
+            payload_size += sizeof(PackedFrameHeader) + frame.data.size();
+        }
+        if (payload_size - sizeof(BinaryProtocolPacked) > UINT16_MAX) {
+            ESP_LOGE(TAG, "Packed audio too large: %u bytes", payload_size);
+            return;
+        }
+    }
+
+    size_t header_size = version >= 2 ? sizeof(BinaryProtocol2) : 0;
+    pack_buffer_.resize(header_size + payload_size);
+    auto payload = pack_buffer_.data() + header_size;
+    if (packed) {
+        auto message = (BinaryProtocolPacked*)payload;
+        message->type = 0;
+        message->frame_count = frames.size();
+        message->payload_size = htons(payload_size - sizeof(BinaryProtocolPacked));
+        auto p = message->payload;
+        for (auto& frame : frames) {
+            auto header = (PackedFrameHeader*)p;
+            header->timestamp = htonl((uint32_t)(frame.queued_time / 1000));
+            header->size = htons(frame.data.size());
+            memcpy(p + sizeof(PackedFrameHeader), frame.data.data(), frame.data.size());
+            p += sizeof(PackedFrameHeader) + frame.data.size();
+        }
+    } else {
+        memcpy(payload, first.data.data(), payload_size);
+    }
+
+    if (version >= 2) {
+        // Live audio is queued as soon as it is encoded, so the queue time
+        // stands in for the capture time
+        auto header = (BinaryProtocol2*)pack_buffer_.data();
+        header->version = htons(2);
+        header->type = htons(packed ? 1 : 0);
+        header->sequence = htonl(uplink_sequence_++);
+        header->timestamp = htonl((uint32_t)(first.queued_time / 1000));
+        header->payload_size = htonl(payload_size);
+    }
+    WriteAudio(pack_buffer_);
+}
+
+void Protocol::RecordDownlinkTiming(uint32_t sequence, uint32_t timestamp) {
+    // A new server stream restarts its sequence
+    if (sequence == 0 || sequence < downlink_sequence_) {
+        downlink_offset_ = INT64_MAX;
+    } else if (sequence > downlink_sequence_ + 1) {
+        downlink_lost_ += sequence - downlink_sequence_ - 1;
+        ESP_LOGW(TAG, "Downlink frames missing: %lu (total %lu)", sequence - downlink_sequence_ - 1, downlink_lost_);
+    }
+    downlink_sequence_ = sequence;
+
+    // The earliest frame of the stream sets the baseline, later ones are
+    // measured against the server's own timeline
+    int64_t offset = esp_timer_get_time() / 1000 - timestamp;
+    if (offset < downlink_offset_) {
+        downlink_offset_ = offset;
+    }
+    downlink_lateness_.Record((offset - downlink_offset_) * 1000);
+}
+
+void Protocol::DeliverIncomingAudio(const uint8_t* data, size_t len) {
+    if (on_incoming_audio_ == nullptr) {
+        return;
+    }
+
+    bool packed = frames_per_packet_ > 1;
+    if (binary_version_ >= 2) {
+        auto header = (const BinaryProtocol2*)data;
+        if (len < sizeof(BinaryProtocol2) || ntohs(header->version) != 2 ||
+            ntohl(header->payload_size) != len - sizeof(BinaryProtocol2)) {
+            ESP_LOGE(TAG, "Malformed binary message, %u bytes", len);
+            return;
+        }
+        RecordDownlinkTiming(ntohl(header->sequence), ntohl(header->timestamp));
+        packed = ntohs(header->type) == 1;
+        data = header->payload;
+        len -= sizeof(BinaryProtocol2);
+    }
+    if (!packed) {
+        on_incoming_audio_(OpusPacket(data, data + len));
+        return;
+    }
+
+    auto message = (const BinaryProtocolPacked*)data;
+    if (len < sizeof(BinaryProtocolPacked) || message->type != 0 ||
+        ntohs(message->payload_size) != len - sizeof(BinaryProtocolPacked)) {
+        ESP_LOGE(TAG, "Malformed packed audio, %u bytes", len);
+        return;
+    }
+    auto p = message->payload;
+    auto end = data + len;
+    for (int i = 0; i < message->frame_count; i++) {
+        if (end - p < (ptrdiff_t)sizeof(PackedFrameHeader)) {
+            ESP_LOGE(TAG, "Packed audio truncated at frame %d", i);
+            return;
+        }
+        auto header = (const PackedFrameHeader*)p;
+        size_t size = ntohs(header->size);
+        p += sizeof(PackedFrameHeader);
+        if ((size_t)(end - p) < size) {
+            ESP_LOGE(TAG, "Packed audio truncated at frame %d", i);
+            return;
+        }
+        on_incoming_audio_(OpusPacket(p, p + size));
+        p += size;
+    }
+}
+
+void Protocol::DropOldestAudio() {
+    // Control messages are never dropped, they are small and their order matters
+    for (auto it = send_queue_.begin(); it != send_queue_.end(); ++it) {
+        if (it->droppable) {
+            ReleaseSlots(send_queue_, it, std::next(it));
+            queued_audio_--;
+            send_stats_.dropped++;
+            return;
+        }
+    }
+}
+
+void Protocol::SendAudio(OpusPacket&& data, bool droppable) {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    if (droppable && queued_audio_ >= CONFIG_SEND_QUEUE_SIZE) {
+#if CONFIG_SEND_QUEUE_PAUSE_ENCODER
+        // Hold back the caller (the encoder) until the network catches up
+        send_stats_.paused++;
+        bool has_room = space_cv_.wait_for(lock, std::chrono::milliseconds(SEND_QUEUE_MAX_PAUSE_MS), [this]() {
+            return queued_audio_ < CONFIG_SEND_QUEUE_SIZE;
+        });
+        if (!has_room) {
+            DropOldestAudio();
+        }
+#else
+        DropOldestAudio();
+#endif
+    }
+    auto slot = TakeSlot();
+    slot->binary = true;
+    slot->droppable = droppable;
+    slot->data = std::move(data);
+    slot->queued_time = esp_timer_get_time();
+    send_queue_.splice(send_queue_.end(), free_slots_, slot);
+    TRACE_COUNTER("send_queue", send_queue_.size());
+    if (droppable) {
+        queued_audio_++;
+    }
+    if (send_queue_.size() > send_stats_.max_depth) {
+        send_stats_.max_depth = send_queue_.size();
+    }
+    lock.unlock();
+    send_cv_.notify_one();
+}
+
+void Protocol::SendText(std::string_view text) {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    auto slot = TakeSlot();
+    slot->binary = false;
+    slot->droppable = false;
+    slot->text.assign(text.data(), text.size());
+    slot->queued_time = esp_timer_get_time();
+    send_queue_.splice(send_queue_.end(), free_slots_, slot);
+    if (send_queue_.size() > send_stats_.max_depth) {
+        send_stats_.max_depth = send_queue_.size();
+    }
+    lock.unlock();
+    send_cv_.notify_one();
+}
+
+void Protocol::ClearSendQueue() {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    if (!send_queue_.empty()) {
+        ESP_LOGI(TAG, "Dropping %u queued messages of the previous session", send_queue_.size());
+    }
+    ReleaseSlots(send_queue_, send_queue_.begin(), send_queue_.end());
+    queued_audio_ = 0;
+    send_held_ = true;
+    lock.unlock();
+    space_cv_.notify_all();
+}
+
+void Protocol::StartSending(const JsonWriter& first) {
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    if (first.ok()) {
+        auto slot = TakeSlot();
+        slot->binary = false;
+        slot->droppable = false;
+        slot->text.assign(first.c_str(), first.size());
+        slot->queued_time = esp_timer_get_time();
+        send_queue_.splice(send_queue_.begin(), free_slots_, slot);
+    } else {
+        ESP_LOGE(TAG, "JSON message exceeds the message buffer, dropped");
+    }
+    send_held_ = false;
+    lock.unlock();
+    send_cv_.notify_one();
+}
+
+size_t Protocol::send_queue_depth() {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    return send_queue_.size();
+}
+
+SendQueueStats Protocol::send_queue_stats() {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    return send_stats_;
+}
+
+void Protocol::LogSendQueueStats() {
+    auto stats = send_queue_stats();
+    ESP_LOGI(TAG, "Send queue: sent %lu, dropped %lu, paused %lu, max depth %u",
+        stats.sent, stats.dropped, stats.paused, stats.max_depth);
+    send_duration_.Log(TAG);
+    send_queue_delay_.Log(TAG);
+    rtt_.Log(TAG);
+    if (binary_version_ >= 2) {
+        ESP_LOGI(TAG, "Downlink frames missing: %lu", downlink_lost_);
+        downlink_lateness_.Log(TAG);
+    }
+}
+
+#if CONFIG_SESSION_RECORDER
+// The recorder sits between the transports and the application, so it sees
+// exactly what the application gets: decrypted, reordered and unpacked
+void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+    on_incoming_json_ = [callback](const cJSON* root) {
+        char* json = cJSON_PrintUnformatted(root);
+        if (json != nullptr) {
+            SessionRecorder::GetInstance().RecordJson(json);
+            cJSON_free(json);
+        }
+        callback(root);
+    };
+}
+
+void Protocol::OnIncomingAudio(std::function<void(OpusPacket&& data)> callback) {
+    on_incoming_audio_ = [callback](OpusPacket&& data) {
+        SessionRecorder::GetInstance().RecordAudio(data.data(), data.size());
+        callback(std::move(data));
+    };
+}
+
+void Protocol::OnAudioChannelOpened(std::function<void()> callback) {
+    on_audio_channel_opened_ = [this, callback]() {
+        SessionRecorder::GetInstance().Begin(server_sample_rate_);
+        callback();
+    };
+}
+
+void Protocol::OnAudioChannelClosed(std::function<void()> callback) {
+    on_audio_channel_closed_ = [callback]() {
+        SessionRecorder::GetInstance().Finish();
+        callback();
+    };
+}
+#else
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(OpusPacket&& data)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -19,6 +410,7 @@ void Protocol::OnAudioChannelOpened(std::function<void()> callback) {
 void Protocol::OnAudioChannelClosed(std::function<void()> callback) {
     on_audio_channel_closed_ = callback;
 }
+#endif
 
 void Protocol::OnNetworkError(std::function<void(const std::string& message)> callback) {
     on_network_error_ = callback;
@@ -32,37 +424,51 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    StackJsonWriter<256> json;
+    json.BeginObject().AddString("session_id", session_id_).AddString("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        json.AddString("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    json.EndObject();
+    SendJson(json);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "detect")
+        .AddString("text", wake_word)
+        .EndObject();
+    SendJson(json);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "start");
     if (mode == kListeningModeAlwaysOn) {
-        message += ",\"mode\":\"realtime\"";
+        json.AddString("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        json.AddString("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        json.AddString("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    json.EndObject();
+    SendJson(json);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "listen")
+        .AddString("state", "stop")
+        .EndObject();
+    SendJson(json);
 }
 
 void Protocol::SendIotDescriptors(const std::string& descriptors) {
@@ -102,7 +508,7 @@ void Protocol::SendIotDescriptors(const std::string& descriptors) {
             continue;
         }
 
-        SendText(std::string(message));
+        SendText(message);
         cJSON_free(message);
         cJSON_Delete(messageRoot);
     }
@@ -111,8 +517,88 @@ void Protocol::SendIotDescriptors(const std::string& descriptors) {
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
-    SendText(message);
+    auto write = [this, &states](JsonWriter& json) {
+        json.BeginObject()
+            .AddString("session_id", session_id_)
+            .AddString("type", "iot")
+            .AddBool("update", true)
+            .AddRaw("states", states)
+            .EndObject();
+        SendJson(json);
+    };
+    // The states grow with the things a board has, build the message on the
+    // heap when they may not fit the stack buffer. Escaping can take up to 6
+    // bytes for each byte of the session id.
+    size_t capacity = states.size() + session_id_.size() * 6 + 64;
+    if (capacity <= 1024) {
+        StackJsonWriter<1024> json;
+        write(json);
+    } else {
+        HeapJsonWriter json(capacity);
+        write(json);
+    }
+}
+
+void Protocol::SendPing() {
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "ping")
+        .AddInt("timestamp", esp_timer_get_time() / 1000)
+        .EndObject();
+    SendJson(json);
+}
+
+void Protocol::SendFlowControl(bool pause) {
+    StackJsonWriter<256> json;
+    json.BeginObject()
+        .AddString("session_id", session_id_)
+        .AddString("type", "flow")
+        .AddString("state", pause ? "pause" : "resume")
+        .EndObject();
+    SendJson(json);
+}
+
+void Protocol::WriteHelloOptions(JsonWriter& hello) {
+#if CONFIG_AUDIO_CHANNEL_KEEP_WARM
+    // Ask the server to keep the channel open between conversations
+    hello.AddInt("idle_timeout", CONFIG_AUDIO_CHANNEL_IDLE_TIMEOUT);
+#endif
+#if CONFIG_ADAPTIVE_UPLINK
+    // The uplink may switch to longer frames when the network is congested
+    hello.AddInt("max_frame_duration", CONFIG_ADAPTIVE_UPLINK_MAX_FRAME_DURATION);
+#endif
+#if CONFIG_DECODE_QUEUE_PAUSE_SERVER
+    // Long replies may be paused with flow messages when the decode queue fills up
+    hello.AddBool("flow_control", true);
+#endif
+}
+
+void Protocol::ParseHelloOptions(const cJSON* root) {
+    // The server answers with the idle timeout it accepts, or not at all
+    auto idle_timeout = cJSON_GetObjectItem(root, "idle_timeout");
+    idle_timeout_ = cJSON_IsNumber(idle_timeout) ? idle_timeout->valueint : 0;
+    auto max_frame_duration = cJSON_GetObjectItem(root, "max_frame_duration");
+    max_frame_duration_ = cJSON_IsNumber(max_frame_duration) ? max_frame_duration->valueint : 0;
+    auto flow_control = cJSON_GetObjectItem(root, "flow_control");
+    flow_control_ = cJSON_IsTrue(flow_control);
+}
+
+void Protocol::ParsePong(const cJSON* root) {
+    auto timestamp = cJSON_GetObjectItem(root, "timestamp");
+    if (cJSON_IsNumber(timestamp)) {
+        rtt_ms_ = esp_timer_get_time() / 1000 - (int64_t)timestamp->valuedouble;
+        rtt_.Record((int64_t)rtt_ms_ * 1000);
+        ESP_LOGI(TAG, "Ping RTT: %d ms", rtt_ms_);
+    }
+}
+
+void Protocol::SendJson(const JsonWriter& json) {
+    if (!json.ok()) {
+        ESP_LOGE(TAG, "JSON message exceeds the message buffer, dropped");
+        return;
+    }
+    SendText(json.view());
 }
 
 bool Protocol::IsTimeout() const {
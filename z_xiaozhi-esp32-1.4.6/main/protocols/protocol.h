@@ -3,8 +3,20 @@
 
 #include <cJSON.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <chrono>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "json_writer.h"
+#include "histogram.h"
+#include "memory_tracker.h"
+#include "packet_pool.h"
 
 struct BinaryProtocol3 {
     uint8_t type;
@@ -13,6 +25,32 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+// Binary protocol version 2, negotiated with "version": 2 in the hello.
+// Uplink timestamps are capture times, downlink timestamps are the frame's
+// position in the server's audio stream. Multi-byte fields are big endian.
+struct BinaryProtocol2 {
+    uint16_t version;
+    uint16_t type;          // 0: one opus frame, 1: BinaryProtocolPacked
+    uint32_t sequence;
+    uint32_t timestamp;     // ms
+    uint32_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+// Several Opus frames in one binary message, used once both sides agreed on
+// frames_per_packet > 1 in the hello. Multi-byte fields are big endian.
+struct BinaryProtocolPacked {
+    uint8_t type;           // 0: opus frames
+    uint8_t frame_count;
+    uint16_t payload_size;  // bytes following this header
+    uint8_t payload[];      // frame_count x (PackedFrameHeader + opus data)
+} __attribute__((packed));
+
+struct PackedFrameHeader {
+    uint32_t timestamp;     // capture time in ms
+    uint16_t size;
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -24,9 +62,18 @@ enum ListeningMode {
     kListeningModeAlwaysOn // 需要 AEC 支持
 };
 
+// Counters of the uplink send queue
+struct SendQueueStats {
+    uint32_t sent = 0;
+    uint32_t dropped = 0;       // audio packets dropped because the queue was full
+    uint32_t paused = 0;        // times the encoder had to wait for room
+    size_t max_depth = 0;
+};
+
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    Protocol();
+    virtual ~Protocol();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
@@ -34,8 +81,29 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Idle timeout accepted by the server for a warm audio channel, 0 if none
+    inline int idle_timeout() const {
+        return idle_timeout_;
+    }
+    // Round trip time measured by the last ping, -1 if unknown
+    inline int rtt_ms() const {
+        return rtt_ms_;
+    }
+    // Longest uplink frame the server accepts, 0 if it did not negotiate it
+    inline int max_frame_duration() const {
+        return max_frame_duration_;
+    }
+    // The server echoed flow_control in its hello and honours flow messages
+    inline bool flow_control() const {
+        return flow_control_;
+    }
+    // Moving average of the time one network write takes
+    inline int send_latency_ms() const {
+        return send_latency_ms_;
+    }
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
+    // An empty packet marks a lost frame, the decoder should conceal it
+    void OnIncomingAudio(std::function<void(OpusPacket&& data)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
@@ -45,17 +113,32 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    // Queue an encoded packet, it is sent by the protocol's sender task.
+    // Packets that are not droppable (bursts of buffered audio) don't count
+    // against the queue size and are never discarded.
+    void SendAudio(OpusPacket&& data, bool droppable = true);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendIotDescriptors(const std::string& descriptors);
     virtual void SendIotStates(const std::string& states);
+    virtual void SendPing();
+    // Asks the server to hold back downlink audio, or to carry on
+    virtual void SendFlowControl(bool pause);
+
+    size_t send_queue_depth();
+    SendQueueStats send_queue_stats();
+    inline Histogram& send_duration() { return send_duration_; }
+    inline Histogram& send_queue_delay() { return send_queue_delay_; }
+    inline Histogram& rtt() { return rtt_; }
+    // How much later than the server's timestamps suggest downlink frames arrived
+    inline Histogram& downlink_lateness() { return downlink_lateness_; }
+    void LogSendQueueStats();
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<void(OpusPacket&& data)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
@@ -64,10 +147,79 @@ protected:
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    int idle_timeout_ = 0;
+    int rtt_ms_ = -1;
+    int max_frame_duration_ = 0;
+    bool flow_control_ = false;
+    // Frames per binary message negotiated in the hello, 1 means unpacked
+    std::atomic<int> frames_per_packet_ = 1;
+    // Binary protocol version accepted by the server, see BinaryProtocol2
+    std::atomic<int> binary_version_ = 1;
+
+    // Called on the sender task only, may block on socket I/O
+    virtual void WriteText(std::string_view text) = 0;
+    virtual void WriteAudio(const std::vector<uint8_t>& data) = 0;
 
-    virtual void SendText(const std::string& text) = 0;
+    void SendText(std::string_view text);
+    void SendJson(const JsonWriter& json);
+    // Drops what is queued for the previous session and holds back what is
+    // queued from now on, until StartSending()
+    void ClearSendQueue();
+    // Sends `first` (the hello) ahead of everything held back, then sends normally
+    void StartSending(const JsonWriter& first);
+    // Waits for the sender task to finish, call first thing in the destructor
+    // of a protocol, its WriteText/WriteAudio must not run any more
+    void StopSender();
+    void WriteHelloOptions(JsonWriter& hello);
+    void ParseHelloOptions(const cJSON* root);
+    void ParsePong(const cJSON* root);
+    // Pass a received binary message to the audio callback, unpacking it if needed
+    void DeliverIncomingAudio(const uint8_t* data, size_t len);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+
+private:
+    // Queue slots are recycled, so a control message is copied into the
+    // text capacity a slot already has instead of a new allocation
+    struct OutgoingPacket {
+        bool binary = false;
+        bool droppable = false;
+        OpusPacket data;
+        std::string text;
+        int64_t queued_time = 0;
+    };
+    using PacketList = std::list<OutgoingPacket, TaggedAllocator<OutgoingPacket, kMemoryTagProtocol>>;
+
+    std::mutex send_mutex_;
+    std::condition_variable send_cv_;
+    std::condition_variable space_cv_;
+    PacketList send_queue_;
+    PacketList free_slots_;
+    PacketList sending_;        // taken by the sender task, written outside the lock
+    size_t queued_audio_ = 0;   // droppable packets in the queue
+    bool send_held_ = false;    // between ClearSendQueue() and StartSending()
+    bool sender_stop_ = false;
+    bool sender_running_ = false;
+    SendQueueStats send_stats_;
+    Histogram send_duration_;
+    Histogram send_queue_delay_;
+    std::atomic<int> send_latency_ms_ = 0;
+    std::vector<uint8_t> pack_buffer_;  // used by the sender task only
+    uint32_t uplink_sequence_ = 0;
+    Histogram rtt_;
+    Histogram downlink_lateness_;
+    // Downlink timing, touched by the network task only
+    uint32_t downlink_sequence_ = 0;
+    int64_t downlink_offset_ = INT64_MAX;
+    uint32_t downlink_lost_ = 0;
+
+    void SenderLoop();
+    // send_mutex_ held for these
+    PacketList::iterator TakeSlot();
+    void ReleaseSlots(PacketList& list, PacketList::iterator first, PacketList::iterator last);
+    void DropOldestAudio();
+    void WriteAudioFrames(PacketList& frames);
+    void RecordDownlinkTiming(uint32_t sequence, uint32_t timestamp);
 };
 
 #endif // PROTOCOL_H
@@ -0,0 +1,120 @@
+#include "reorder_buffer.h"
+
+ReorderBuffer::ReorderBuffer(size_t window, size_t max_concealed)
+    : slots_(window > 0 ? window : 1), max_concealed_(max_concealed) {
+}
+
+void ReorderBuffer::OnPacket(std::function<void(OpusPacket&& payload)> callback) {
+    on_packet_ = callback;
+}
+
+void ReorderBuffer::Reset() {
+    for (auto& slot : slots_) {
+        slot.used = false;
+        slot.payload.clear();
+    }
+    started_ = false;
+    next_sequence_ = 0;
+    highest_sequence_ = 0;
+    received_mask_ = 0;
+    stats_ = Stats();
+}
+
+bool ReorderBuffer::HasPending() const {
+    for (auto& slot : slots_) {
+        if (slot.used) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReorderBuffer::Advance(bool conceal) {
+    auto& slot = SlotOf(next_sequence_);
+    bool received = slot.used && slot.sequence == next_sequence_;
+    received_mask_ = (received_mask_ << 1) | (received ? 1 : 0);
+    next_sequence_++;
+
+    if (received) {
+        slot.used = false;
+        if (on_packet_) {
+            on_packet_(std::move(slot.payload));
+        }
+        slot.payload.clear();
+        return;
+    }
+
+    stats_.lost++;
+    if (conceal && on_packet_) {
+        on_packet_(OpusPacket());
+    }
+}
+
+bool ReorderBuffer::Push(uint32_t sequence, OpusPacket&& payload) {
+    stats_.received++;
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    // Signed distance keeps the comparisons valid across sequence wrap-around
+    const int32_t offset = (int32_t)(sequence - next_sequence_);
+    const size_t window = slots_.size();
+
+    if (offset < 0) {
+        // Its frame has already been played or concealed
+        uint32_t age = (uint32_t)(-(int64_t)offset) - 1;
+        if (age < 64 && (received_mask_ >> age) & 1) {
+            stats_.duplicated++;
+        } else {
+            stats_.late++;
+        }
+        return HasPending();
+    }
+
+    if ((size_t)offset >= window) {
+        // Make room by giving up on the oldest positions
+        uint32_t skip = offset - window + 1;
+        if (skip <= max_concealed_) {
+            while (skip-- > 0) {
+                Advance(true);
+            }
+        } else {
+            // A large jump (server restart, long outage): don't synthesize seconds
+            // of concealment, drain what is held and resynchronize on this packet
+            for (size_t i = 0; i < window; i++) {
+                Advance(false);
+            }
+            uint32_t remaining = offset - window;
+            stats_.lost += remaining;
+            next_sequence_ += remaining;
+            received_mask_ = remaining >= 64 ? 0 : received_mask_ << remaining;
+        }
+    }
+
+    auto& slot = SlotOf(sequence);
+    if (slot.used && slot.sequence == sequence) {
+        stats_.duplicated++;
+        return HasPending();
+    }
+    if ((int32_t)(sequence - highest_sequence_) < 0) {
+        stats_.reordered++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+    slot.used = true;
+    slot.sequence = sequence;
+    slot.payload = std::move(payload);
+
+    while (SlotOf(next_sequence_).used) {
+        Advance(true);
+    }
+    return HasPending();
+}
+
+void ReorderBuffer::Flush() {
+    while (HasPending()) {
+        Advance(true);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <functional>
+
+#include "packet_pool.h"
+
+// Puts sequenced audio packets back in order.
+// Packets that arrive early are held for up to `window` positions. A gap that
+// is given up on is delivered as an empty packet, so the decoder can run
+// packet loss concealment for exactly that frame.
+class ReorderBuffer {
+public:
+    struct Stats {
+        uint32_t received = 0;
+        uint32_t lost = 0;          // never arrived in time, concealed or skipped
+        uint32_t reordered = 0;     // arrived after a later packet but still in time
+        uint32_t duplicated = 0;
+        uint32_t late = 0;          // arrived after its frame had been concealed
+    };
+
+    ReorderBuffer(size_t window, size_t max_concealed);
+
+    void OnPacket(std::function<void(OpusPacket&& payload)> callback);
+    void Reset();
+    // Returns true while packets are held back waiting for a gap to fill
+    bool Push(uint32_t sequence, OpusPacket&& payload);
+    // Give up on the pending gaps and deliver everything that is held
+    void Flush();
+    bool HasPending() const;
+
+    inline const Stats& stats() const { return stats_; }
+
+private:
+    struct Slot {
+        bool used = false;
+        uint32_t sequence = 0;
+        OpusPacket payload;
+    };
+
+    std::vector<Slot> slots_;
+    size_t max_concealed_;
+    bool started_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    // Bit n is set if sequence (next_sequence_ - 1 - n) was actually received
+    uint64_t received_mask_ = 0;
+    Stats stats_;
+    std::function<void(OpusPacket&& payload)> on_packet_;
+
+    void Advance(bool conceal);
+    inline Slot& SlotOf(uint32_t sequence) { return slots_[sequence % slots_.size()]; }
+};
+
+#endif // REORDER_BUFFER_H
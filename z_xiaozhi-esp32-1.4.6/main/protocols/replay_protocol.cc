@@ -0,0 +1,140 @@
+#include "replay_protocol.h"
+#include "session_recorder.h"
+#include "stack_monitor.h"
+
+#include <cstring>
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include "assets/lang_config.h"
+
+#define TAG "Replay"
+
+ReplayProtocol::ReplayProtocol() {
+    event_group_handle_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_handle_, REPLAY_PROTOCOL_STOPPED_EVENT);
+}
+
+ReplayProtocol::~ReplayProtocol() {
+    StopSender();
+    CloseAudioChannel();
+    vEventGroupDelete(event_group_handle_);
+}
+
+void ReplayProtocol::Start() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SESSION_PARTITION_LABEL);
+    if (partition_ == nullptr) {
+        ESP_LOGE(TAG, "No %s partition, nothing to replay", SESSION_PARTITION_LABEL);
+    }
+}
+
+void ReplayProtocol::WriteText(std::string_view text) {
+    ESP_LOGD(TAG, "Discard text: %.*s", (int)text.size(), text.data());
+}
+
+void ReplayProtocol::WriteAudio(const std::vector<uint8_t>& data) {
+}
+
+bool ReplayProtocol::IsAudioChannelOpened() const {
+    return playing_ && !error_occurred_;
+}
+
+void ReplayProtocol::CloseAudioChannel() {
+    stop_requested_ = true;
+    xEventGroupWaitBits(event_group_handle_, REPLAY_PROTOCOL_STOPPED_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+}
+
+bool ReplayProtocol::OpenAudioChannel() {
+    CloseAudioChannel();
+    error_occurred_ = false;
+
+    SessionHeader header;
+    if (partition_ == nullptr || esp_partition_read(partition_, 0, &header, sizeof(header)) != ESP_OK ||
+        header.magic != SESSION_MAGIC || header.version != SESSION_VERSION ||
+        sizeof(header) + header.size > partition_->size) {
+        ESP_LOGE(TAG, "No valid session in the %s partition", SESSION_PARTITION_LABEL);
+        SetError(Lang::Strings::SERVER_NOT_FOUND);
+        return false;
+    }
+    ESP_LOGI(TAG, "Replaying %lu bytes at %d%% speed", header.size, CONFIG_SESSION_REPLAY_SPEED);
+
+    server_sample_rate_ = header.sample_rate;
+    session_id_ = "replay";
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    stop_requested_ = false;
+    playing_ = true;
+    xEventGroupClearBits(event_group_handle_, REPLAY_PROTOCOL_STOPPED_EVENT);
+    xTaskCreate([](void* arg) {
+        auto protocol = (ReplayProtocol*)arg;
+        protocol->ReplayLoop();
+        StackMonitor::GetInstance().RecordCurrentTask();
+        vTaskDelete(NULL);
+    }, "replay", CONFIG_REPLAY_STACK_SIZE, this, 4, nullptr);
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void ReplayProtocol::ReplayLoop() {
+    SessionHeader header;
+    esp_partition_read(partition_, 0, &header, sizeof(header));
+
+    // Records are read straight from flash, one at a time
+    std::vector<uint8_t> data;
+    size_t offset = sizeof(header);
+    size_t end = sizeof(header) + header.size;
+    int64_t start_time = esp_timer_get_time();
+    while (!stop_requested_ && offset + sizeof(SessionRecord) <= end) {
+        SessionRecord record;
+        if (esp_partition_read(partition_, offset, &record, sizeof(record)) != ESP_OK ||
+            offset + sizeof(record) + record.size > end) {
+            ESP_LOGE(TAG, "Corrupted record at offset %u", offset);
+            break;
+        }
+        data.resize(record.size);
+        if (record.size > 0 && esp_partition_read(partition_, offset + sizeof(record), data.data(), record.size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read record at offset %u", offset);
+            break;
+        }
+        offset += sizeof(record) + record.size;
+
+        int64_t due = start_time + (int64_t)record.time_ms * 1000 * 100 / CONFIG_SESSION_REPLAY_SPEED;
+        int64_t wait_us = due - esp_timer_get_time();
+        if (wait_us > 0) {
+            // Round up to whole ticks, a record may come up to a tick late but
+            // never early, and the schedule doesn't drift since due is absolute
+            int64_t tick_us = portTICK_PERIOD_MS * 1000;
+            vTaskDelay((wait_us + tick_us - 1) / tick_us);
+        }
+        if (stop_requested_) {
+            break;
+        }
+
+        last_incoming_time_ = std::chrono::steady_clock::now();
+        if (record.type == kSessionRecordAudio) {
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(OpusPacket(data.begin(), data.end()));
+            }
+        } else if (record.type == kSessionRecordJson) {
+            data.push_back('\0');
+            auto root = cJSON_Parse((const char*)data.data());
+            if (root != nullptr && on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
+            cJSON_Delete(root);
+        }
+        data.clear();
+    }
+
+    ESP_LOGI(TAG, "Replay finished");
+    bool closed_by_device = stop_requested_;
+    playing_ = false;
+    xEventGroupSetBits(event_group_handle_, REPLAY_PROTOCOL_STOPPED_EVENT);
+    // Like a server hanging up at the end of the recording
+    if (!closed_by_device && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
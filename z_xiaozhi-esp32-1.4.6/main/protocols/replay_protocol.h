@@ -0,0 +1,39 @@
+#ifndef _REPLAY_PROTOCOL_H_
+#define _REPLAY_PROTOCOL_H_
+
+
+#include "protocol.h"
+
+#include <atomic>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#define REPLAY_PROTOCOL_STOPPED_EVENT (1 << 0)
+
+// Plays back the session stored in the session partition (see
+// SessionRecorder) instead of talking to a server. Incoming messages are
+// delivered with their recorded timing, scaled by CONFIG_SESSION_REPLAY_SPEED;
+// everything the device sends is discarded.
+class ReplayProtocol : public Protocol {
+public:
+    ReplayProtocol();
+    ~ReplayProtocol();
+
+    void Start() override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+private:
+    EventGroupHandle_t event_group_handle_;
+    const esp_partition_t* partition_ = nullptr;
+    std::atomic<bool> playing_ = false;
+    std::atomic<bool> stop_requested_ = false;
+
+    void ReplayLoop();
+    void WriteText(std::string_view text) override;
+    void WriteAudio(const std::vector<uint8_t>& data) override;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "session_recorder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <mbedtls/base64.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "stack_monitor.h"
+
+#define TAG "SessionRecorder"
+
+void SessionRecorder::Begin(int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (saving_) {
+        ESP_LOGW(TAG, "Previous session is still being saved, not recording this one");
+        return;
+    }
+    if (buffer_ == nullptr) {
+        // Kept for the lifetime of the firmware, sessions are recorded one after another
+        buffer_ = (uint8_t*)heap_caps_malloc(CONFIG_SESSION_RECORDER_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr) {
+            buffer_ = (uint8_t*)heap_caps_malloc(CONFIG_SESSION_RECORDER_BUFFER_SIZE, MALLOC_CAP_DEFAULT);
+        }
+        if (buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %d bytes, recording disabled", CONFIG_SESSION_RECORDER_BUFFER_SIZE);
+            return;
+        }
+        capacity_ = CONFIG_SESSION_RECORDER_BUFFER_SIZE;
+    }
+    size_ = 0;
+    truncated_ = false;
+    sample_rate_ = sample_rate;
+    start_time_ = esp_timer_get_time();
+    recording_ = true;
+}
+
+void SessionRecorder::RecordJson(std::string_view json) {
+    Append(kSessionRecordJson, (const uint8_t*)json.data(), json.size());
+}
+
+void SessionRecorder::RecordAudio(const uint8_t* data, size_t size) {
+    Append(kSessionRecordAudio, data, size);
+}
+
+void SessionRecorder::Append(SessionRecordType type, const uint8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_ || truncated_) {
+        return;
+    }
+    if (size > UINT16_MAX || size_ + sizeof(SessionRecord) + size > capacity_) {
+        ESP_LOGW(TAG, "Buffer full after %u bytes, the rest of the session is not recorded", size_);
+        truncated_ = true;
+        return;
+    }
+
+    auto record = (SessionRecord*)(buffer_ + size_);
+    record->time_ms = (esp_timer_get_time() - start_time_) / 1000;
+    record->type = type;
+    record->reserved = 0;
+    record->size = size;
+    memcpy(record->data, data, size);
+    size_ += sizeof(SessionRecord) + size;
+}
+
+void SessionRecorder::Finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_) {
+        return;
+    }
+    recording_ = false;
+    ESP_LOGI(TAG, "Session recorded: %u bytes%s", size_, truncated_ ? " (truncated)" : "");
+
+    // Called on the main loop or the network task, which must not wait for the flash
+    saving_ = true;
+    auto ret = xTaskCreate([](void* arg) {
+        auto recorder = (SessionRecorder*)arg;
+        recorder->Save();
+        StackMonitor::GetInstance().RecordCurrentTask();
+        vTaskDelete(NULL);
+    }, "session_save", CONFIG_SESSION_SAVE_STACK_SIZE, this, 1, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the session save task");
+        saving_ = false;
+    }
+}
+
+// The buffer is left alone while saving_ is set, so it is read without the lock
+void SessionRecorder::Save() {
+    SaveToPartition();
+#if CONFIG_SESSION_RECORDER_DUMP_SERIAL
+    DumpToSerial();
+#endif
+    std::lock_guard<std::mutex> lock(mutex_);
+    saving_ = false;
+}
+
+void SessionRecorder::SaveToPartition() {
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SESSION_PARTITION_LABEL);
+    if (partition == nullptr) {
+        return;
+    }
+
+    SessionHeader header = {SESSION_MAGIC, SESSION_VERSION, (uint16_t)sample_rate_, (uint32_t)size_};
+    size_t total = sizeof(header) + size_;
+    if (total > partition->size) {
+        ESP_LOGW(TAG, "Session does not fit in the partition (%u > %lu bytes)", total, partition->size);
+        return;
+    }
+
+    size_t erase_size = (total + partition->erase_size - 1) / partition->erase_size * partition->erase_size;
+    esp_err_t err = esp_partition_erase_range(partition, 0, erase_size);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, sizeof(header), buffer_, size_);
+    }
+    if (err == ESP_OK) {
+        // The header goes last, so an interrupted save never looks valid
+        err = esp_partition_write(partition, 0, &header, sizeof(header));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save the session: %s", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Session saved to partition %s", SESSION_PARTITION_LABEL);
+}
+
+void SessionRecorder::DumpToSerial() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_ == nullptr || recording_) {
+        return;
+    }
+
+    SessionHeader header = {SESSION_MAGIC, SESSION_VERSION, (uint16_t)sample_rate_, (uint32_t)size_};
+    // 57 bytes encode to one 76 character line; the header is a multiple of
+    // 3 bytes, so the lines can simply be concatenated by the decoder
+    unsigned char line[80];
+    size_t length;
+    printf("-----BEGIN XIAOZHI SESSION-----\n");
+    mbedtls_base64_encode(line, sizeof(line), &length, (const unsigned char*)&header, sizeof(header));
+    printf("%.*s\n", (int)length, line);
+    for (size_t offset = 0; offset < size_; offset += 57) {
+        size_t chunk = size_ - offset < 57 ? size_ - offset : 57;
+        mbedtls_base64_encode(line, sizeof(line), &length, buffer_ + offset, chunk);
+        printf("%.*s\n", (int)length, line);
+    }
+    printf("-----END XIAOZHI SESSION-----\n");
+}
@@ -0,0 +1,79 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+
+// Data partition that holds the last recorded session, add it to the
+// partition table to keep sessions across reboots and to replay them
+#define SESSION_PARTITION_LABEL "session"
+#define SESSION_MAGIC 0x52535a58    // "XZSR"
+#define SESSION_VERSION 1
+
+// Layout of a recorded session, in the partition and in serial dumps.
+// A header is followed by `size` bytes of SessionRecord. Little endian.
+struct SessionHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t sample_rate;   // sample rate of the downlink audio
+    uint32_t size;
+} __attribute__((packed));
+
+enum SessionRecordType {
+    kSessionRecordJson = 0,
+    kSessionRecordAudio = 1,    // an empty audio record is a lost frame
+};
+
+struct SessionRecord {
+    uint32_t time_ms;       // arrival time since the audio channel opened
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t size;
+    uint8_t data[];
+} __attribute__((packed));
+
+// Captures everything the server sends during one audio channel session,
+// with arrival times, so that it can be fed back by ReplayProtocol.
+// Records go to a PSRAM buffer, once it is full the rest of the session is
+// not recorded. Saving erases and writes flash for up to a few seconds, so it
+// runs in a low priority task; a session that begins meanwhile is not recorded.
+class SessionRecorder {
+public:
+    static SessionRecorder& GetInstance() {
+        static SessionRecorder instance;
+        return instance;
+    }
+    SessionRecorder(const SessionRecorder&) = delete;
+    SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+    void Begin(int sample_rate);
+    void RecordJson(std::string_view json);
+    void RecordAudio(const uint8_t* data, size_t size);
+    // Ends the session and saves it to the session partition if there is one,
+    // returns before the save is done
+    void Finish();
+    // Print the last session as base64 between BEGIN/END markers,
+    // scripts/session_tool.py turns a captured log back into a file
+    void DumpToSerial();
+
+private:
+    SessionRecorder() = default;
+
+    std::mutex mutex_;
+    uint8_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    bool recording_ = false;
+    bool truncated_ = false;
+    bool saving_ = false;
+    int sample_rate_ = 0;
+    int64_t start_time_ = 0;
+
+    void Append(SessionRecordType type, const uint8_t* data, size_t size);
+    void Save();
+    void SaveToPartition();
+};
+
+#endif // SESSION_RECORDER_H
@@ -2,6 +2,9 @@
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
+#if CONFIG_SESSION_RECORDER
+#include "session_recorder.h"
+#endif
 
 #include <cstring>
 #include <cJSON.h>
@@ -16,64 +19,94 @@ WebsocketProtocol::WebsocketProtocol() {
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-    }
+    StopSender();
+    websocket_.reset();
     vEventGroupDelete(event_group_handle_);
 }
 
 void WebsocketProtocol::Start() {
 }
 
-void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
-    if (websocket_ == nullptr) {
+std::shared_ptr<WebSocket> WebsocketProtocol::GetWebsocket() const {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    return websocket_;
+}
+
+void WebsocketProtocol::ReleaseWebsocket() {
+    std::shared_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket.swap(websocket_);
+    }
+    if (websocket != nullptr) {
+        // If the sender task is writing, it drops the last reference once its send returns
+        websocket->Close();
+    }
+}
+
+void WebsocketProtocol::WriteAudio(const std::vector<uint8_t>& data) {
+    auto websocket = GetWebsocket();
+    if (websocket == nullptr) {
         return;
     }
 
-    websocket_->Send(data.data(), data.size(), true);
+    websocket->Send(data.data(), data.size(), true);
 }
 
-void WebsocketProtocol::SendText(const std::string& text) {
-    if (websocket_ == nullptr) {
+void WebsocketProtocol::WriteText(std::string_view text) {
+    auto websocket = GetWebsocket();
+    if (websocket == nullptr) {
         return;
     }
 
-    if (!websocket_->Send(text)) {
-        ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+    // A send cut short by closing the channel is not an error
+    if (!websocket->Send(text.data(), text.size(), false) && GetWebsocket() == websocket) {
+        ESP_LOGE(TAG, "Failed to send text: %.*s", (int)text.size(), text.data());
         SetError(Lang::Strings::SERVER_ERROR);
     }
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr || !websocket_->IsConnected()) {
+            return false;
+        }
+    }
+    return !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-        websocket_ = nullptr;
-    }
+    // Nothing of this session goes to the next connection
+    ClearSendQueue();
+    ReleaseWebsocket();
+    LogSendQueueStats();
+#if CONFIG_SESSION_RECORDER
+    // Closing from the device side does not report a disconnect
+    SessionRecorder::GetInstance().Finish();
+#endif
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-    }
+    // Messages queued from here on wait for the hello of the new connection
+    ClearSendQueue();
+    ReleaseWebsocket();
 
     error_occurred_ = false;
+    frames_per_packet_ = 1;
+    binary_version_ = 1;
     std::string url = CONFIG_WEBSOCKET_URL;
     std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
-    websocket_ = Board::GetInstance().CreateWebSocket();
-    websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
-
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    // The sender task only gets to see the websocket once it is connected
+    std::shared_ptr<WebSocket> websocket(Board::GetInstance().CreateWebSocket());
+    websocket->SetHeader("Authorization", token.c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(WEBSOCKET_PROTOCOL_VERSION).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
-            }
+            DeliverIncomingAudio((const uint8_t*)data, len);
         } else {
             // Parse JSON data
             auto root = cJSON_Parse(data);
@@ -81,6 +114,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
             if (type != NULL) {
                 if (strcmp(type->valuestring, "hello") == 0) {
                     ParseServerHello(root);
+                } else if (strcmp(type->valuestring, "pong") == 0) {
+                    ParsePong(root);
                 } else {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
@@ -94,29 +129,42 @@ bool WebsocketProtocol::OpenAudioChannel() {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
-    if (!websocket_->Connect(url.c_str())) {
+    if (!websocket->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
         SetError(Lang::Strings::SERVER_NOT_FOUND);
         return false;
     }
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket_ = std::move(websocket);
+    }
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    websocket_->Send(message);
+    StackJsonWriter<256> hello;
+    hello.BeginObject()
+        .AddString("type", "hello")
+        .AddInt("version", WEBSOCKET_PROTOCOL_VERSION)
+        .AddString("transport", "websocket")
+        .BeginObject("audio_params")
+            .AddString("format", "opus")
+            .AddInt("sample_rate", 16000)
+            .AddInt("channels", 1)
+            .AddInt("frame_duration", OPUS_FRAME_DURATION_MS)
+#if CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET > 1
+            .AddInt("frames_per_packet", CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET)
+#endif
+        .EndObject();
+    WriteHelloOptions(hello);
+    hello.EndObject();
+    StartSending(hello);
 
     // Wait for server hello
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -140,12 +188,31 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         return;
     }
 
+    ParseHelloOptions(root);
+
+#if WEBSOCKET_PROTOCOL_VERSION >= 2
+    // Servers that only know version 1 answer without a version or with 1
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint >= 2) {
+        binary_version_ = 2;
+        ESP_LOGI(TAG, "Using binary protocol version 2");
+    }
+#endif
+
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (audio_params != NULL) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (sample_rate != NULL) {
             server_sample_rate_ = sample_rate->valueint;
         }
+#if CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET > 1
+        // Both directions switch to packed messages if the server agrees
+        auto frames_per_packet = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+        if (cJSON_IsNumber(frames_per_packet) && frames_per_packet->valueint > 1) {
+            frames_per_packet_ = std::min(frames_per_packet->valueint, CONFIG_WEBSOCKET_MAX_FRAMES_PER_PACKET);
+            ESP_LOGI(TAG, "Packing up to %d frames per message", frames_per_packet_.load());
+        }
+#endif
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
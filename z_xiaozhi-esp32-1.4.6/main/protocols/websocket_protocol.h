@@ -7,26 +7,41 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <mutex>
+#include <memory>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+#if CONFIG_WEBSOCKET_BINARY_PROTOCOL_V2
+#define WEBSOCKET_PROTOCOL_VERSION 2
+#else
+#define WEBSOCKET_PROTOCOL_VERSION 1
+#endif
+
 class WebsocketProtocol : public Protocol {
 public:
     WebsocketProtocol();
     ~WebsocketProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
-    WebSocket* websocket_ = nullptr;
-
+    // Writes happen on the sender task, channel changes on the main loop.
+    // The sender keeps its own reference while it writes, so closing the
+    // channel never waits for a blocked send.
+    std::shared_ptr<WebSocket> websocket_;
+    mutable std::mutex channel_mutex_;
+
+    std::shared_ptr<WebSocket> GetWebsocket() const;
+    // Closes the current websocket, which also makes a blocked send return
+    void ReleaseWebsocket();
     void ParseServerHello(const cJSON* root);
-    void SendText(const std::string& text) override;
+    void WriteText(std::string_view text) override;
+    void WriteAudio(const std::vector<uint8_t>& data) override;
 };
 
 #endif
@@ -0,0 +1,86 @@
+#include "rate_controller.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "RateController"
+
+RateController::RateController(int min_duration_ms, int max_duration_ms, int min_bitrate, int max_bitrate, int step_ms)
+    : min_duration_ms_(min_duration_ms), max_duration_ms_(max_duration_ms), step_ms_(step_ms), duration_ms_(min_duration_ms),
+    min_bitrate_(min_bitrate), max_bitrate_(max_bitrate), bitrate_(max_bitrate) {
+}
+
+void RateController::SetMaxDuration(int max_duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_duration_ms_ = max_duration_ms < min_duration_ms_ ? min_duration_ms_ : max_duration_ms;
+    clear_seconds_ = 0;
+    congested_seconds_ = 0;
+    seconds_to_step_up_ = kSecondsToStepUp;
+    last_step_up_ = false;
+    seconds_since_step_ = 0;
+    last_queue_depth_ = 0;
+    if (duration_ms_ > max_duration_ms_) {
+        duration_ms_ = max_duration_ms_;
+    }
+    if (max_duration_ms_ == min_duration_ms_) {
+        ESP_LOGI(TAG, "Server takes no frames longer than %d ms, uplink frame duration is fixed", min_duration_ms_);
+    }
+}
+
+void RateController::Update(size_t queue_depth, size_t queue_size, int send_latency_ms, int rtt_ms) {
+    bool congested = queue_depth * 2 >= queue_size || send_latency_ms > kCongestedLatencyMs ||
+        rtt_ms > kCongestedRttMs;
+    bool clear = queue_depth <= 1 && send_latency_ms < kClearLatencyMs && rtt_ms < kClearRttMs;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A queue that is draining already carries the current frames, leave it be
+    if (queue_depth < last_queue_depth_) {
+        congested = false;
+    }
+    last_queue_depth_ = queue_depth;
+
+    // Anything between the two thresholds keeps the current setting
+    congested_seconds_ = congested ? congested_seconds_ + 1 : 0;
+    clear_seconds_ = clear ? clear_seconds_ + 1 : 0;
+    seconds_since_step_++;
+
+    int duration = duration_ms_;
+    int bitrate = bitrate_;
+    if (congested_seconds_ >= kSecondsToStepDown && (bitrate > min_bitrate_ || duration < max_duration_ms_)) {
+        // Congested soon after a recovery, wait twice as long before the next one.
+        // A recovery that held for that long starts over from the short wait.
+        if (last_step_up_ && seconds_since_step_ <= seconds_to_step_up_) {
+            seconds_to_step_up_ = std::min(seconds_to_step_up_ * 2, kMaxSecondsToStepUp);
+        } else if (last_step_up_) {
+            seconds_to_step_up_ = kSecondsToStepUp;
+        }
+        if (bitrate > min_bitrate_) {
+            bitrate = std::max(bitrate - kBitrateStep, min_bitrate_);
+        } else {
+            duration += step_ms_;
+        }
+        congested_seconds_ = 0;
+        last_step_up_ = false;
+    } else if (clear_seconds_ >= seconds_to_step_up_ && (bitrate < max_bitrate_ || duration > min_duration_ms_)) {
+        if (duration > min_duration_ms_) {
+            duration -= step_ms_;
+        } else {
+            bitrate = std::min(bitrate + kBitrateStep, max_bitrate_);
+        }
+        clear_seconds_ = 0;
+        last_step_up_ = true;
+    } else {
+        return;
+    }
+    seconds_since_step_ = 0;
+
+    if (duration > max_duration_ms_) {
+        duration = max_duration_ms_;
+    } else if (duration < min_duration_ms_) {
+        duration = min_duration_ms_;
+    }
+    ESP_LOGI(TAG, "Uplink %d ms %d bps -> %d ms %d bps (queue %u, latency %d ms, rtt %d ms)",
+        duration_ms_.load(), bitrate_.load(), duration, bitrate, queue_depth, send_latency_ms, rtt_ms);
+    duration_ms_ = duration;
+    bitrate_ = bitrate;
+}
@@ -0,0 +1,63 @@
+#ifndef RATE_CONTROLLER_H
+#define RATE_CONTROLLER_H
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+
+// Picks the uplink Opus bitrate and frame duration from transport backpressure.
+// A congested uplink first gets a lower bitrate, which any server decodes and
+// which applies to the running encoder. Below the lowest bitrate it gets longer
+// frames: fewer packets per second and less per-packet overhead (TLS record,
+// websocket or UDP header). Recovery goes back the same way, shorter frames
+// first.
+// Decisions need several consecutive observations (hysteresis) and back off
+// faster than they recover. A recovery that runs straight back into congestion
+// doubles the time before the next one, so a link that only just fits the
+// longer frames settles there instead of flapping.
+//
+// The duration range is [min, max]. Application passes the server's
+// max_frame_duration as max, a server that does not announce one (the stock
+// server) leaves max == min and the duration fixed. A bitrate range of 0 leaves
+// the bitrate to the encoder.
+class RateController {
+public:
+    RateController(int min_duration_ms, int max_duration_ms, int min_bitrate = 0, int max_bitrate = 0,
+        int step_ms = 20);
+
+    // Feed one observation per second while audio is being sent.
+    // rtt_ms < 0 means unknown. Update and SetMaxDuration may run on different tasks.
+    void Update(size_t queue_depth, size_t queue_size, int send_latency_ms, int rtt_ms);
+    void SetMaxDuration(int max_duration_ms);
+
+    inline int frame_duration() const { return duration_ms_; }
+    // 0 while the bitrate is left to the encoder
+    inline int bitrate() const { return bitrate_; }
+
+private:
+    static constexpr int kCongestedLatencyMs = 150;
+    static constexpr int kClearLatencyMs = 50;
+    static constexpr int kCongestedRttMs = 600;
+    static constexpr int kClearRttMs = 300;
+    static constexpr int kSecondsToStepDown = 2;
+    static constexpr int kSecondsToStepUp = 10;
+    static constexpr int kMaxSecondsToStepUp = 160;
+    static constexpr int kBitrateStep = 2000;
+
+    std::mutex mutex_;
+    int min_duration_ms_;
+    int max_duration_ms_;
+    int step_ms_;
+    std::atomic<int> duration_ms_;
+    int min_bitrate_;
+    int max_bitrate_;
+    std::atomic<int> bitrate_;
+    int congested_seconds_ = 0;
+    int clear_seconds_ = 0;
+    int seconds_to_step_up_ = kSecondsToStepUp;
+    int seconds_since_step_ = 0;
+    size_t last_queue_depth_ = 0;
+    bool last_step_up_ = false;
+};
+
+#endif // RATE_CONTROLLER_H
@@ -67,6 +67,30 @@ void Settings::SetInt(const std::string& key, int32_t value) {
     }
 }
 
+std::vector<uint8_t> Settings::GetBlob(const std::string& key) {
+    std::vector<uint8_t> value;
+    if (nvs_handle_ == 0) {
+        return value;
+    }
+
+    size_t length = 0;
+    if (nvs_get_blob(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
+        return value;
+    }
+    value.resize(length);
+    ESP_ERROR_CHECK(nvs_get_blob(nvs_handle_, key.c_str(), value.data(), &length));
+    return value;
+}
+
+void Settings::SetBlob(const std::string& key, const void* data, size_t size) {
+    if (read_write_) {
+        ESP_ERROR_CHECK(nvs_set_blob(nvs_handle_, key.c_str(), data, size));
+        dirty_ = true;
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
+
 void Settings::EraseKey(const std::string& key) {
     if (read_write_) {
         auto ret = nvs_erase_key(nvs_handle_, key.c_str());
@@ -2,6 +2,7 @@
 #define SETTINGS_H
 
 #include <string>
+#include <vector>
 #include <nvs_flash.h>
 
 class Settings {
@@ -13,6 +14,8 @@ public:
     void SetString(const std::string& key, const std::string& value);
     int32_t GetInt(const std::string& key, int32_t default_value = 0);
     void SetInt(const std::string& key, int32_t value);
+    std::vector<uint8_t> GetBlob(const std::string& key);
+    void SetBlob(const std::string& key, const void* data, size_t size);
     void EraseKey(const std::string& key);
     void EraseAll();
 
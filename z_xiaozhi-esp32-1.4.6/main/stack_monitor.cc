@@ -0,0 +1,136 @@
+#include "stack_monitor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "StackMonitor"
+
+#define ADD_TASK(name, option) Add(name, #option, CONFIG_##option)
+
+StackMonitor::StackMonitor() {
+    ADD_TASK("main_loop", MAIN_LOOP_STACK_SIZE);
+    ADD_TASK("background_task", BACKGROUND_TASK_STACK_SIZE);
+    ADD_TASK("protocol_send", PROTOCOL_SEND_STACK_SIZE);
+    ADD_TASK("open_channel", OPEN_CHANNEL_STACK_SIZE);
+    ADD_TASK("boot_stage", BOOT_STAGE_STACK_SIZE);
+    ADD_TASK("check_new_version", CHECK_NEW_VERSION_STACK_SIZE);
+#if !CONFIG_DISABLE_OTA_UPDATE
+    ADD_TASK("ota_writer", OTA_WRITER_STACK_SIZE);
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+    ADD_TASK("audio_communication", AUDIO_COMMUNICATION_STACK_SIZE);
+#endif
+#if CONFIG_USE_WAKE_WORD_DETECT
+    ADD_TASK("audio_detection", AUDIO_DETECTION_STACK_SIZE);
+    ADD_TASK("encode_detect_packets", WAKE_WORD_ENCODE_STACK_SIZE);
+#endif
+#if CONFIG_SESSION_REPLAY
+    ADD_TASK("replay", REPLAY_STACK_SIZE);
+#endif
+#if CONFIG_SESSION_RECORDER
+    ADD_TASK("session_save", SESSION_SAVE_STACK_SIZE);
+#endif
+#if CONFIG_CPU_MONITOR
+    ADD_TASK("cpu_monitor", CPU_MONITOR_STACK_SIZE);
+#endif
+    // ESP-IDF's tasks, sized by their own options
+    ADD_TASK("main", ESP_MAIN_TASK_STACK_SIZE);
+    ADD_TASK("esp_timer", ESP_TIMER_TASK_STACK_SIZE);
+    ADD_TASK("sys_evt", ESP_SYSTEM_EVENT_TASK_STACK_SIZE);
+    ADD_TASK("tiT", LWIP_TCPIP_TASK_STACK_SIZE);
+}
+
+void StackMonitor::Add(const char* name, const char* option, uint32_t size) {
+    if (task_count_ < kMaxTasks) {
+        tasks_[task_count_++] = {name, option, size, UINT32_MAX, false};
+    }
+}
+
+// Peak plus a quarter and 512 bytes of margin, in 512 byte steps. Paths that
+// the soak run did not take (an error log with a long format string, an
+// OTA) still need some room.
+int StackMonitor::Recommend(uint32_t peak) {
+    uint32_t size = peak + peak / 4 + 512;
+    return (size + 511) / 512 * 512;
+}
+
+void StackMonitor::Record(const char* task_name, uint32_t stack_free) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[i];
+        // FreeRTOS keeps configMAX_TASK_NAME_LEN - 1 characters of a task name,
+        // "check_new_version" comes back as "check_new_versi"
+        if (strncmp(task.name, task_name, configMAX_TASK_NAME_LEN - 1) != 0) {
+            continue;
+        }
+        if (stack_free < task.min_free) {
+            task.min_free = stack_free;
+        }
+        if (!task.warned && task.min_free < task.size / 10) {
+            ESP_LOGW(TAG, "%s used %" PRIu32 " of %" PRIu32 " bytes of stack, increase CONFIG_%s",
+                task.name, task.size - task.min_free, task.size, task.option);
+            task.warned = true;
+        }
+        return;
+    }
+}
+
+void StackMonitor::RecordCurrentTask() {
+    Record(pcTaskGetName(nullptr), uxTaskGetStackHighWaterMark(nullptr));
+}
+
+void StackMonitor::Scan() {
+#if configUSE_TRACE_FACILITY
+    // Room for a few tasks created in between
+    std::vector<TaskStatus_t> status(uxTaskGetNumberOfTasks() + 4);
+    int count = uxTaskGetSystemState(status.data(), status.size(), nullptr);
+    for (int i = 0; i < count; i++) {
+        Record(status[i].pcTaskName, status[i].usStackHighWaterMark);
+    }
+#endif
+}
+
+std::string StackMonitor::GetJson() {
+    Scan();
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json = "[";
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[i];
+        bool seen = task.min_free != UINT32_MAX;
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "%s{\"name\":\"%s\",\"size\":%" PRIu32 ",\"peak\":%" PRId32 ",\"recommended\":%d}",
+            i ? "," : "", task.name, task.size, seen ? (int32_t)(task.size - task.min_free) : -1,
+            seen ? Recommend(task.size - task.min_free) : -1);
+        json += buffer;
+    }
+    json += "]";
+    return json;
+}
+
+void StackMonitor::Print() {
+    Scan();
+    std::lock_guard<std::mutex> lock(mutex_);
+    printf("| %-21s |  Size |  Peak | Recommended\n", "Task");
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[i];
+        if (task.min_free == UINT32_MAX) {
+            printf("| %-21s | %5" PRIu32 " |     - |           -\n", task.name, task.size);
+            continue;
+        }
+        uint32_t peak = task.size - task.min_free;
+        printf("| %-21s | %5" PRIu32 " | %5" PRIu32 " | %11d\n", task.name, task.size, peak, Recommend(peak));
+    }
+    // Only tasks that ran, a size that never got exercised is no evidence
+    printf("\n# sdkconfig_append\n");
+    for (int i = 0; i < task_count_; i++) {
+        auto& task = tasks_[i];
+        if (task.min_free != UINT32_MAX) {
+            printf("CONFIG_%s=%d\n", task.option, Recommend(task.size - task.min_free));
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef STACK_MONITOR_H
+#define STACK_MONITOR_H
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+
+// Peak stack use since boot of the tasks whose stack size is configurable,
+// ours in the "Task stack sizes" menu and a few of ESP-IDF's. After a soak
+// run Print() turns the peaks into suggested sizes, as sdkconfig lines that
+// go into a board's sdkconfig_append.
+// A task's high-water mark already is its peak, so long lived tasks are read
+// when a report is made; tasks that delete themselves record theirs on the
+// way out, the peak of the worst run is kept.
+class StackMonitor {
+public:
+    static StackMonitor& GetInstance() {
+        static StackMonitor instance;
+        return instance;
+    }
+    StackMonitor(const StackMonitor&) = delete;
+    StackMonitor& operator=(const StackMonitor&) = delete;
+
+    // stack_free is the task's high-water mark in bytes, unknown names are ignored
+    void Record(const char* task_name, uint32_t stack_free);
+    // Call right before the calling task deletes itself
+    void RecordCurrentTask();
+    // Reads the high-water marks of all tasks alive now
+    void Scan();
+
+    // [{"name":..,"size":..,"peak":..,"recommended":..},...], peak and recommended are -1 until the task was seen
+    std::string GetJson();
+    // Table and sdkconfig lines, for the console
+    void Print();
+
+private:
+    static constexpr int kMaxTasks = 20;
+
+    struct TaskStack {
+        const char* name;
+        const char* option;     // Kconfig symbol of the stack size
+        uint32_t size;
+        uint32_t min_free;      // UINT32_MAX until seen
+        bool warned;
+    };
+
+    StackMonitor();
+    void Add(const char* name, const char* option, uint32_t size);
+    static int Recommend(uint32_t peak);
+
+    std::mutex mutex_;
+    TaskStack tasks_[kMaxTasks];
+    int task_count_ = 0;
+};
+
+#endif // STACK_MONITOR_H
@@ -13,7 +13,6 @@ public:
     static size_t GetFreeHeapSize();
     static std::string GetMacAddress();
     static std::string GetChipModelName();
-    static esp_err_t PrintRealTimeStats(TickType_t xTicksToWait);
 };
 
 #endif // _SYSTEM_INFO_H_
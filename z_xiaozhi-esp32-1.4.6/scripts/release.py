@@ -1,7 +1,9 @@
 import sys
 import os
 import json
+import struct
 import zipfile
+import zlib
 
 # 切换到项目根目录
 os.chdir(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -30,12 +32,34 @@ def merge_bin():
         print("merge bin failed")
         sys.exit(1)
 
+# 压缩的 OTA 固件：48 字节的头（小端），后面是 zlib 压缩的 app 固件，与 main/ota.cc 对应
+OTA_COMPRESSED_MAGIC = b"XZOC"
+OTA_COMPRESSION_ZLIB = 1
+
+def compress_bin():
+    with open("build/xiaozhi.bin", "rb") as f:
+        image = f.read()
+    # esp_app_desc_t 紧跟在 image header (24) 和 segment header (8) 之后，version 在其中的偏移 16
+    version = image[48:80]
+    # 默认 32 KB 的窗口，设备端 tinfl 的窗口也是 32 KB
+    compressed = zlib.compress(image, 9)
+    header = struct.pack("<4sB3xII32s", OTA_COMPRESSED_MAGIC, OTA_COMPRESSION_ZLIB,
+                         len(image), len(compressed), version)
+    output_path = "build/xiaozhi-ota.bin.z"
+    with open(output_path, "wb") as f:
+        f.write(header)
+        f.write(compressed)
+    print(f"compress bin to {output_path}: {len(image)} -> {len(header) + len(compressed)} bytes")
+    return output_path
+
 def zip_bin(board_type, project_version):
     output_path = f"releases/v{project_version}_{board_type}.zip"
     if os.path.exists(output_path):
         os.remove(output_path)
+    compressed_path = compress_bin()
     with zipfile.ZipFile(output_path, 'w') as zipf:
         zipf.write("build/merged-binary.bin", arcname="merged-binary.bin")
+        zipf.write(compressed_path, arcname=os.path.basename(compressed_path))
     print(f"zip bin to {output_path} done")
     
 
@@ -0,0 +1,88 @@
+# Extract and inspect sessions recorded by the firmware (CONFIG_SESSION_RECORDER)
+#
+#   python session_tool.py extract monitor.log session.bin   # from a serial dump
+#   python session_tool.py info session.bin                  # timeline and audio gaps
+#
+# To replay a session on a device, flash it to the "session" partition:
+#   parttool.py write_partition --partition-name session --input session.bin
+import base64
+import json
+import struct
+import sys
+
+SESSION_MAGIC = 0x52535a58
+HEADER = struct.Struct("<IHHI")      # magic, version, sample_rate, size
+RECORD = struct.Struct("<IBBH")      # time_ms, type, reserved, size
+
+
+def extract(log_file, output_file):
+    sessions = []
+    lines = None
+    with open(log_file, errors="ignore") as f:
+        for line in f:
+            line = line.strip()
+            if line.endswith("-----BEGIN XIAOZHI SESSION-----"):
+                lines = []
+            elif line.endswith("-----END XIAOZHI SESSION-----") and lines is not None:
+                sessions.append(b"".join(base64.b64decode(l) for l in lines))
+                lines = None
+            elif lines is not None:
+                lines.append(line)
+    if not sessions:
+        sys.exit("no session found in " + log_file)
+    # The last dump is the most recent session
+    with open(output_file, "wb") as f:
+        f.write(sessions[-1])
+    print(f"found {len(sessions)} session(s), wrote the last one ({len(sessions[-1])} bytes) to {output_file}")
+
+
+def info(session_file):
+    with open(session_file, "rb") as f:
+        data = f.read()
+    magic, version, sample_rate, size = HEADER.unpack_from(data)
+    if magic != SESSION_MAGIC:
+        sys.exit("not a session file")
+    print(f"version {version}, sample rate {sample_rate}, {size} bytes of records")
+
+    offset = HEADER.size
+    end = HEADER.size + size
+    audio_frames = lost_frames = 0
+    last_audio_ms = None
+    gaps = []
+    while offset + RECORD.size <= end:
+        time_ms, kind, _, length = RECORD.unpack_from(data, offset)
+        payload = data[offset + RECORD.size:offset + RECORD.size + length]
+        offset += RECORD.size + length
+        if kind == 0:
+            message = json.loads(payload)
+            print(f"{time_ms:8d} ms  {json.dumps(message, ensure_ascii=False)}")
+            if message.get("type") == "tts" and message.get("state") in ("start", "stop"):
+                last_audio_ms = None
+        else:
+            audio_frames += 1
+            if length == 0:
+                lost_frames += 1
+            if last_audio_ms is not None:
+                gaps.append((time_ms - last_audio_ms, time_ms))
+            last_audio_ms = time_ms
+
+    print(f"audio frames {audio_frames}, lost {lost_frames}")
+    if gaps:
+        gaps.sort(reverse=True)
+        print("largest gaps between audio frames during playback:")
+        for gap, time_ms in gaps[:10]:
+            print(f"  {gap:6d} ms before the frame at {time_ms} ms")
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == "extract":
+        extract(sys.argv[2], sys.argv[3])
+    elif len(sys.argv) == 3 and sys.argv[1] == "info":
+        info(sys.argv[2])
+    else:
+        print("Usage: python session_tool.py extract <log> <session.bin> | info <session.bin>")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+# Convert an event trace printed by the firmware (CONFIG_EVENT_TRACE, console
+# command "trace dump") into a JSON file for chrome://tracing or ui.perfetto.dev
+#
+#   python trace_to_chrome.py monitor.log trace.json
+#
+# If the log holds several dumps, the last one is converted.
+import json
+import sys
+
+
+def parse(log_file):
+    dumps = []
+    lines = None
+    with open(log_file, errors="ignore") as f:
+        for line in f:
+            line = line.strip()
+            if line.endswith("-----BEGIN XIAOZHI TRACE-----"):
+                lines = []
+            elif line.endswith("-----END XIAOZHI TRACE-----") and lines is not None:
+                dumps.append(lines)
+                lines = None
+            elif lines is not None:
+                lines.append(line)
+    if not dumps:
+        raise SystemExit(f"No trace found in {log_file}")
+    return dumps[-1]
+
+
+def convert(lines):
+    now = 0
+    task_names = {}
+    events = {}
+    for line in lines:
+        fields = line.split(" ", 6)
+        if fields[0] == "now":
+            now = int(fields[1])
+        elif fields[0] == "task":
+            task_names[fields[1]] = fields[2] if len(fields) > 2 else fields[1]
+        elif fields[0] == "event" and len(fields) == 7:
+            core, time_us, phase, task, value, name = fields[1:]
+            events.setdefault(int(core), []).append((int(time_us), phase, task, int(value), name))
+
+    # Event times are 32 bit and wrap every ~71 minutes, walk each core's
+    # ring backwards from the dump time to recover the full timestamps.
+    # Tasks preempted between taking the time and writing the event leave
+    # neighbours slightly out of order, so the step is signed: a small
+    # negative one is a later event, not one 71 minutes earlier.
+    trace_events = []
+    for core, core_events in events.items():
+        last = now
+        for time_us, phase, task, value, name in reversed(core_events):
+            delta = ((last & 0xffffffff) - time_us) & 0xffffffff
+            if delta >= 1 << 31:
+                delta -= 1 << 32
+            last -= delta
+            event = {"name": name, "ph": phase, "ts": last, "pid": 1, "tid": task}
+            if phase == "C":
+                event["args"] = {name: value}
+            elif phase == "i":
+                event["s"] = "t"
+            trace_events.append(event)
+
+    trace_events.sort(key=lambda e: e["ts"])
+    for task in {e["tid"] for e in trace_events}:
+        trace_events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": task,
+                             "args": {"name": task_names.get(task, task)}})
+    trace_events.append({"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "xiaozhi"}})
+    return trace_events
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(f"Usage: {sys.argv[0]} <monitor log> <trace.json>")
+        sys.exit(1)
+    trace_events = convert(parse(sys.argv[1]))
+    with open(sys.argv[2], "w") as f:
+        json.dump({"traceEvents": trace_events, "displayTimeUnit": "ms"}, f)
+    print(f"Wrote {len(trace_events)} events to {sys.argv[2]}")
+
+
+if __name__ == "__main__":
+    main()